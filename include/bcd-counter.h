@@ -0,0 +1,92 @@
+#ifndef BCD_COUNTER_H
+#define BCD_COUNTER_H
+
+#include <stdint.h>
+
+// Incremental decimal counter for the 4-digit display.
+//
+// Holds the displayed time as one decimal digit per panel (digits[0] is the
+// leftmost panel) and advances it by the number of ticks elapsed since the
+// last frame, carrying only into the digits that roll over. A stall of any
+// length is caught up in a single call, and the result always equals the
+// elapsed time divided by the tick length. Each call reports which panels
+// changed so the renderer can skip the others.
+
+#define BCD_DIGITS 4
+
+typedef struct {
+  uint8_t digits[BCD_DIGITS];
+  uint32_t ticks;      // Ticks currently shown
+  uint32_t tickUs;     // Length of one tick of the last digit (microseconds)
+  bool saturate;       // On overflow hold all nines, otherwise show zeros
+  bool overflowed;
+  uint8_t changed;     // Panels changed since the last bcdAdvance() (bit n = panel n)
+} BcdCounter;
+
+// Function to set the counter to zero, the next bcdAdvance() reports every panel
+inline void bcdReset(BcdCounter &c, uint32_t tickUs, bool saturate) {
+  for (int i = 0; i < BCD_DIGITS; i++) c.digits[i] = 0;
+  c.ticks = 0;
+  c.tickUs = tickUs;
+  c.saturate = saturate;
+  c.overflowed = false;
+  c.changed = (1 << BCD_DIGITS) - 1;
+}
+
+// Function to add a number of ticks, carrying from the last digit upwards
+inline void bcdAddTicks(BcdCounter &c, uint32_t delta) {
+  c.ticks += delta;
+  if (c.overflowed) return;
+
+  uint32_t carry = delta;
+  for (int i = BCD_DIGITS - 1; i >= 0 && carry != 0; i--) {
+    uint32_t value = c.digits[i] + carry;
+    if (value < 10) {
+      carry = 0;
+    } else if (value < 20) {
+      value -= 10;  // Usual case, a single roll-over
+      carry = 1;
+    } else {
+      carry = value / 10;
+      value %= 10;
+    }
+    if (value != c.digits[i]) {
+      c.digits[i] = value;
+      c.changed |= (1 << i);
+    }
+  }
+
+  if (carry != 0) {
+    // Ran past the last digit
+    c.overflowed = true;
+    for (int i = 0; i < BCD_DIGITS; i++) c.digits[i] = c.saturate ? 9 : 0;
+    c.changed = (1 << BCD_DIGITS) - 1;
+  }
+}
+
+// Function to bring the counter up to an elapsed time
+// Returns the panels that changed since the last call
+inline uint8_t bcdAdvance(BcdCounter &c, int64_t elapsedUs) {
+  int64_t elapsedTicks = elapsedUs > 0 ? elapsedUs / c.tickUs : 0;
+  uint32_t ticks = elapsedTicks < UINT32_MAX ? (uint32_t)elapsedTicks : UINT32_MAX;
+  if (ticks < c.ticks) {
+    // Time went backwards (start time was corrected) - count up from zero again
+    uint8_t shown[BCD_DIGITS];
+    for (int i = 0; i < BCD_DIGITS; i++) shown[i] = c.digits[i];
+    uint8_t changed = c.changed;
+    bcdReset(c, c.tickUs, c.saturate);
+    bcdAddTicks(c, ticks);
+    for (int i = 0; i < BCD_DIGITS; i++) {
+      if (c.digits[i] != shown[i]) changed |= (1 << i);
+    }
+    c.changed = changed;
+  } else if (ticks > c.ticks) {
+    bcdAddTicks(c, ticks - c.ticks);
+  }
+
+  uint8_t changed = c.changed;
+  c.changed = 0;
+  return changed;
+}
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stdint.h>
+
+// NTP-style clock synchronisation between the top and bottom units.
+//
+// Every ping/pong carries the transmit time of the message plus the transmit
+// and receive times of the last message heard from the peer. Each side turns
+// that into a four-timestamp sample:
+//   t1 = our transmit, t2 = peer receive, t3 = peer transmit, t4 = our receive
+//   offset = ((t2 - t1) + (t3 - t4)) / 2   (peer clock minus local clock)
+//   delay  = (t4 - t1) - (t3 - t2)         (round trip without peer turnaround)
+//
+// Queueing and retries only ever add delay, to one direction or the other, so
+// a sample bounds the offset rather than measuring it: t2 - t1 is the offset
+// plus the up delay and t3 - t4 the offset less the down delay. Over a window of
+// samples the drift is the slope that leaves the widest gap between the lowest
+// t2 - t1 and the highest t3 - t4 (found where the lower hull of the one crosses
+// the upper hull of the other), and the offset is the middle of that gap over
+// the newest half of the window. Each side of the gap is set by the fastest
+// frames in its own direction, so a slow frame costs nothing; what is left is
+// half the asymmetry between the two directions, which no round trip can see.
+// All times are esp_timer microseconds.
+
+#define CLOCK_SYNC_WINDOW 128            // Samples kept, one per ping interval (about 9 minutes at the idle rate)
+#define CLOCK_SYNC_MAX_DELAY 50000       // Discard anything slower than this outright (microseconds)
+#define CLOCK_SYNC_MAX_DRIFT 0.0002      // Crystal tolerance bound on the drift estimate (200 ppm)
+
+typedef struct {
+  int64_t localTime; // t4 of the sample
+  int64_t ahead;     // t2 - t1: offset plus the up delay
+  int64_t behind;    // t3 - t4: offset less the down delay
+} ClockSample;
+
+typedef struct {
+  ClockSample samples[CLOCK_SYNC_WINDOW];
+  int count;
+  int next;
+  bool valid;
+  int64_t refTime;   // Local time the estimate below is anchored to
+  int64_t offset;    // Peer minus local clock at refTime (microseconds)
+  double drift;      // Peer clock rate relative to local (0.00002 = 20 ppm fast)
+  double rate;       // Fitted drift before the crystal bound, smoothed across fits
+  bool driftValid;
+  int64_t rtt;       // Minimum round trip delay in the window (microseconds)
+  unsigned long accepted; // Samples taken into the window
+  unsigned long rejected; // Samples discarded: no timestamps, out of order or too slow
+} ClockSync;
+
+// Function to reset the estimator, e.g. after the peer reboots
+inline void clockSyncReset(ClockSync &cs) {
+  cs.count = 0;
+  cs.next = 0;
+  cs.valid = false;
+  cs.refTime = 0;
+  cs.offset = 0;
+  cs.drift = 0.0;
+  cs.rate = 0.0;
+  cs.driftValid = false;
+  cs.rtt = 0;
+  cs.accepted = 0;
+  cs.rejected = 0;
+}
+
+// Function to get the k-th oldest sample in the window
+inline const ClockSample &clockSyncSample(const ClockSync &cs, int k) {
+  return cs.samples[(cs.next + CLOCK_SYNC_WINDOW - cs.count + k) % CLOCK_SYNC_WINDOW];
+}
+
+// Function to get the turn a -> b -> c makes, positive if it is to the left
+inline int64_t clockSyncTurn(const ClockSample &a, int64_t ay, const ClockSample &b, int64_t by,
+                             const ClockSample &c, int64_t cy) {
+  return (b.localTime - a.localTime) * (cy - ay) - (by - ay) * (c.localTime - a.localTime);
+}
+
+// Function to re-fit offset and drift from the samples in the window
+inline void clockSyncFit(ClockSync &cs) {
+  const ClockSample &newest = clockSyncSample(cs, cs.count - 1);
+  int64_t ref = newest.localTime;
+  cs.rtt = newest.ahead - newest.behind;
+  for (int k = 0; k < cs.count - 1; k++) {
+    const ClockSample &s = clockSyncSample(cs, k);
+    if (s.ahead - s.behind < cs.rtt) cs.rtt = s.ahead - s.behind;
+  }
+
+  if (cs.count >= 3 && ref - clockSyncSample(cs, 0).localTime >= 2000000) {
+    // Lower hull of the ahead values and upper hull of the behind values,
+    // oldest first
+    uint8_t lower[CLOCK_SYNC_WINDOW], upper[CLOCK_SYNC_WINDOW];
+    int nl = 0, nu = 0;
+    for (int k = 0; k < cs.count; k++) {
+      const ClockSample &s = clockSyncSample(cs, k);
+      while (nl >= 2) {
+        const ClockSample &a = clockSyncSample(cs, lower[nl - 2]), &b = clockSyncSample(cs, lower[nl - 1]);
+        if (clockSyncTurn(a, a.ahead, b, b.ahead, s, s.ahead) > 0) break;
+        nl--;
+      }
+      lower[nl++] = k;
+      while (nu >= 2) {
+        const ClockSample &a = clockSyncSample(cs, upper[nu - 2]), &b = clockSyncSample(cs, upper[nu - 1]);
+        if (clockSyncTurn(a, a.behind, b, b.behind, s, s.behind) < 0) break;
+        nu--;
+      }
+      upper[nu++] = k;
+    }
+
+    // Raising the slope from the bottom, the gap grows while the lowest ahead
+    // value is older than the highest behind value. Walk both hulls' edges in
+    // slope order until they pass each other; the edge that gets there is the
+    // slope with the widest gap
+    int i = 0, j = nu - 1;
+    int64_t dy = 0, dx = 0;
+    while (clockSyncSample(cs, lower[i]).localTime < clockSyncSample(cs, upper[j]).localTime) {
+      const ClockSample &a0 = clockSyncSample(cs, lower[i]);
+      const ClockSample &b1 = clockSyncSample(cs, upper[j]);
+      bool lowerNext = j == 0;
+      if (i + 1 < nl && j > 0) {
+        const ClockSample &a1 = clockSyncSample(cs, lower[i + 1]), &b0 = clockSyncSample(cs, upper[j - 1]);
+        lowerNext = (a1.ahead - a0.ahead) * (b1.localTime - b0.localTime) <
+                    (b1.behind - b0.behind) * (a1.localTime - a0.localTime);
+      }
+      if (lowerNext) {
+        const ClockSample &a1 = clockSyncSample(cs, lower[++i]);
+        dy = a1.ahead - a0.ahead;
+        dx = a1.localTime - a0.localTime;
+      } else {
+        const ClockSample &b0 = clockSyncSample(cs, upper[--j]);
+        dy = b1.behind - b0.behind;
+        dx = b1.localTime - b0.localTime;
+      }
+    }
+
+    if (dx > 0) {
+      // A single window is short, so the slope is smoothed across fits
+      double slope = (double)dy / (double)dx;
+      cs.rate = cs.driftValid ? cs.rate + (slope - cs.rate) / 8 : slope;
+      cs.drift = cs.rate;
+      if (cs.drift > CLOCK_SYNC_MAX_DRIFT) cs.drift = CLOCK_SYNC_MAX_DRIFT;
+      if (cs.drift < -CLOCK_SYNC_MAX_DRIFT) cs.drift = -CLOCK_SYNC_MAX_DRIFT;
+      cs.driftValid = true;
+    }
+  }
+
+  // Middle of the gap over the newest half, carried to the newest sample with
+  // the fitted rate. Newer samples track a drift change sooner, and the fitted
+  // rate rather than the clamped drift keeps a clock beyond the crystal bound
+  // on its samples
+  double lowestAhead = 0, highestBehind = 0;
+  for (int k = cs.count / 2; k < cs.count; k++) {
+    const ClockSample &s = clockSyncSample(cs, k);
+    double carried = cs.rate * (double)(s.localTime - ref);
+    double ahead = (double)(s.ahead - newest.ahead) - carried;
+    double behind = (double)(s.behind - newest.behind) - carried;
+    if (k == cs.count / 2 || ahead < lowestAhead) lowestAhead = ahead;
+    if (k == cs.count / 2 || behind > highestBehind) highestBehind = behind;
+  }
+  cs.offset = (newest.ahead + newest.behind) / 2 + (int64_t)((lowestAhead + highestBehind) / 2);
+  cs.refTime = ref;
+  cs.valid = true;
+}
+
+// Function to add a four-timestamp sample, returns false if it was rejected
+inline bool clockSyncAddSample(ClockSync &cs, int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+  int64_t delay = (t4 - t1) - (t3 - t2);
+  if (t1 == 0 || t2 == 0 || delay < 0 || delay > CLOCK_SYNC_MAX_DELAY ||
+      (cs.count > 0 && t4 <= clockSyncSample(cs, cs.count - 1).localTime)) {
+    cs.rejected++;
+    return false;
+  }
+
+  ClockSample &s = cs.samples[cs.next];
+  s.localTime = t4;
+  s.ahead = t2 - t1;
+  s.behind = t3 - t4;
+  cs.next = (cs.next + 1) % CLOCK_SYNC_WINDOW;
+  if (cs.count < CLOCK_SYNC_WINDOW) cs.count++;
+  cs.accepted++;
+  clockSyncFit(cs);
+  return true;
+}
+
+// Function to get the peer-minus-local offset at a local time
+inline int64_t clockSyncOffsetAt(const ClockSync &cs, int64_t localTime) {
+  return cs.offset + (int64_t)(cs.drift * (double)(localTime - cs.refTime));
+}
+
+// Function to convert a peer timestamp to the local clock
+inline int64_t clockSyncToLocal(const ClockSync &cs, int64_t peerTime) {
+  int64_t approx = peerTime - cs.offset;
+  return peerTime - clockSyncOffsetAt(cs, approx);
+}
+
+// Function to convert a local timestamp to the peer clock
+inline int64_t clockSyncToPeer(const ClockSync &cs, int64_t localTime) {
+  return localTime + clockSyncOffsetAt(cs, localTime);
+}
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef DEFERRED_LOG_H
+#define DEFERRED_LOG_H
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <type_traits>
+#include "hal.h"
+#include "event-queue.h"
+#include "log-formats.h"
+
+// Deferred logging for the time-critical paths.
+//
+// logEvent() copies a format ID (log-formats.h), its arguments and a
+// timestamp into a ring buffer and returns; it never waits for Serial. A
+// low-priority task (logDrainTask) writes the records out. When the ring is
+// full the record is dropped and counted, and the drain task reports the
+// count as a LOG_DROPPED message. Any task may log; pushes are serialised by
+// a spinlock held only for the copy.
+//
+// Records go out in binary and tools/log-decode.py turns them back into text,
+// leaving ordinary Serial text alone. Define LOG_TEXT_OUTPUT to have the drain
+// task format the text itself instead (always the case in the simulator).
+//
+// Binary frame: 0x1E, u16 format ID (little-endian), u8 argument count,
+// u8 double mask (bit i = argument i is a double), u32 timestamp
+// (microseconds, low 32 bits), then each argument as a zigzag varint or, for
+// doubles, 8 bytes little-endian.
+
+#if defined(STOPWATCH_NATIVE) && !defined(LOG_TEXT_OUTPUT)
+#define LOG_TEXT_OUTPUT
+#endif
+
+#define LOG_MAX_ARGS 6
+#define LOG_QUEUE_SIZE 32        // Records buffered, must be a power of two
+#define LOG_DRAIN_INTERVAL 20    // Drain task wake-up period (ms)
+#define LOG_FRAME_START 0x1E
+#define LOG_FRAME_MAX (9 + LOG_MAX_ARGS * 10)
+
+typedef struct {
+  uint32_t timeUs;
+  uint16_t format;
+  uint8_t argCount;
+  uint8_t doubleMask;
+  int64_t args[LOG_MAX_ARGS];
+} LogRecord;
+
+struct DeferredLog {
+  EventQueue<LogRecord, LOG_QUEUE_SIZE> records;   // overflows counts dropped records
+  portMUX_TYPE pushMux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+// Functions to store one argument of a record
+inline void logStoreArg(LogRecord &r, int i, double value) {
+  memcpy(&r.args[i], &value, sizeof(value));
+  r.doubleMask |= (1 << i);
+}
+
+inline void logStoreArg(LogRecord &r, int i, float value) {
+  logStoreArg(r, i, (double)value);
+}
+
+template <typename T>
+inline void logStoreArg(LogRecord &r, int i, T value) {
+  static_assert(std::is_integral<T>::value || std::is_enum<T>::value,
+                "log arguments must be integers or doubles");
+  r.args[i] = (int64_t)value;
+}
+
+inline void logStoreArgs(LogRecord &, int) {}
+
+template <typename T, typename... Rest>
+inline void logStoreArgs(LogRecord &r, int i, T first, Rest... rest) {
+  logStoreArg(r, i, first);
+  logStoreArgs(r, i + 1, rest...);
+}
+
+// Function to queue a log message, never blocks; returns false if it was dropped
+template <typename... Args>
+inline bool logEvent(DeferredLog &dl, LogFormat format, Args... args) {
+  static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+  LogRecord r;
+  r.timeUs = (uint32_t)halMicros();
+  r.format = format;
+  r.argCount = sizeof...(Args);
+  r.doubleMask = 0;
+  logStoreArgs(r, 0, args...);
+
+  portENTER_CRITICAL(&dl.pushMux);
+  bool queued = queuePush(dl.records, r);
+  portEXIT_CRITICAL(&dl.pushMux);
+  return queued;
+}
+
+// Function to format a record as text, argument types come from the record
+inline void logFormat(const LogRecord &r, char *out, size_t size) {
+  if (r.format >= LOG_FORMAT_COUNT) {
+    snprintf(out, size, "unknown log format %u", r.format);
+    return;
+  }
+  const char *f = logFormatStrings[r.format];
+  size_t pos = 0;
+  int arg = 0;
+  while (*f != '\0' && pos + 1 < size) {
+    if (*f != '%' || f[1] == '%') {
+      out[pos++] = *f;
+      f += (*f == '%') ? 2 : 1;
+      continue;
+    }
+
+    // Copy one conversion specification, e.g. "%02X" or "%lld"
+    char spec[16];
+    size_t len = 0;
+    int longs = 0;
+    do {
+      if (*f == 'l') longs++;
+      if (len < sizeof(spec) - 1) spec[len++] = *f;
+      f++;
+    } while (*f != '\0' && strchr("diouxXcfeEgG", *f) == NULL);
+    if (*f != '\0') spec[len++] = *f++;
+    spec[len] = '\0';
+
+    int64_t value = arg < r.argCount ? r.args[arg] : 0;
+    int n;
+    if (r.doubleMask & (1 << arg)) {
+      double d;
+      memcpy(&d, &value, sizeof(d));
+      n = snprintf(out + pos, size - pos, spec, d);
+    } else if (longs >= 2) {
+      n = snprintf(out + pos, size - pos, spec, (long long)value);
+    } else if (longs == 1) {
+      n = snprintf(out + pos, size - pos, spec, (long)value);
+    } else {
+      n = snprintf(out + pos, size - pos, spec, (int)value);
+    }
+    if (n > 0) pos = min(pos + n, size - 1);
+    arg++;
+  }
+  out[pos] = '\0';
+}
+
+// Function to append a zigzag varint to a frame
+inline size_t logPutVarint(uint8_t *out, int64_t value) {
+  uint64_t v = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+  size_t len = 0;
+  while (v >= 0x80) {
+    out[len++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  out[len++] = (uint8_t)v;
+  return len;
+}
+
+// Function to write one record to Serial (drain task)
+inline void logWrite(const LogRecord &r) {
+#ifdef LOG_TEXT_OUTPUT
+  char text[160];
+  logFormat(r, text, sizeof(text));
+  Serial.println(text);
+#else
+  uint8_t frame[LOG_FRAME_MAX];
+  size_t len = 0;
+  frame[len++] = LOG_FRAME_START;
+  frame[len++] = r.format & 0xFF;
+  frame[len++] = r.format >> 8;
+  frame[len++] = r.argCount;
+  frame[len++] = r.doubleMask;
+  for (int i = 0; i < 4; i++) frame[len++] = (r.timeUs >> (8 * i)) & 0xFF;
+  for (int i = 0; i < r.argCount; i++) {
+    if (r.doubleMask & (1 << i)) {
+      for (int b = 0; b < 8; b++) frame[len++] = ((uint64_t)r.args[i] >> (8 * b)) & 0xFF;
+    } else {
+      len += logPutVarint(frame + len, r.args[i]);
+    }
+  }
+  Serial.write(frame, len); // One write, so other Serial output can't split the frame
+#endif
+}
+
+// Log drain task - writes queued records to Serial, arg is the DeferredLog
+inline void logDrainTask(void *arg) {
+  DeferredLog &dl = *(DeferredLog *)arg;
+  uint32_t droppedSeen = 0;
+  for (;;) {
+    LogRecord r;
+    while (queuePop(dl.records, r)) {
+      logWrite(r);
+    }
+
+    uint32_t dropped = dl.records.overflows.load(std::memory_order_relaxed);
+    if (dropped != droppedSeen) {
+      r.timeUs = (uint32_t)halMicros();
+      r.format = LOG_DROPPED;
+      r.argCount = 1;
+      r.doubleMask = 0;
+      r.args[0] = dropped - droppedSeen;
+      logWrite(r);
+      droppedSeen = dropped;
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_INTERVAL));
+  }
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef DIGIT_GLYPHS_H
+#define DIGIT_GLYPHS_H
+
+#include <stdint.h>
+
+// Digit glyphs for the 8x8 panels, shared by all stopwatch sketches.
+//
+// The base digit and decimal point patterns below are only used at compile
+// time: glyphTable holds every digit already merged with each decimal point
+// variant, so drawing a panel is one lookup and an 8-byte copy. Everything
+// here is const, so it stays in flash instead of being copied to RAM.
+
+// Define 8x8 patterns for digits 0-9
+// Each byte represents a row, MSB is leftmost pixel
+constexpr uint8_t digitPatterns[10][8] = {
+  // Digit 0
+  {
+    0b00111100,  // Row 0: __XXXX__
+    0b01100110,  // Row 1: _XX__XX_
+    0b01100110,  // Row 2: _XX__XX_
+    0b01100110,  // Row 3: _XX__XX_
+    0b01100110,  // Row 4: _XX__XX_
+    0b01100110,  // Row 5: _XX__XX_
+    0b00111100,  // Row 6: __XXXX__
+    0b00000000   // Row 7: ________
+  },
+  // Digit 1
+  {
+    0b00011000,  // Row 0: ___XX___
+    0b00111000,  // Row 1: __XXX___
+    0b00011000,  // Row 2: ___XX___
+    0b00011000,  // Row 3: ___XX___
+    0b00011000,  // Row 4: ___XX___
+    0b00011000,  // Row 5: ___XX___
+    0b01111100,  // Row 6: _XXXXX__
+    0b00000000   // Row 7: ________
+  },
+  // Digit 2
+  {
+    0b00111100,  // Row 0: __XXXX__
+    0b01100110,  // Row 1: _XX__XX_
+    0b00000110,  // Row 2: _____XX_
+    0b00001100,  // Row 3: ____XX__
+    0b00110000,  // Row 4: __XX____
+    0b01100000,  // Row 5: _XX_____
+    0b01111100,  // Row 6: _XXXXX__
+    0b00000000   // Row 7: ________
+  },
+  // Digit 3
+  {
+    0b00111100,  // Row 0: __XXXX__
+    0b01100110,  // Row 1: _XX__XX_
+    0b00000110,  // Row 2: _____XX_
+    0b00011100,  // Row 3: ___XXX__
+    0b00000110,  // Row 4: _____XX_
+    0b01100110,  // Row 5: _XX__XX_
+    0b00111100,  // Row 6: __XXXX__
+    0b00000000   // Row 7: ________
+  },
+  // Digit 4
+  {
+    0b00001100,  // Row 0: ____XX__
+    0b00011100,  // Row 1: ___XXX__
+    0b00111100,  // Row 2: __XXXX__
+    0b01101100,  // Row 3: _XX_XX__
+    0b01111110,  // Row 4: _XXXXXX_
+    0b00001100,  // Row 5: ____XX__
+    0b00001100,  // Row 6: ____XX__
+    0b00000000   // Row 7: ________
+  },
+  // Digit 5
+  {
+    0b01111110,  // Row 0: _XXXXXX_
+    0b01100000,  // Row 1: _XX_____
+    0b01100000,  // Row 2: _XX_____
+    0b01111100,  // Row 3: _XXXXX__
+    0b00000110,  // Row 4: _____XX_
+    0b01100110,  // Row 5: _XX__XX_
+    0b00111100,  // Row 6: __XXXX__
+    0b00000000   // Row 7: ________
+  },
+  // Digit 6
+  {
+    0b00111100,  // Row 0: __XXXX__
+    0b01100110,  // Row 1: _XX__XX_
+    0b01100000,  // Row 2: _XX_____
+    0b01111100,  // Row 3: _XXXXX__
+    0b01100110,  // Row 4: _XX__XX_
+    0b01100110,  // Row 5: _XX__XX_
+    0b00111100,  // Row 6: __XXXX__
+    0b00000000   // Row 7: ________
+  },
+  // Digit 7
+  {
+    0b01111110,  // Row 0: _XXXXXX_
+    0b00000110,  // Row 1: _____XX_
+    0b00001100,  // Row 2: ____XX__
+    0b00011000,  // Row 3: ___XX___
+    0b00110000,  // Row 4: __XX____
+    0b00110000,  // Row 5: __XX____
+    0b00110000,  // Row 6: __XX____
+    0b00000000   // Row 7: ________
+  },
+  // Digit 8
+  {
+    0b00111100,  // Row 0: __XXXX__
+    0b01100110,  // Row 1: _XX__XX_
+    0b01100110,  // Row 2: _XX__XX_
+    0b00111100,  // Row 3: __XXXX__
+    0b01100110,  // Row 4: _XX__XX_
+    0b01100110,  // Row 5: _XX__XX_
+    0b00111100,  // Row 6: __XXXX__
+    0b00000000   // Row 7: ________
+  },
+  // Digit 9
+  {
+    0b00111100,  // Row 0: __XXXX__
+    0b01100110,  // Row 1: _XX__XX_
+    0b01100110,  // Row 2: _XX__XX_
+    0b00111110,  // Row 3: __XXXXX_
+    0b00000110,  // Row 4: _____XX_
+    0b01100110,  // Row 5: _XX__XX_
+    0b00111100,  // Row 6: __XXXX__
+    0b00000000   // Row 7: ________
+  }
+};
+
+// Decimal point patterns - split between panels 1 and 2
+constexpr uint8_t decimalPatternLeft[8] = {  // For panel 1 (ones of seconds)
+  0b00000000,  // Row 0: ________
+  0b00000000,  // Row 1: ________
+  0b00000000,  // Row 2: ________
+  0b00000000,  // Row 3: ________
+  0b00000000,  // Row 4: ________
+  0b00000000,  // Row 5: ________
+  0b00000001,  // Row 6: _______X
+  0b00000000   // Row 7: ________
+};
+
+constexpr uint8_t decimalPatternRight[8] = {  // For panel 2 (tenths of seconds)
+  0b00000000,  // Row 0: ________
+  0b00000000,  // Row 1: ________
+  0b00000000,  // Row 2: ________
+  0b00000000,  // Row 3: ________
+  0b00000000,  // Row 4: ________
+  0b00000000,  // Row 5: ________
+  0b00000000,  // Row 6: ________
+  0b00000000   // Row 7: ________
+};
+
+// Decimal point variants, one per panel slot that needs one
+enum GlyphVariant {
+  GLYPH_PLAIN,          // No decimal point
+  GLYPH_LEFT_DECIMAL,   // Left half of the decimal point (panel 1)
+  GLYPH_RIGHT_DECIMAL,  // Right half of the decimal point (panel 2)
+  GLYPH_VARIANTS
+};
+
+#define GLYPH_BLANK 10   // Glyph index for an empty panel (decimal point only)
+#define GLYPH_COUNT 11
+
+// Function to compute one row of a merged glyph at compile time
+constexpr uint8_t glyphRow(int variant, int digit, int row) {
+  return (digit == GLYPH_BLANK ? 0 : digitPatterns[digit][row]) |
+         (variant == GLYPH_LEFT_DECIMAL ? decimalPatternLeft[row] :
+          variant == GLYPH_RIGHT_DECIMAL ? decimalPatternRight[row] : 0);
+}
+
+#define GLYPH_ROWS(v, d) { glyphRow(v, d, 0), glyphRow(v, d, 1), glyphRow(v, d, 2), glyphRow(v, d, 3), \
+                           glyphRow(v, d, 4), glyphRow(v, d, 5), glyphRow(v, d, 6), glyphRow(v, d, 7) }
+#define GLYPH_DIGITS(v) { GLYPH_ROWS(v, 0), GLYPH_ROWS(v, 1), GLYPH_ROWS(v, 2), GLYPH_ROWS(v, 3), \
+                          GLYPH_ROWS(v, 4), GLYPH_ROWS(v, 5), GLYPH_ROWS(v, 6), GLYPH_ROWS(v, 7), \
+                          GLYPH_ROWS(v, 8), GLYPH_ROWS(v, 9), GLYPH_ROWS(v, GLYPH_BLANK) }
+
+// Pre-merged glyphs: glyphTable[variant][digit][row]
+constexpr uint8_t glyphTable[GLYPH_VARIANTS][GLYPH_COUNT][8] = {
+  GLYPH_DIGITS(GLYPH_PLAIN),
+  GLYPH_DIGITS(GLYPH_LEFT_DECIMAL),
+  GLYPH_DIGITS(GLYPH_RIGHT_DECIMAL)
+};
+
+#undef GLYPH_ROWS
+#undef GLYPH_DIGITS
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <stdint.h>
+#include <atomic>
+
+// Lock-free single-producer/single-consumer ring buffer.
+//
+// Used to hand events from a callback running in another task (e.g. the
+// ESP-NOW receive callback in the Wi-Fi task) to the main loop without locks.
+// Exactly one context may push and exactly one may pop. N must be a power of two.
+
+template <typename T, uint32_t N>
+struct EventQueue {
+  static_assert((N & (N - 1)) == 0, "EventQueue size must be a power of two");
+
+  T items[N];
+  std::atomic<uint32_t> head{0};      // Next slot to write, only advanced by the producer
+  std::atomic<uint32_t> tail{0};      // Next slot to read, only advanced by the consumer
+  std::atomic<uint32_t> overflows{0}; // Events dropped because the queue was full
+  std::atomic<uint32_t> maxDepth{0};  // High-water mark
+};
+
+// Function to add an event (producer side), returns false and counts an overflow if full
+template <typename T, uint32_t N>
+inline bool queuePush(EventQueue<T, N> &q, const T &item) {
+  uint32_t head = q.head.load(std::memory_order_relaxed);
+  uint32_t tail = q.tail.load(std::memory_order_acquire);
+  uint32_t depth = head - tail;
+  if (depth >= N) {
+    q.overflows.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  q.items[head & (N - 1)] = item;
+  q.head.store(head + 1, std::memory_order_release);
+
+  if (depth + 1 > q.maxDepth.load(std::memory_order_relaxed)) {
+    q.maxDepth.store(depth + 1, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+// Function to take the oldest event (consumer side), returns false if empty
+template <typename T, uint32_t N>
+inline bool queuePop(EventQueue<T, N> &q, T &item) {
+  uint32_t tail = q.tail.load(std::memory_order_relaxed);
+  uint32_t head = q.head.load(std::memory_order_acquire);
+  if (head == tail) {
+    return false;
+  }
+
+  item = q.items[tail & (N - 1)];
+  q.tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+// Function to get the number of events waiting
+template <typename T, uint32_t N>
+inline uint32_t queueDepth(const EventQueue<T, N> &q) {
+  return q.head.load(std::memory_order_acquire) - q.tail.load(std::memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,407 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <Arduino.h>
+
+// Hardware abstraction for the stopwatch sketches.
+//
+// The sketches reach the clock, GPIO, LED PWM, flash storage, settings and the
+// ESP-NOW peer radio only through these functions, and the display through MatrixDisplay
+// (matrix-transport.h). On the ESP32 they are thin inline wrappers around the
+// Arduino core and ESP-IDF. With STOPWATCH_NATIVE defined (the [env:native]
+// build) they are implemented by the deterministic simulator in sim/, which
+// runs the sketches on a virtual clock on the host.
+//
+// FreeRTOS calls and Serial are used directly; the native build provides them
+// from sim/platform/.
+//
+// halMicros() is the one timebase: a 64-bit microsecond count from power-up
+// that no unit will live to see wrap. Timestamps, intervals and the wire
+// protocol's time fields are all microseconds on it, held in int64_t. Times are
+// converted to display ticks (bcdAdvance()) or milliseconds and seconds only
+// where they are shown. There is no millisecond clock: the 32-bit millis()
+// wraps after 49.7 days, and wall units stay powered for longer than that.
+
+#define HAL_STORAGE_SECTOR 4096   // Erase unit of the storage area
+#define HAL_WAKE_LATENCY_US 500   // From a wake pin reaching its level to halLightSleep() returning, a typical ESP32 figure
+
+// What ended a light sleep (halLightSleep())
+enum HalWakeCause { HAL_WAKE_TIMER, HAL_WAKE_PIN, HAL_WAKE_SERIAL, HAL_WAKE_OTHER };
+
+// Radio callbacks - both run in the Wi-Fi task on the ESP32; rssi is the
+// received frame's signal strength (dBm)
+typedef void (*HalRadioReceive)(const uint8_t *mac, const uint8_t *data, int len, int rssi);
+typedef void (*HalRadioSent)(const uint8_t *mac, bool delivered);
+
+// Latency probes along the start path, from the climber leaving the pad to the
+// first frame on the top display, and the start signal's ack. The simulator
+// records when each is first hit (stopwatch-sim bench); on the ESP32 they
+// compile to nothing.
+enum HalProbe {
+  PROBE_PAD_EDGE,       // Bottom: pad release interrupt
+  PROBE_DEBOUNCED,      // Bottom: release accepted by the debounce
+  PROBE_RADIO_SEND,     // Bottom: start signal handed to the radio
+  PROBE_RADIO_RECEIVE,  // Top: start signal in the receive callback
+  PROBE_STATE_UPDATE,   // Top: timing task switched to RUNNING
+  PROBE_DISPLAY_PUSH,   // Top: first running frame sent to the display
+  PROBE_START_ACKED,    // Bottom: start signal acked by a top unit
+  PROBE_COUNT
+};
+
+#ifdef STOPWATCH_NATIVE
+
+struct SimTimer;
+typedef SimTimer *HalTimer;
+
+// Clock
+int64_t halMicros();
+int64_t halMicrosSinceBoot();
+void halDelay(unsigned long ms);
+uint32_t halCycleCount();
+uint32_t halCpuMhz();
+HalTimer halTimerCreate(void (*callback)(void *), void *arg, const char *name);
+void halTimerStartOnce(HalTimer timer, int64_t us);
+void halTimerStop(HalTimer timer);
+
+// GPIO and LED PWM
+void halPinMode(uint8_t pin, uint8_t mode);
+int halDigitalRead(uint8_t pin);
+void halAttachInterrupt(uint8_t pin, void (*handler)(), int mode);
+bool halAttachFilteredInterrupt(uint8_t pin, void (*handler)(), uint32_t glitchNs);
+void halLedWrite(uint8_t pin, int value);
+void halDigitalWrite(uint8_t pin, int level);
+
+// Light sleep
+void halSleepWakeOnPin(uint8_t pin, int level);
+void halSleepWakeOnSerial();
+HalWakeCause halLightSleep(int64_t us);
+
+// Peer radio
+bool halRadioBegin(HalRadioReceive onReceive, HalRadioSent onSent);
+bool halRadioAddPeer(const uint8_t *mac);
+void halRadioRemovePeer(const uint8_t *mac);
+bool halRadioSend(const uint8_t *mac, const uint8_t *data, size_t len);
+void halRadioMacAddress(uint8_t *mac);
+
+// Storage - flash semantics: erase sets bytes to 0xFF, writes only clear bits
+uint32_t halStorageSize();
+bool halStorageRead(uint32_t offset, void *data, size_t len);
+bool halStorageWrite(uint32_t offset, const void *data, size_t len);
+bool halStorageErase(uint32_t offset, size_t len);
+
+// Settings - small named values that survive a power cycle
+bool halConfigRead(const char *key, void *data, size_t len);
+bool halConfigWrite(const char *key, const void *data, size_t len);
+
+// Latency probes
+void halProbe(HalProbe probe);
+
+#else
+
+#include <esp_now.h>
+#include <WiFi.h>
+#include <esp_wifi.h>
+#include <esp_timer.h>
+#include <esp_idf_version.h>
+#include <esp_partition.h>
+#include <Preferences.h>
+#include <driver/pcnt.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <esp_sleep.h>
+
+typedef esp_timer_handle_t HalTimer;
+
+// Function to read the 64-bit microsecond clock, monotonic from power-up
+inline int64_t halMicros() {
+  return esp_timer_get_time();
+}
+
+// Function to read the time since power-up in microseconds
+// esp_timer starts early in startup, so only the ROM and second-stage
+// bootloader (a few hundred milliseconds) are not counted
+inline int64_t halMicrosSinceBoot() {
+  return esp_timer_get_time();
+}
+
+// Function to sleep the calling task
+inline void halDelay(unsigned long ms) {
+  delay(ms);
+}
+
+// Function to read the calling core's CPU cycle counter (wraps every 2^32 cycles)
+inline uint32_t halCycleCount() {
+  return ESP.getCycleCount();
+}
+
+// Function to read the CPU clock in MHz
+inline uint32_t halCpuMhz() {
+  return getCpuFrequencyMhz();
+}
+
+// Function to create a one-shot timer, the callback runs in the esp_timer task
+inline HalTimer halTimerCreate(void (*callback)(void *), void *arg, const char *name) {
+  esp_timer_create_args_t args = {};
+  args.callback = callback;
+  args.arg = arg;
+  args.name = name;
+  esp_timer_handle_t timer = NULL;
+  esp_timer_create(&args, &timer);
+  return timer;
+}
+
+// Function to (re)arm a one-shot timer
+inline void halTimerStartOnce(HalTimer timer, int64_t us) {
+  esp_timer_stop(timer);
+  esp_timer_start_once(timer, us > 0 ? us : 0);
+}
+
+// Function to disarm a timer
+inline void halTimerStop(HalTimer timer) {
+  esp_timer_stop(timer);
+}
+
+// Function to configure a pin
+inline void halPinMode(uint8_t pin, uint8_t mode) {
+  pinMode(pin, mode);
+}
+
+// Function to read a pin
+inline int halDigitalRead(uint8_t pin) {
+  return digitalRead(pin);
+}
+
+// Function to attach an edge interrupt (RISING, FALLING or CHANGE)
+inline void halAttachInterrupt(uint8_t pin, void (*handler)(), int mode) {
+  attachInterrupt(digitalPinToInterrupt(pin), handler, mode);
+}
+
+// Pulse counter interrupt, forwards to the handler given as its argument
+inline void IRAM_ATTR halFilteredEdge(void *handler) {
+  ((void (*)())handler)();
+}
+
+// Function to call handler on both edges of a pin, through a pulse counter
+// unit's glitch filter so pulses shorter than glitchNs (at most 1023 APB
+// cycles, 12.8 us) never interrupt; each unit counts the pin's edges and
+// interrupts at a count of one, which also clears it
+inline bool halAttachFilteredInterrupt(uint8_t pin, void (*handler)(), uint32_t glitchNs) {
+  static int nextUnit = PCNT_UNIT_0;
+  if (nextUnit >= PCNT_UNIT_MAX) return false;
+  pcnt_unit_t unit = (pcnt_unit_t)nextUnit++;
+
+  pcnt_config_t config = {};
+  config.pulse_gpio_num = pin;
+  config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+  config.channel = PCNT_CHANNEL_0;
+  config.unit = unit;
+  config.pos_mode = PCNT_COUNT_INC;
+  config.neg_mode = PCNT_COUNT_INC;
+  config.lctrl_mode = PCNT_MODE_KEEP;
+  config.hctrl_mode = PCNT_MODE_KEEP;
+  config.counter_h_lim = 1;
+  config.counter_l_lim = -1;
+  if (pcnt_unit_config(&config) != ESP_OK) return false;
+
+  uint32_t cycles = (uint32_t)((uint64_t)glitchNs * (APB_CLK_FREQ / 1000000) / 1000);
+  pcnt_set_filter_value(unit, (uint16_t)min(cycles, (uint32_t)1023));
+  pcnt_filter_enable(unit);
+  pcnt_event_enable(unit, PCNT_EVT_H_LIM);
+  pcnt_counter_pause(unit);
+  pcnt_counter_clear(unit);
+
+  static bool serviceInstalled = false;
+  if (!serviceInstalled) {
+    if (pcnt_isr_service_install(0) != ESP_OK) return false;
+    serviceInstalled = true;
+  }
+  if (pcnt_isr_handler_add(unit, halFilteredEdge, (void *)handler) != ESP_OK) return false;
+  pcnt_counter_resume(unit);
+  return true;
+}
+
+// Function to set an LED channel's PWM duty (0-255)
+inline void halLedWrite(uint8_t pin, int value) {
+  analogWrite(pin, value);
+}
+
+// Function to drive an output pin HIGH or LOW, a register write that is safe
+// in a critical section or an interrupt
+inline void IRAM_ATTR halDigitalWrite(uint8_t pin, int level) {
+  gpio_set_level((gpio_num_t)pin, level);
+}
+
+// Function to have a pin wake the unit from light sleep while it is at a
+// level; level triggered, so a pin already there ends the sleep at once
+inline void halSleepWakeOnPin(uint8_t pin, int level) {
+  gpio_wakeup_enable((gpio_num_t)pin, level == LOW ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+}
+
+// Function to have Serial input wake the unit from light sleep; the
+// characters that wake it are lost
+inline void halSleepWakeOnSerial() {
+  uart_set_wakeup_threshold(UART_NUM_0, 3);
+  esp_sleep_enable_uart_wakeup(UART_NUM_0);
+}
+
+// Function to light sleep for up to us microseconds, or until a wake pin or
+// Serial input ends it. Both cores, the timers and the pulse counters stop
+// and the radio is off, so frames sent meanwhile are lost; memory, pin levels
+// and halMicros() carry on. Queued Serial output goes out after waking.
+inline HalWakeCause halLightSleep(int64_t us) {
+  esp_sleep_enable_timer_wakeup(us);
+  if (esp_light_sleep_start() != ESP_OK) return HAL_WAKE_OTHER;
+  switch (esp_sleep_get_wakeup_cause()) {
+    case ESP_SLEEP_WAKEUP_TIMER: return HAL_WAKE_TIMER;
+    case ESP_SLEEP_WAKEUP_GPIO: return HAL_WAKE_PIN;
+    case ESP_SLEEP_WAKEUP_UART: return HAL_WAKE_SERIAL;
+    default: return HAL_WAKE_OTHER;
+  }
+}
+
+// Send callback registered with halRadioBegin()
+inline HalRadioSent &halRadioSentHandler() {
+  static HalRadioSent handler = NULL;
+  return handler;
+}
+
+// ESP-NOW send callback, forwards the delivery status
+inline void halRadioOnSent(const uint8_t *mac, esp_now_send_status_t status) {
+  HalRadioSent handler = halRadioSentHandler();
+  if (handler != NULL) handler(mac, status == ESP_NOW_SEND_SUCCESS);
+}
+
+// Receive callback registered with halRadioBegin()
+inline HalRadioReceive &halRadioReceiveHandler() {
+  static HalRadioReceive handler = NULL;
+  return handler;
+}
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+// ESP-NOW receive callback, forwards the frame with its RSSI
+inline void halRadioOnReceive(const esp_now_recv_info_t *info, const uint8_t *data, int len) {
+  halRadioReceiveHandler()(info->src_addr, data, len, info->rx_ctrl->rssi);
+}
+#else
+// Before IDF 5 the ESP-NOW receive callback has no RSSI. It is taken from the
+// promiscuous callback, which sees each management frame (ESP-NOW frames are
+// action frames) just before ESP-NOW does, in the same task
+inline volatile int &halRadioLastRssi() {
+  static volatile int rssi = 0;
+  return rssi;
+}
+
+inline void halRadioOnPromiscuous(void *buf, wifi_promiscuous_pkt_type_t type) {
+  if (type == WIFI_PKT_MGMT) halRadioLastRssi() = ((const wifi_promiscuous_pkt_t *)buf)->rx_ctrl.rssi;
+}
+
+// ESP-NOW receive callback, forwards the frame with its RSSI
+inline void halRadioOnReceive(const uint8_t *mac, const uint8_t *data, int len) {
+  halRadioReceiveHandler()(mac, data, len, halRadioLastRssi());
+}
+#endif
+
+// Function to bring up Wi-Fi in station mode and ESP-NOW
+inline bool halRadioBegin(HalRadioReceive onReceive, HalRadioSent onSent) {
+  WiFi.mode(WIFI_STA);
+  if (esp_now_init() != ESP_OK) return false;
+  halRadioReceiveHandler() = onReceive;
+  esp_now_register_recv_cb(halRadioOnReceive);
+#if ESP_IDF_VERSION_MAJOR < 5
+  wifi_promiscuous_filter_t filter = {};
+  filter.filter_mask = WIFI_PROMIS_FILTER_MASK_MGMT;
+  esp_wifi_set_promiscuous_filter(&filter);
+  esp_wifi_set_promiscuous_rx_cb(halRadioOnPromiscuous);
+  esp_wifi_set_promiscuous(true);
+#endif
+  if (onSent != NULL) {
+    halRadioSentHandler() = onSent;
+    esp_now_register_send_cb(halRadioOnSent);
+  }
+  return true;
+}
+
+// Function to add a unicast peer on the current channel, true if it already was one
+inline bool halRadioAddPeer(const uint8_t *mac) {
+  esp_now_peer_info_t peerInfo = {};
+  memcpy(peerInfo.peer_addr, mac, 6);
+  peerInfo.channel = 0;
+  peerInfo.encrypt = false;
+  peerInfo.ifidx = WIFI_IF_STA;
+  esp_err_t result = esp_now_add_peer(&peerInfo);
+  return result == ESP_OK || result == ESP_ERR_ESPNOW_EXIST;
+}
+
+// Function to remove a unicast peer, freeing its slot; ESP-NOW holds at most 20
+inline void halRadioRemovePeer(const uint8_t *mac) {
+  esp_now_del_peer(mac);
+}
+
+// Function to send a frame to a peer, the result arrives in the send callback
+inline bool halRadioSend(const uint8_t *mac, const uint8_t *data, size_t len) {
+  return esp_now_send(mac, data, len) == ESP_OK;
+}
+
+// Function to read this unit's station MAC address
+inline void halRadioMacAddress(uint8_t *mac) {
+  esp_wifi_get_mac(WIFI_IF_STA, mac);
+}
+
+// Storage area - the data partition the default partition tables reserve for
+// SPIFFS, which these sketches don't otherwise use
+
+// Function to find the storage partition, NULL if the partition table has none
+inline const esp_partition_t *halStoragePartition() {
+  static const esp_partition_t *partition =
+    esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+  return partition;
+}
+
+// Function to get the size of the storage area in bytes
+inline uint32_t halStorageSize() {
+  return halStoragePartition() != NULL ? halStoragePartition()->size : 0;
+}
+
+// Function to read from the storage area
+inline bool halStorageRead(uint32_t offset, void *data, size_t len) {
+  return halStoragePartition() != NULL && esp_partition_read(halStoragePartition(), offset, data, len) == ESP_OK;
+}
+
+// Function to program the storage area; both cores stall while flash is written
+inline bool halStorageWrite(uint32_t offset, const void *data, size_t len) {
+  return halStoragePartition() != NULL && esp_partition_write(halStoragePartition(), offset, data, len) == ESP_OK;
+}
+
+// Function to erase whole sectors of the storage area (tens of milliseconds each)
+inline bool halStorageErase(uint32_t offset, size_t len) {
+  return halStoragePartition() != NULL && esp_partition_erase_range(halStoragePartition(), offset, len) == ESP_OK;
+}
+
+// Settings - key/value pairs in the NVS partition, kept apart from the storage area
+
+// Function to open the settings namespace on first use
+inline Preferences &halConfigStore() {
+  static Preferences prefs;
+  static bool opened = prefs.begin("stopwatch", false);
+  (void)opened;
+  return prefs;
+}
+
+// Function to read a setting, false if it was never written or has another size
+inline bool halConfigRead(const char *key, void *data, size_t len) {
+  Preferences &prefs = halConfigStore();
+  return prefs.isKey(key) && prefs.getBytesLength(key) == len && prefs.getBytes(key, data, len) == len;
+}
+
+// Function to write a setting; both cores stall while flash is written
+inline bool halConfigWrite(const char *key, const void *data, size_t len) {
+  return halConfigStore().putBytes(key, data, len) == len;
+}
+
+// Function to mark a latency probe, only recorded in the simulator
+inline void halProbe(HalProbe) {}
+
+#endif
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef LINK_STATS_H
+#define LINK_STATS_H
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+
+// Link quality between a unit and one peer.
+//
+// Every frame received from the peer counts, with its RSSI. The round trip
+// comes from the echo fields every frame carries (wire-protocol.h): the
+// transmit time of our last frame the peer heard and when it heard it, so
+// delay = (our receive - our transmit) - (peer transmit - peer receive), the
+// same figure the clock synchronisation uses, without the time the peer held
+// on to it. Each of our frames is counted once, by the first frame that
+// echoes it.
+//
+// Loss is counted with the ping sequence numbers. The top unit numbers its
+// pings and the start unit echoes the number in the pong: a ping whose pong
+// hasn't come back by the time its slot in LINK_PING_SLOTS is reused was
+// lost, in either direction. The start unit counts the gaps in the numbers it
+// receives, the loss towards it alone. Retransmits and failed deliveries are
+// counted by the sketch.
+
+#define LINK_RTT_BUCKETS 8
+#define LINK_PING_SLOTS 16          // Pings awaiting their pong, power of two
+#define LINK_MAX_RTT_US 100000      // Longer delays are stale echoes, not round trips
+
+// Upper bounds of the round trip histogram buckets (microseconds), the last is open
+static const uint32_t linkRttBounds[LINK_RTT_BUCKETS - 1] = { 1000, 2000, 3000, 5000, 10000, 20000, 50000 };
+
+typedef struct {
+  uint32_t frames;          // Frames received from the peer
+  int rssiLast;             // dBm
+  int rssiMin;
+  int rssiMax;
+  int64_t rssiTotal;
+  int64_t lastEcho;         // Our transmit time last echoed, counted already
+  uint32_t rttSamples;
+  int64_t rttTotalUs;
+  int64_t rttMinUs;
+  int64_t rttMaxUs;
+  uint32_t rttHistogram[LINK_RTT_BUCKETS];
+  uint32_t pingSlots[LINK_PING_SLOTS];  // Sequence of each ping awaiting its pong, 0 once answered
+  uint32_t pingsAnswered;   // Pings we sent that were answered
+  uint32_t pingsLost;       // and that were not
+  uint32_t lastPingSeen;    // Sequence of the last ping received, 0 = none yet
+  uint32_t pingsSeen;       // Pings received
+  uint32_t pingsMissed;     // Gaps in their sequence numbers
+  uint32_t retransmits;     // Our signals or results sent again
+  uint32_t sendFailures;    // Frames to the peer the MAC layer gave up on
+} LinkStats;
+
+// Function to clear the statistics, e.g. for a new peer
+inline void linkStatsReset(LinkStats &ls) {
+  memset(&ls, 0, sizeof(ls));
+}
+
+// Function to count a frame received from the peer; echoTime, recvTime and
+// peerTxTime are its echo and timestamp fields (wire-protocol.h)
+inline void linkStatsFrame(LinkStats &ls, int rssi, int64_t echoTime, int64_t recvTime,
+                           int64_t peerTxTime, int64_t rxTime) {
+  if (ls.frames == 0 || rssi < ls.rssiMin) ls.rssiMin = rssi;
+  if (ls.frames == 0 || rssi > ls.rssiMax) ls.rssiMax = rssi;
+  ls.frames++;
+  ls.rssiLast = rssi;
+  ls.rssiTotal += rssi;
+
+  if (echoTime == 0 || recvTime == 0 || echoTime == ls.lastEcho) return;
+  ls.lastEcho = echoTime;
+  int64_t rtt = (rxTime - echoTime) - (peerTxTime - recvTime);
+  if (rtt <= 0 || rtt > LINK_MAX_RTT_US) return;
+  if (ls.rttSamples == 0 || rtt < ls.rttMinUs) ls.rttMinUs = rtt;
+  if (rtt > ls.rttMaxUs) ls.rttMaxUs = rtt;
+  ls.rttSamples++;
+  ls.rttTotalUs += rtt;
+  int bucket = 0;
+  while (bucket < LINK_RTT_BUCKETS - 1 && rtt >= linkRttBounds[bucket]) bucket++;
+  ls.rttHistogram[bucket]++;
+}
+
+// Function to note a numbered ping we sent; the one it displaces from its
+// slot without a pong was lost
+inline void linkStatsPingSent(LinkStats &ls, uint32_t sequence) {
+  uint32_t &slot = ls.pingSlots[sequence & (LINK_PING_SLOTS - 1)];
+  if (slot != 0) ls.pingsLost++;
+  slot = sequence;
+}
+
+// Function to match a pong to its ping
+inline void linkStatsPong(LinkStats &ls, uint32_t sequence) {
+  uint32_t &slot = ls.pingSlots[sequence & (LINK_PING_SLOTS - 1)];
+  if (sequence == 0 || slot != sequence) return;  // Unnumbered, late or repeated
+  slot = 0;
+  ls.pingsAnswered++;
+}
+
+// Function to count a numbered ping from the peer, and the ones missing before it
+// A number that goes backwards is a peer that restarted its count
+inline void linkStatsPingSeen(LinkStats &ls, uint32_t sequence) {
+  if (sequence == 0) return;
+  if (ls.lastPingSeen != 0 && sequence > ls.lastPingSeen) ls.pingsMissed += sequence - ls.lastPingSeen - 1;
+  ls.lastPingSeen = sequence;
+  ls.pingsSeen++;
+}
+
+// Function to get the share of our pings lost, 0-1
+inline double linkStatsPingLoss(const LinkStats &ls) {
+  uint32_t total = ls.pingsAnswered + ls.pingsLost;
+  return total > 0 ? (double)ls.pingsLost / total : 0.0;
+}
+
+// Function to get the share of the peer's pings that didn't reach us, 0-1
+inline double linkStatsPingMissed(const LinkStats &ls) {
+  uint32_t total = ls.pingsSeen + ls.pingsMissed;
+  return total > 0 ? (double)ls.pingsMissed / total : 0.0;
+}
+
+// Function to print the statistics
+inline void linkStatsPrint(const LinkStats &ls, const char *name) {
+  if (ls.frames == 0) {
+    Serial.printf("%s link: nothing received\n", name);
+    return;
+  }
+  Serial.printf("%s link: %u frames, RSSI last %d avg %lld min %d max %d dBm\n", name, ls.frames,
+                ls.rssiLast, (long long)(ls.rssiTotal / ls.frames), ls.rssiMin, ls.rssiMax);
+  if (ls.pingsAnswered + ls.pingsLost > 0) {
+    Serial.printf("  pings sent: %u answered, %u lost (%.1f%% round trip loss)\n",
+                  ls.pingsAnswered, ls.pingsLost, 100.0 * linkStatsPingLoss(ls));
+  }
+  if (ls.pingsSeen > 0) {
+    Serial.printf("  pings received: %u, %u missing (%.1f%% loss)\n",
+                  ls.pingsSeen, ls.pingsMissed, 100.0 * linkStatsPingMissed(ls));
+  }
+  Serial.printf("  %u retransmits, %u failed deliveries\n", ls.retransmits, ls.sendFailures);
+  if (ls.rttSamples == 0) return;
+  Serial.printf("  round trip avg %lld us min %lld us max %lld us over %u samples\n",
+                (long long)(ls.rttTotalUs / ls.rttSamples), (long long)ls.rttMinUs, (long long)ls.rttMaxUs,
+                ls.rttSamples);
+  Serial.printf("  round trip:");
+  for (int i = 0; i < LINK_RTT_BUCKETS; i++) {
+    if (i < LINK_RTT_BUCKETS - 1) {
+      Serial.printf(" <%u us %u,", linkRttBounds[i], ls.rttHistogram[i]);
+    } else {
+      Serial.printf(" more %u\n", ls.rttHistogram[i]);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef LOG_FORMATS_H
+#define LOG_FORMATS_H
+
+// Deferred log messages (deferred-log.h), shared by the sketches and
+// tools/log-decode.py, which reads this file for the format strings.
+//
+// The position in the list is the format ID sent over Serial: add new
+// messages at the end and never reorder. Arguments are integers or doubles,
+// no strings; at most LOG_MAX_ARGS of them.
+
+#define LOG_FORMATS(X) \
+  X(LOG_DROPPED,           "%u log records dropped") \
+  X(LOG_MESSAGE_FROM,      "Message received from: %02X:%02X:%02X:%02X:%02X:%02X") \
+  X(LOG_DELIVERY_SUCCESS,  "Last Packet Send Status: Delivery Success") \
+  X(LOG_DELIVERY_FAIL,     "Last Packet Send Status: Delivery Fail") \
+  X(LOG_PING_RECEIVED,     "Ping received - Sending pong") \
+  X(LOG_PONG_RECEIVED,     "Pong received - Connection confirmed") \
+  X(LOG_SIGNAL_ACKED,      "Signal %u acknowledged by lane %d after %lld us (%d retransmits)") \
+  X(LOG_SIGNAL_GAVE_UP,    "Signal %u not acknowledged by lanes %02X, giving up") \
+  X(LOG_RETRANSMIT,        "Retransmitting signal %u (attempt %d)") \
+  X(LOG_START_SENT,        "Start signal sent successfully") \
+  X(LOG_START_SEND_FAILED, "Error sending start signal") \
+  X(LOG_RESET_SENT,        "Reset signal sent successfully") \
+  X(LOG_RESET_SEND_FAILED, "Error sending reset signal") \
+  X(LOG_PAD_PRESSED,       "Climber stepped on pad - LED WHITE") \
+  X(LOG_PAD_RELEASED,      "Climber released pad - Starting timer, LED ORANGE") \
+  X(LOG_RESET_PRESSED,     "Reset button pressed - Clearing display and turning off LED") \
+  X(LOG_TIMING_QUEUE_FULL, "ERROR: Timing command queue full") \
+  X(LOG_DUPLICATE_SIGNAL,  "Duplicate signal %u ignored") \
+  X(LOG_BOTTOM_CONNECTED,  "Bottom unit connected!") \
+  X(LOG_BOTTOM_LOST,       "Connection to bottom unit lost!") \
+  X(LOG_START_RECEIVED,    "Start signal received - Beginning stopwatch") \
+  X(LOG_RESET_RECEIVED,    "Reset signal received - Clearing display and turning off LED") \
+  X(LOG_CLOCK_SYNC,        "Clock offset: %lld us, drift: %.2f ppm, rtt: %lld us") \
+  X(LOG_STOP_PRESSED,      "Stop button pressed - Timer stopped, LED GREEN") \
+  X(LOG_FINAL_TIME,        "Final time: %.6f seconds") \
+  X(LOG_RUN_SAVED,         "Run %u saved to flash") \
+  X(LOG_RUN_SAVE_FAILED,   "ERROR: Saving run to flash failed") \
+  X(LOG_HISTORY_QUEUE_FULL, "ERROR: Run history queue full, run not saved") \
+  X(LOG_UNKNOWN_UNIT,      "Message from a unit not on any lane ignored") \
+  X(LOG_LANE_FINISHED,     "Lane %d finished: %.6f seconds (place %d)") \
+  X(LOG_RACE_WON,          "Lane %d wins by %.6f seconds") \
+  X(LOG_LANE_ASSIGNED,     "Assigned to lane %d") \
+  X(LOG_RESULT_ACKED,      "Result for signal %u acknowledged") \
+  X(LOG_RESULT_GAVE_UP,    "Result for signal %u not acknowledged, giving up") \
+  X(LOG_BAD_FRAME,         "Bad frame dropped (status %d, %d bytes)") \
+  X(LOG_LANE_PAIRED,       "New top unit paired on lane %d") \
+  X(LOG_NO_FREE_LANE,      "New top unit ignored, every lane is taken") \
+  X(LOG_BOTTOM_PAIRED,     "Paired with bottom unit %02X:%02X:%02X:%02X:%02X:%02X") \
+  X(LOG_DISCOVERING,       "Bottom unit not answering - looking for one") \
+  X(LOG_OTHER_BOTTOM,      "Message from another bottom unit ignored") \
+  X(LOG_BOOT_READY,        "Ready %.1f ms after power-on") \
+  X(LOG_PAD_SETTLED,       "Pad settled at level %d after %u edges over %lld us") \
+  X(LOG_PAD_GLITCH,        "Pad glitch ignored: %u edges over %lld us") \
+  X(LOG_START_ARMED,       "Start sequence armed, cue in %.3f s") \
+  X(LOG_START_ABORTED,     "Pad left before the start sequence, no start") \
+  X(LOG_REACTION,          "Reaction time %.3f s") \
+  X(LOG_FALSE_START,       "FALSE START - reaction time %.3f s") \
+  X(LOG_CLIMBER_READY,     "Climber on the start pad")
+
+#define LOG_FORMAT_ID(id, format) id,
+#define LOG_FORMAT_STRING(id, format) format,
+
+enum LogFormat {
+  LOG_FORMATS(LOG_FORMAT_ID)
+  LOG_FORMAT_COUNT
+};
+
+static const char *const logFormatStrings[LOG_FORMAT_COUNT] = {
+  LOG_FORMATS(LOG_FORMAT_STRING)
+};
+
+#undef LOG_FORMAT_ID
+#undef LOG_FORMAT_STRING
+
+#endif
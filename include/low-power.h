@@ -0,0 +1,157 @@
+#ifndef LOW_POWER_H
+#define LOW_POWER_H
+
+#include <Arduino.h>
+#include "hal.h"
+#include "peer-table.h"
+
+// Low power mode for a start unit running on batteries.
+//
+// With the mode on, the start unit light sleeps (halLightSleep()) whenever it
+// has nothing to do, and a pad press or the reset button wakes it. The radio
+// sleeps too, so the unit has to be awake for the top units' pings: each ping
+// says the longest wait until the next one (wire-protocol.h), and
+// lowPowerPlan() wakes the unit SLEEP_PING_GUARD_US before the next ping of
+// each connected lane is due. Once the ping is in and its pong has gone out
+// the unit sleeps again. A ping that doesn't come is given up on after
+// SLEEP_PING_LATE_US, and the lane's next one is expected an interval later,
+// for up to SLEEP_FOLLOW_US after the last one that came: a top unit that
+// lost us pings every 100 ms, which such a wake catches. While a lane isn't
+// connected, or no lane has been paired, the unit also listens for
+// SLEEP_SCAN_LISTEN_US every SLEEP_SCAN_INTERVAL_US, longer than a
+// reconnecting top unit's ping interval, so it is found again.
+//
+// The pulse counter is stopped in light sleep, so the pad press that wakes
+// the unit never reaches the pad interrupt. The sketch stamps it
+// HAL_WAKE_LATENCY_US before the unit woke, the wake latency. That stamp only
+// times the start sequence: the climber leaves the pad, which starts the run,
+// with the unit awake.
+//
+// The average current is estimated from the time spent asleep and awake, at
+// the ESP32 datasheet figures for light sleep and for a CPU with the radio
+// receiving; the LED and the cue driver come on top.
+
+#define SLEEP_PING_GUARD_US 10000         // Awake this long before a lane's ping is due
+#define SLEEP_PING_LATE_US 100000         // and waiting at most this long after
+#define SLEEP_FOLLOW_US 30000000          // Wake for a lane's pings this long after the last one came
+#define SLEEP_SCAN_INTERVAL_US 5000000    // Listen for lanes that aren't connected this often
+#define SLEEP_SCAN_LISTEN_US 150000       // for this long, more than a reconnecting unit's ping interval
+#define SLEEP_MIN_US 5000                 // Shorter sleeps aren't worth entering light sleep for
+#define SLEEP_AWAKE_HOLD_US 5000000       // Awake this long after the pad, the reset button or a lane result
+#define SLEEP_RACE_AWAKE_US 60000000      // and while a lane hasn't finished, for at most this long after the start
+#define LOW_POWER_SLEEP_UA 800            // Light sleep current (microamps)
+#define LOW_POWER_AWAKE_UA 100000         // Awake current, radio receiving (microamps)
+
+struct LowPower {
+  bool enabled = false;
+  int64_t since = 0;            // Statistics start, when the mode was turned on (halMicros())
+  int64_t lastScan = -SLEEP_SCAN_INTERVAL_US;  // Last listen for lanes that aren't connected
+  int64_t asleepUs = 0;
+  uint32_t sleeps = 0;
+  uint32_t timerWakes = 0;      // For a ping or a scan
+  uint32_t pinWakes = 0;        // Pad or reset button
+  uint32_t serialWakes = 0;
+  uint32_t padWakes = 0;        // Pin wakes that stamped a pad press
+  int64_t longestSleepUs = 0;
+};
+
+// Function to clear the statistics, e.g. when the mode is turned on
+inline void lowPowerReset(LowPower &lp, int64_t now) {
+  bool enabled = lp.enabled;
+  lp = LowPower();
+  lp.enabled = enabled;
+  lp.since = now;
+}
+
+// Function to find when a lane's next ping is due: an interval after its
+// last one, or a whole number of intervals after it once that has passed by
+// more than SLEEP_PING_LATE_US
+inline int64_t lowPowerNextPing(int64_t lastPing, int64_t interval, int64_t now) {
+  int64_t due = lastPing + interval;
+  if (now > due + SLEEP_PING_LATE_US) due += ((now - due - SLEEP_PING_LATE_US) / interval + 1) * interval;
+  return due;
+}
+
+// Function to plan the next sleep: until just before the next ping of each
+// lane is due, or the next scan while a lane isn't connected
+// Returns the halMicros() time to wake at, now if a ping is due or a scan is
+// under way (starting one if it is time)
+inline int64_t lowPowerPlan(LowPower &lp, const PeerTable &t, int64_t now, int64_t timeout) {
+  int64_t wake = INT64_MAX;
+  uint8_t connected = peerTableConnected(t, now, timeout);
+  bool scan = t.configured == 0;
+  for (int i = 0; i < MAX_LANES; i++) {
+    if (!(t.configured & LANE_BIT(i + 1))) continue;
+    const LanePeer &p = t.lanes[i];
+    if (!(connected & LANE_BIT(i + 1))) scan = true;
+    if (p.pingIntervalUs <= 0 || p.lastPingTime == 0 || now - p.lastPingTime > SLEEP_FOLLOW_US) {
+      scan = true;
+      continue;
+    }
+    int64_t due = lowPowerNextPing(p.lastPingTime, p.pingIntervalUs, now) - SLEEP_PING_GUARD_US;
+    if (due <= now) return now;
+    if (due < wake) wake = due;
+  }
+
+  if (scan) {
+    if (now - lp.lastScan < SLEEP_SCAN_LISTEN_US) return now;
+    int64_t next = lp.lastScan + SLEEP_SCAN_INTERVAL_US;
+    if (next <= now) {
+      lp.lastScan = now;
+      return now;
+    }
+    if (next < wake) wake = next;
+  }
+  return wake;
+}
+
+// Function to count a light sleep and what ended it
+inline void lowPowerSlept(LowPower &lp, int64_t sleptUs, HalWakeCause cause) {
+  lp.sleeps++;
+  lp.asleepUs += sleptUs;
+  if (sleptUs > lp.longestSleepUs) lp.longestSleepUs = sleptUs;
+  if (cause == HAL_WAKE_TIMER) lp.timerWakes++;
+  else if (cause == HAL_WAKE_PIN) lp.pinWakes++;
+  else if (cause == HAL_WAKE_SERIAL) lp.serialWakes++;
+}
+
+// Function to estimate the average current since the statistics started (microamps)
+inline int64_t lowPowerCurrentUa(const LowPower &lp, int64_t now) {
+  int64_t total = now - lp.since;
+  if (total <= 0) return LOW_POWER_AWAKE_UA;
+  double asleep = (double)lp.asleepUs / total;
+  return (int64_t)(asleep * LOW_POWER_SLEEP_UA + (1 - asleep) * LOW_POWER_AWAKE_UA);
+}
+
+// Function to print the sleep statistics and the estimated average current
+inline void lowPowerPrintStats(const LowPower &lp, int64_t now) {
+  Serial.printf("Low power mode %s\n", lp.enabled ? "on" : "off");
+  int64_t total = now - lp.since;
+  if (lp.sleeps == 0 || total <= 0) return;
+  Serial.printf("  %u sleeps over %.1f s, asleep %.1f%%, longest %lld ms\n", lp.sleeps, total / 1e6,
+                100.0 * lp.asleepUs / total, (long long)(lp.longestSleepUs / 1000));
+  Serial.printf("  woken by the timer %u, a pin %u (%u pad presses), Serial %u\n",
+                lp.timerWakes, lp.pinWakes, lp.padWakes, lp.serialWakes);
+  Serial.printf("  wake to timestamp %d us, stamped that far back\n", HAL_WAKE_LATENCY_US);
+  Serial.printf("  average current %.2f mA (%.1f mA asleep, %.0f mA awake)\n", lowPowerCurrentUa(lp, now) / 1000.0,
+                LOW_POWER_SLEEP_UA / 1000.0, LOW_POWER_AWAKE_UA / 1000.0);
+}
+
+// Serial commands for low power mode:
+//   z         turn low power mode on or off
+//   p         print the sleep statistics and the estimated current
+
+// Function to take one character of a low power command
+// Returns true when the mode was changed, for the caller to save it
+inline bool lowPowerCommand(LowPower &lp, int c, int64_t now) {
+  if (c == 'z') {
+    lp.enabled = !lp.enabled;
+    lowPowerReset(lp, now);
+    Serial.printf("Low power mode %s\n", lp.enabled ? "on" : "off");
+    return true;
+  }
+  if (c == 'p') lowPowerPrintStats(lp, now);
+  return false;
+}
+
+#endif
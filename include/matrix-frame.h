@@ -0,0 +1,136 @@
+#ifndef MATRIX_FRAME_H
+#define MATRIX_FRAME_H
+
+#include <Arduino.h>
+#include <MD_MAX72xx.h>
+#include "hal.h"
+#include "matrix-transport.h"
+#include "trace-buffer.h"
+
+// Shadow framebuffer for the 4-panel MAX72XX display.
+//
+// Sketches draw into the next frame, then frameRender() compares it with what
+// the chain is currently showing and hands only the changed rows to
+// MD_MAX72XX with automatic updates turned off. A single mx.update() then
+// flushes them, one SPI chain transaction per changed digit register (row)
+// instead of one per setRow() call.
+//
+// Works with either MD_MAX72XX or MatrixTransport (matrix-transport.h). With
+// MatrixTransport the time reported per frame is the CPU time to queue the
+// changed rows; the transfer itself runs on the SPI DMA in the background.
+//
+// Define FRAME_FULL_REFRESH before including this file to push every row with
+// automatic updates on, the way the sketches used to, for before/after
+// comparison of the statistics below.
+
+#define FRAME_PANELS 4
+#define FRAME_ROWS 8
+
+typedef struct {
+  uint8_t next[FRAME_PANELS][FRAME_ROWS];  // Frame being drawn
+  uint8_t shown[FRAME_PANELS][FRAME_ROWS]; // What the display is showing
+  // Statistics
+  uint32_t frames;
+  uint32_t transactions;      // SPI chain transactions, all frames
+  uint32_t lastTransactions;
+  uint32_t totalUs;           // Time spent in frameRender(), all frames
+  uint32_t lastUs;
+  uint32_t maxUs;
+} FrameBuffer;
+
+// Function to clear the next frame
+inline void frameClear(FrameBuffer &fb) {
+  memset(fb.next, 0, sizeof(fb.next));
+}
+
+// Function to copy 8 rows into a panel of the next frame
+inline void frameSetPanel(FrameBuffer &fb, int panel, const uint8_t *rows) {
+  memcpy(fb.next[panel], rows, FRAME_ROWS);
+}
+
+// Function to blank a panel of the next frame
+inline void frameBlankPanel(FrameBuffer &fb, int panel) {
+  memset(fb.next[panel], 0, FRAME_ROWS);
+}
+
+// Function to reset the statistics
+inline void frameResetStats(FrameBuffer &fb) {
+  fb.frames = 0;
+  fb.transactions = 0;
+  fb.lastTransactions = 0;
+  fb.totalUs = 0;
+  fb.lastUs = 0;
+  fb.maxUs = 0;
+}
+
+// Function to set up the framebuffer once mx.begin() has succeeded
+// Clears the display so the shadow copy matches the hardware
+template <typename Matrix>
+inline void frameBegin(FrameBuffer &fb, Matrix &mx) {
+  mx.clear();
+  memset(fb.shown, 0, sizeof(fb.shown));
+  frameClear(fb);
+  frameResetStats(fb);
+#ifndef FRAME_FULL_REFRESH
+  mx.control(MD_MAX72XX::UPDATE, MD_MAX72XX::OFF);
+#endif
+}
+
+// Function to push the next frame to the display
+// Returns the number of SPI chain transactions used
+template <typename Matrix>
+inline uint8_t frameRender(FrameBuffer &fb, Matrix &mx) {
+  uint32_t startUs = (uint32_t)halMicros();
+  uint8_t count = 0;
+
+#ifdef FRAME_FULL_REFRESH
+  for (int panel = 0; panel < FRAME_PANELS; panel++) {
+    for (int row = 0; row < FRAME_ROWS; row++) {
+      TRACE_BEGIN(TRACE_SET_ROW, panel * FRAME_ROWS + row);
+      mx.setRow(panel, row, fb.next[panel][row]);
+      TRACE_END(TRACE_SET_ROW);
+      count++;
+    }
+  }
+  memcpy(fb.shown, fb.next, sizeof(fb.shown));
+#else
+  uint8_t dirtyRows = 0;
+  for (int panel = 0; panel < FRAME_PANELS; panel++) {
+    for (int row = 0; row < FRAME_ROWS; row++) {
+      if (fb.next[panel][row] != fb.shown[panel][row]) {
+        TRACE_BEGIN(TRACE_SET_ROW, panel * FRAME_ROWS + row);
+        mx.setRow(panel, row, fb.next[panel][row]);
+        TRACE_END(TRACE_SET_ROW);
+        fb.shown[panel][row] = fb.next[panel][row];
+        dirtyRows |= (1 << row);
+      }
+    }
+  }
+
+  // Each changed row is one transaction covering every panel in the chain
+  if (dirtyRows != 0) {
+    mx.update();
+    for (uint8_t rows = dirtyRows; rows != 0; rows &= rows - 1) {
+      count++;
+    }
+  }
+#endif
+
+  uint32_t elapsedUs = (uint32_t)halMicros() - startUs;
+  fb.frames++;
+  fb.transactions += count;
+  fb.lastTransactions = count;
+  fb.totalUs += elapsedUs;
+  fb.lastUs = elapsedUs;
+  if (elapsedUs > fb.maxUs) fb.maxUs = elapsedUs;
+  return count;
+}
+
+// Function to print the display statistics
+inline void framePrintStats(const FrameBuffer &fb) {
+  if (fb.frames == 0) return;
+  Serial.printf("Display: %u frames, %.1f bus transactions/frame, %u us/frame avg, %u us max\n",
+                fb.frames, (float)fb.transactions / fb.frames, fb.totalUs / fb.frames, fb.maxUs);
+}
+
+#endif
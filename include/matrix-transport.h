@@ -0,0 +1,224 @@
+#ifndef MATRIX_TRANSPORT_H
+#define MATRIX_TRANSPORT_H
+
+#include <Arduino.h>
+#include <MD_MAX72xx.h>
+
+#ifdef STOPWATCH_NATIVE
+
+// Host build: the simulator's display model stands in for the chain
+#include "sim-matrix.h"
+typedef SimMatrix MatrixDisplay;
+
+#else
+
+#include <driver/spi_master.h>
+#include <esp_heap_caps.h>
+
+// Hardware SPI + DMA transport for the MAX72XX chain.
+//
+// MatrixTransport takes the same constructor arguments as the pin-based
+// MD_MAX72XX constructor and implements the part of its interface the
+// sketches use (begin, control, setRow, update, clear), so it can replace it
+// on the constructor line. Instead of bit-banging GPIOs it routes the ESP32's
+// HSPI peripheral to the same pins through the GPIO matrix. update() queues
+// one DMA transaction per changed digit register and returns straight away;
+// the frame is clocked out in the background while loop() carries on.
+//
+// Only digit-row modules (MD_MAX72XX DR1 types, including ICSTATION_HW and
+// FC16_HW) are supported; begin() fails for the others.
+//
+// Define MATRIX_SOFTWARE_SPI to make MatrixDisplay the original bit-banged
+// MD_MAX72XX again, for comparing frame push times on the same hardware.
+// In the native build MatrixDisplay is the simulator's SimMatrix.
+
+#define MATRIX_SPI_HOST SPI2_HOST    // HSPI
+#define MATRIX_SPI_CLOCK 10000000    // MAX7219 maximum serial clock (10 MHz)
+#define MATRIX_MAX_DEVICES 8
+#define MATRIX_ROWS 8
+
+// MAX7219 registers
+#define MAX7219_DIGIT0 0x01
+#define MAX7219_DECODE_MODE 0x09
+#define MAX7219_INTENSITY 0x0A
+#define MAX7219_SCAN_LIMIT 0x0B
+#define MAX7219_SHUTDOWN 0x0C
+#define MAX7219_DISPLAY_TEST 0x0F
+
+class MatrixTransport {
+public:
+  MatrixTransport(MD_MAX72XX::moduleType_t mod, uint8_t dataPin, uint8_t clkPin, uint8_t csPin, uint8_t numDevices = 1)
+    : _mod(mod), _dataPin(dataPin), _clkPin(clkPin), _csPin(csPin),
+      _numDevices(numDevices > MATRIX_MAX_DEVICES ? MATRIX_MAX_DEVICES : numDevices) {}
+
+  // Statistics
+  uint32_t transactions = 0;  // DMA transactions queued
+  uint32_t waits = 0;         // Times update() had to wait for a previous transfer
+
+  // Function to set up the SPI bus and the MAX7219 registers
+  bool begin() {
+    switch (_mod) {
+      case MD_MAX72XX::DR1CR0RR0_HW: _revCols = false; _revRows = false; break;
+      case MD_MAX72XX::DR1CR0RR1_HW: _revCols = false; _revRows = true;  break;
+      case MD_MAX72XX::DR1CR1RR0_HW: _revCols = true;  _revRows = false; break;
+      case MD_MAX72XX::DR1CR1RR1_HW: _revCols = true;  _revRows = true;  break;
+      default: return false; // Column-wired modules need MD_MAX72XX
+    }
+
+    spi_bus_config_t bus = {};
+    bus.mosi_io_num = _dataPin;
+    bus.miso_io_num = -1;
+    bus.sclk_io_num = _clkPin;
+    bus.quadwp_io_num = -1;
+    bus.quadhd_io_num = -1;
+    bus.max_transfer_sz = MATRIX_MAX_DEVICES * 2;
+    if (spi_bus_initialize(MATRIX_SPI_HOST, &bus, SPI_DMA_CH_AUTO) != ESP_OK) return false;
+
+    spi_device_interface_config_t dev = {};
+    dev.mode = 0;
+    dev.clock_speed_hz = MATRIX_SPI_CLOCK;
+    dev.spics_io_num = _csPin;  // MAX7219 latches on the CS rising edge
+    dev.queue_size = MATRIX_ROWS;
+    if (spi_bus_add_device(MATRIX_SPI_HOST, &dev, &_spi) != ESP_OK) return false;
+
+    for (int r = 0; r < MATRIX_ROWS; r++) {
+      _txBuf[r] = (uint8_t *)heap_caps_malloc(MATRIX_MAX_DEVICES * 2, MALLOC_CAP_DMA);
+      if (_txBuf[r] == NULL) return false;
+    }
+
+    sendAll(MAX7219_DISPLAY_TEST, 0);
+    sendAll(MAX7219_SCAN_LIMIT, MATRIX_ROWS - 1);
+    sendAll(MAX7219_DECODE_MODE, 0);
+    clear();
+    sendAll(MAX7219_SHUTDOWN, 0); // Start shut down, like MD_MAX72XX
+    return true;
+  }
+
+  // Function to handle the control requests the sketches use
+  bool control(MD_MAX72XX::controlRequest_t mode, int value) {
+    switch (mode) {
+      case MD_MAX72XX::SHUTDOWN:  sendAll(MAX7219_SHUTDOWN, value == MD_MAX72XX::ON ? 0 : 1); return true;
+      case MD_MAX72XX::INTENSITY: sendAll(MAX7219_INTENSITY, value & 0x0F); return true;
+      case MD_MAX72XX::TEST:      sendAll(MAX7219_DISPLAY_TEST, value == MD_MAX72XX::ON ? 1 : 0); return true;
+      case MD_MAX72XX::UPDATE:
+        _autoUpdate = (value == MD_MAX72XX::ON);
+        if (_autoUpdate) update();
+        return true;
+      default: return false;
+    }
+  }
+
+  // Function to set one row of one device, sent on the next update()
+  bool setRow(uint8_t dev, uint8_t row, uint8_t value) {
+    if (dev >= _numDevices || row >= MATRIX_ROWS) return false;
+    uint8_t reg = _revRows ? (MATRIX_ROWS - 1 - row) : row;
+    uint8_t data = _revCols ? bitReverse(value) : value;
+    if (_digits[dev][reg] != data) {
+      _digits[dev][reg] = data;
+      _dirty |= (1 << reg);
+    }
+    if (_autoUpdate) update();
+    return true;
+  }
+
+  // Function to clear every device
+  void clear() {
+    memset(_digits, 0, sizeof(_digits));
+    _dirty = 0xFF;
+    if (_autoUpdate) update();
+  }
+
+  // Function to queue the changed digit registers for DMA, returns without waiting
+  void update() {
+    reap(false);
+    for (int r = 0; r < MATRIX_ROWS; r++) {
+      if (!(_dirty & (1 << r))) continue;
+
+      // The buffer for this register may still be on the bus from the last frame
+      if (_busy[r]) {
+        waits++;
+        while (_busy[r]) reap(true);
+      }
+
+      // The first bytes out end up in the device furthest down the chain
+      uint8_t *buf = _txBuf[r];
+      for (int pos = 0; pos < _numDevices; pos++) {
+        int dev = _numDevices - 1 - pos;
+        buf[pos * 2] = MAX7219_DIGIT0 + r;
+        buf[pos * 2 + 1] = _digits[dev][r];
+      }
+
+      spi_transaction_t &t = _trans[r];
+      memset(&t, 0, sizeof(t));
+      t.length = _numDevices * 16;
+      t.tx_buffer = buf;
+      t.user = (void *)(intptr_t)r;
+      _busy[r] = true;
+      _inFlight++;
+      spi_device_queue_trans(_spi, &t, portMAX_DELAY);
+      transactions++;
+    }
+    _dirty = 0;
+  }
+
+  // Function to block until everything queued has been sent
+  void flush() {
+    while (_inFlight > 0) reap(true);
+  }
+
+private:
+  MD_MAX72XX::moduleType_t _mod;
+  uint8_t _dataPin, _clkPin, _csPin, _numDevices;
+  bool _revCols = false;
+  bool _revRows = false;
+  bool _autoUpdate = true;
+  spi_device_handle_t _spi = NULL;
+  uint8_t _digits[MATRIX_MAX_DEVICES][MATRIX_ROWS] = {};  // Register image per device
+  uint8_t _dirty = 0;                                       // Digit registers to send
+  uint8_t *_txBuf[MATRIX_ROWS] = {};
+  spi_transaction_t _trans[MATRIX_ROWS];
+  volatile bool _busy[MATRIX_ROWS] = {};
+  int _inFlight = 0;
+
+  static uint8_t bitReverse(uint8_t b) {
+    b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+    b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+    b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+    return b;
+  }
+
+  // Function to collect finished transactions
+  void reap(bool wait) {
+    spi_transaction_t *done;
+    while (_inFlight > 0 &&
+           spi_device_get_trans_result(_spi, &done, wait ? portMAX_DELAY : 0) == ESP_OK) {
+      _busy[(intptr_t)done->user] = false;
+      _inFlight--;
+      if (wait) break;
+    }
+  }
+
+  // Function to write the same register on every device (blocking, used for setup)
+  void sendAll(uint8_t reg, uint8_t data) {
+    flush();
+    uint8_t *buf = _txBuf[0];
+    for (int pos = 0; pos < _numDevices; pos++) {
+      buf[pos * 2] = reg;
+      buf[pos * 2 + 1] = data;
+    }
+    spi_transaction_t t = {};
+    t.length = _numDevices * 16;
+    t.tx_buffer = buf;
+    spi_device_polling_transmit(_spi, &t);
+  }
+};
+
+#ifdef MATRIX_SOFTWARE_SPI
+typedef MD_MAX72XX MatrixDisplay;
+#else
+typedef MatrixTransport MatrixDisplay;
+#endif
+
+#endif // STOPWATCH_NATIVE
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef PAD_FILTER_H
+#define PAD_FILTER_H
+
+#include <Arduino.h>
+#include <stdio.h>
+#include "event-queue.h"
+
+// Input conditioning for the aluminium-tape contact pads.
+//
+// The pad pin goes through the pulse counter's glitch filter
+// (halAttachFilteredInterrupt()), which drops spikes too short to be the
+// contact, and its interrupt stamps every edge that gets through into the
+// pad's queue with padFilterEdge(). padFilterUpdate() groups the edges into
+// bursts. A burst ends once the pad has been quiet for the settle time; if the
+// pad is then at the other level the burst was a press or release, timed at
+// its first edge, otherwise it was a glitch. The decision waits for the
+// chatter to stop, the timestamp does not.
+//
+// Each burst's edge count and settle time (first to last edge) go into the
+// pad's bounce statistics, and its edges into a capture ring, so the settle
+// time can be tuned for each installation. Nothing here touches the hardware:
+// stopwatch-sim bounce --trace replays captured edges through the same code.
+
+#define PAD_GLITCH_NS 12000          // Pulse counter filter: shorter pulses are not contact (at most 12787 ns)
+#define PAD_SETTLE_DEFAULT_US 3000   // Quiet time that ends a burst, until tuned
+#define PAD_SETTLE_MIN_US 200
+#define PAD_EDGE_QUEUE 64            // Edges from the interrupt not yet grouped, power of two
+#define PAD_CAPTURE_EDGES 128        // Last edges kept for capture, power of two
+#define PAD_SETTLE_BUCKETS 8
+
+// Upper bounds of the settle time histogram buckets (microseconds), the last is open
+static const uint32_t padSettleBounds[PAD_SETTLE_BUCKETS - 1] = { 100, 200, 500, 1000, 2000, 5000, 10000 };
+
+enum PadEvent { PAD_NONE, PAD_PRESSED, PAD_RELEASED, PAD_GLITCH };
+
+typedef struct {
+  int64_t timeUs;   // halMicros() of the edge
+  uint8_t level;    // Pin level read in the interrupt
+} PadEdge;
+
+// Bursts that changed the pad in one direction
+typedef struct {
+  uint32_t transitions;
+  uint32_t edges;           // Edges in them, the first included
+  uint16_t maxEdges;        // Most edges in one transition
+  int64_t totalSettleUs;    // First to last edge
+  int64_t maxSettleUs;
+  uint32_t settleHistogram[PAD_SETTLE_BUCKETS];
+} BounceStats;
+
+struct PadFilter {
+  EventQueue<PadEdge, PAD_EDGE_QUEUE> edges;  // From the pad interrupt
+  volatile uint32_t settleUs = PAD_SETTLE_DEFAULT_US;
+  uint8_t level = HIGH;        // Accepted level
+  bool inBurst = false;
+  int64_t burstStart = 0;      // First edge of the current burst
+  int64_t burstEnd = 0;        // Last edge so far
+  uint16_t burstEdges = 0;
+  int64_t eventTime = 0;       // First edge of the last press or release
+  uint16_t lastEdges = 0;      // Edges in the last burst, accepted or not
+  int64_t lastSettleUs = 0;    // Its settle time
+  BounceStats stats[2];        // [0] presses (to LOW), [1] releases (to HIGH)
+  uint32_t glitches = 0;       // Bursts that ended at the old level
+  PadEdge capture[PAD_CAPTURE_EDGES];
+  uint32_t captured = 0;       // Edges ever captured, the ring holds the last ones
+};
+
+// Function to start a pad at a known level, keeping its settle time
+inline void padFilterReset(PadFilter &f, uint8_t level) {
+  f.level = level;
+  f.inBurst = false;
+  f.burstEdges = 0;
+  f.eventTime = 0;
+  f.lastEdges = 0;
+  f.lastSettleUs = 0;
+  memset(f.stats, 0, sizeof(f.stats));
+  f.glitches = 0;
+  f.captured = 0;
+}
+
+// Function to queue an edge, called from the pad interrupt
+// The pulse counter filter passes an edge PAD_GLITCH_NS late, so that is taken off
+inline void padFilterEdge(PadFilter &f, int64_t timeUs, uint8_t level) {
+  PadEdge e;
+  e.timeUs = timeUs - PAD_GLITCH_NS / 1000;
+  e.level = level;
+  queuePush(f.edges, e);
+}
+
+// Function to start a burst at an edge the interrupt never saw, such as a
+// press that woke the unit from light sleep with the pulse counter stopped
+// Called where padFilterUpdate() is, so the edges queued since come after it
+inline void padFilterMissedEdge(PadFilter &f, int64_t timeUs, uint8_t level) {
+  if (f.inBurst || level == f.level) return;
+  PadEdge e;
+  e.timeUs = timeUs;
+  e.level = level;
+  f.inBurst = true;
+  f.burstStart = timeUs;
+  f.burstEnd = timeUs;
+  f.burstEdges = 1;
+  f.capture[f.captured++ & (PAD_CAPTURE_EDGES - 1)] = e;
+}
+
+// Function to add a finished burst to a direction's statistics
+inline void bounceStatsAdd(BounceStats &s, uint16_t edges, int64_t settleUs) {
+  s.transitions++;
+  s.edges += edges;
+  if (edges > s.maxEdges) s.maxEdges = edges;
+  s.totalSettleUs += settleUs;
+  if (settleUs > s.maxSettleUs) s.maxSettleUs = settleUs;
+  int bucket = 0;
+  while (bucket < PAD_SETTLE_BUCKETS - 1 && settleUs >= padSettleBounds[bucket]) bucket++;
+  s.settleHistogram[bucket]++;
+}
+
+// Function to group the queued edges and decide a burst once the pad has been
+// quiet for the settle time; reading is the pin level now
+// On PAD_PRESSED or PAD_RELEASED the first edge is in f.eventTime; a decided
+// burst's edge count and settle time are in f.lastEdges and f.lastSettleUs
+inline PadEvent padFilterUpdate(PadFilter &f, int64_t now, uint8_t reading) {
+  PadEdge e;
+  while (queuePop(f.edges, e)) {
+    if (!f.inBurst) {
+      f.inBurst = true;
+      f.burstStart = e.timeUs;
+      f.burstEdges = 0;
+    }
+    f.burstEnd = e.timeUs;
+    f.burstEdges++;
+    f.capture[f.captured++ & (PAD_CAPTURE_EDGES - 1)] = e;
+  }
+
+  // A change the interrupt never reported (its queue was full) still counts
+  if (!f.inBurst && reading != f.level) {
+    f.inBurst = true;
+    f.burstStart = now;
+    f.burstEnd = now;
+    f.burstEdges = 1;
+  }
+  if (!f.inBurst || now - f.burstEnd < (int64_t)f.settleUs) return PAD_NONE;
+
+  f.inBurst = false;
+  f.lastEdges = f.burstEdges;
+  f.lastSettleUs = f.burstEnd - f.burstStart;
+  if (reading == f.level) {
+    f.glitches++;
+    return PAD_GLITCH;
+  }
+  f.level = reading;
+  f.eventTime = f.burstStart;
+  bounceStatsAdd(f.stats[reading == HIGH], f.lastEdges, f.lastSettleUs);
+  return reading == LOW ? PAD_PRESSED : PAD_RELEASED;
+}
+
+// Function to get how long until padFilterUpdate() can decide the current
+// burst (microseconds), -1 if no burst is under way
+inline int64_t padFilterDueIn(const PadFilter &f, int64_t now) {
+  if (!f.inBurst && queueDepth(f.edges) == 0) return -1;
+  if (!f.inBurst) return 0;
+  int64_t due = f.burstEnd + f.settleUs - now;
+  return due > 0 ? due : 0;
+}
+
+// Function to suggest a settle time from the statistics: twice the longest seen
+inline uint32_t padFilterSuggestSettle(const PadFilter &f) {
+  int64_t longest = max(f.stats[0].maxSettleUs, f.stats[1].maxSettleUs);
+  return (uint32_t)max((int64_t)PAD_SETTLE_MIN_US, 2 * longest);
+}
+
+// Function to print one direction's bounce statistics
+inline void bounceStatsPrint(const BounceStats &s, const char *what) {
+  if (s.transitions == 0) {
+    Serial.printf("  %s: none\n", what);
+    return;
+  }
+  Serial.printf("  %s: %u, edges avg %.1f max %u, settle avg %lld us max %lld us\n", what,
+                s.transitions, (double)s.edges / s.transitions, s.maxEdges,
+                (long long)(s.totalSettleUs / s.transitions), (long long)s.maxSettleUs);
+  Serial.printf("  %s settle:", what);
+  for (int i = 0; i < PAD_SETTLE_BUCKETS; i++) {
+    if (i < PAD_SETTLE_BUCKETS - 1) {
+      Serial.printf(" <%u us %u,", padSettleBounds[i], s.settleHistogram[i]);
+    } else {
+      Serial.printf(" more %u\n", s.settleHistogram[i]);
+    }
+  }
+}
+
+// Function to print a pad's bounce statistics and the suggested settle time
+inline void padFilterPrintStats(const PadFilter &f, const char *name) {
+  Serial.printf("%s bounce: settle %u us, %u glitches, %u edges dropped\n",
+                name, f.settleUs, f.glitches, f.edges.overflows.load());
+  bounceStatsPrint(f.stats[0], "presses");
+  bounceStatsPrint(f.stats[1], "releases");
+  Serial.printf("  suggested settle %u us\n", padFilterSuggestSettle(f));
+}
+
+// Function to print the captured edges, oldest first, one "edge <us> <level>" per line
+inline void padFilterPrintEdges(const PadFilter &f) {
+  uint32_t count = min(f.captured, (uint32_t)PAD_CAPTURE_EDGES);
+  for (uint32_t i = f.captured - count; i != f.captured; i++) {
+    const PadEdge &e = f.capture[i & (PAD_CAPTURE_EDGES - 1)];
+    Serial.printf("edge %lld %u\n", (long long)e.timeUs, e.level);
+  }
+}
+
+// Serial commands for tuning a pad on site:
+//   b         print the bounce statistics and the suggested settle time
+//   e         print the captured edges, for stopwatch-sim bounce --trace
+//   s<us>     set the settle time, ended by a newline
+typedef struct {
+  bool active;      // Reading the digits of an s command
+  uint32_t value;
+} PadCommand;
+
+// Function to take one character of a pad command
+// Returns true when the settle time was changed, for the caller to save it
+inline bool padFilterCommand(PadFilter &f, PadCommand &cmd, int c, const char *name) {
+  if (cmd.active) {
+    if (c >= '0' && c <= '9') {
+      cmd.value = cmd.value * 10 + (c - '0');
+      return false;
+    }
+    cmd.active = false;
+    if (cmd.value < PAD_SETTLE_MIN_US) return false;
+    f.settleUs = cmd.value;
+    Serial.printf("%s settle time %u us\n", name, f.settleUs);
+    return true;
+  }
+  if (c == 'b') padFilterPrintStats(f, name);
+  else if (c == 'e') padFilterPrintEdges(f);
+  else if (c == 's') cmd.active = true, cmd.value = 0;
+  return false;
+}
+
+#endif
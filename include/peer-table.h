@@ -0,0 +1,103 @@
+#ifndef PEER_TABLE_H
+#define PEER_TABLE_H
+
+#include <stdint.h>
+#include <string.h>
+#include "clock-sync.h"
+#include "link-stats.h"
+
+// Lanes and the start unit's table of top (stop) units.
+//
+// One start unit serves up to MAX_LANES lanes, each with its own top unit.
+// Lanes are numbered from 1; LANE_NONE is a top unit that hasn't heard its
+// lane from the start unit yet. A start or reset goes out once, as a
+// broadcast carrying the mask of lanes taking part, so every lane gets the
+// same frame at the same time however many there are; only retransmits go
+// to the lanes that haven't acknowledged. Each top unit reports its stop
+// edge on the start unit's clock, the race clock the winner is decided on.
+//
+// The table is indexed by lane, so looking up a lane is direct and looking
+// up a sender's MAC is a scan of at most MAX_LANES entries.
+
+#define MAX_LANES 4
+#define LANE_NONE 0
+#define LANE_BIT(lane) (1u << ((lane) - 1))
+
+static const uint8_t BROADCAST_MAC[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+typedef struct {
+  uint8_t mac[6];
+  uint8_t lane;              // LANE_NONE = no unit on this lane
+  bool heard;                // A message has come from the unit since we booted
+  int64_t lastSeen;          // halMicros() of the last message from the unit
+  int64_t pingIntervalUs;    // Longest wait until its next ping, as it last said, 0 = not told
+  int64_t lastPingTime;      // halMicros() of its last ping, 0 = none yet
+  LinkStats link;            // Link quality to the unit (link-stats.h)
+  ClockSync clockSync;       // The unit's clock against ours
+  int64_t lastPeerTxTime;    // Transmit time of the last message from the unit (its clock)
+  int64_t lastPeerRxTime;    // When we received it (our clock)
+  bool finished;             // Stop reported for the current race
+  int64_t stopEdgeTime;      // Reported stop edge on our clock (microseconds)
+} LanePeer;
+
+typedef struct {
+  LanePeer lanes[MAX_LANES]; // Entry i is lane i + 1
+  uint8_t configured;        // Mask of lanes with a unit
+} PeerTable;
+
+// Function to empty the table
+inline void peerTableReset(PeerTable &t) {
+  memset(&t, 0, sizeof(t));
+  for (int i = 0; i < MAX_LANES; i++) {
+    clockSyncReset(t.lanes[i].clockSync);
+  }
+}
+
+// Function to get a lane's entry, NULL if the lane has no unit
+inline LanePeer *peerTableLane(PeerTable &t, uint8_t lane) {
+  if (lane == LANE_NONE || lane > MAX_LANES || !(t.configured & LANE_BIT(lane))) return NULL;
+  return &t.lanes[lane - 1];
+}
+
+// Function to put a unit on a lane, returns NULL if the lane number is invalid
+inline LanePeer *peerTableAdd(PeerTable &t, const uint8_t *mac, uint8_t lane) {
+  if (lane == LANE_NONE || lane > MAX_LANES) return NULL;
+  LanePeer &p = t.lanes[lane - 1];
+  memcpy(p.mac, mac, 6);
+  p.lane = lane;
+  p.heard = false;
+  p.lastSeen = 0;
+  p.pingIntervalUs = 0;
+  p.lastPingTime = 0;
+  linkStatsReset(p.link);
+  clockSyncReset(p.clockSync);
+  p.lastPeerTxTime = 0;
+  p.lastPeerRxTime = 0;
+  p.finished = false;
+  t.configured |= LANE_BIT(lane);
+  return &p;
+}
+
+// Function to find the unit a message came from, NULL if it isn't in the table
+inline LanePeer *peerTableFind(PeerTable &t, const uint8_t *mac) {
+  for (int i = 0; i < MAX_LANES; i++) {
+    if ((t.configured & LANE_BIT(i + 1)) && memcmp(t.lanes[i].mac, mac, 6) == 0) return &t.lanes[i];
+  }
+  return NULL;
+}
+
+// Function to get the mask of lanes heard from within the timeout, or three
+// of a unit's ping intervals if that is longer (microseconds)
+inline uint8_t peerTableConnected(const PeerTable &t, int64_t now, int64_t timeout) {
+  uint8_t mask = 0;
+  for (int i = 0; i < MAX_LANES; i++) {
+    const LanePeer &p = t.lanes[i];
+    int64_t limit = 3 * p.pingIntervalUs > timeout ? 3 * p.pingIntervalUs : timeout;
+    if ((t.configured & LANE_BIT(i + 1)) && p.heard && now - p.lastSeen <= limit) {
+      mask |= LANE_BIT(i + 1);
+    }
+  }
+  return mask;
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef RUN_HISTORY_H
+#define RUN_HISTORY_H
+
+#include <Arduino.h>
+#include "hal.h"
+#include "crc32.h"
+
+// Run history in flash - an append-only ring of fixed-size records.
+//
+// The storage area (hal.h) is split into HISTORY_SECTORS sectors filled in
+// turn, so every sector is erased equally often. Each sector starts with a
+// header holding its generation, one higher than the sector before it,
+// followed by HISTORY_SLOTS run records. Records are only written into erased
+// slots and never rewritten; a sector is erased just before it is reused,
+// dropping the oldest runs.
+//
+// Power loss: a record cut off mid-write fails its CRC and is skipped, its
+// slot stays used. A torn header or half-erased sector fails the header check
+// and is erased again before it is used. stopwatch-sim history cuts the power
+// at every byte of a commit and checks what the next boot reads back.
+//
+// historyBegin() finds the newest sector from the headers and the first free
+// slot in it by binary search, a few dozen small reads. From there the last
+// runs are read straight back (historyReadRecent()).
+//
+// Writing flash stalls both cores, and erasing a sector takes tens of
+// milliseconds, so commit from a low-priority task while nothing is timed.
+
+#define HISTORY_SECTORS 16                                               // 64 KB, about 1000 runs
+#define HISTORY_RECORD_SIZE 64
+#define HISTORY_SLOTS (HAL_STORAGE_SECTOR / HISTORY_RECORD_SIZE - 1)     // First slot holds the header
+#define HISTORY_SECTOR_MAGIC 0x53524831u
+#define HISTORY_RECORD_MAGIC 0x4E555231u
+
+// RunRecord::startVerdict - runs started without the start sequence, and
+// records from before it, hold erased flash
+#define RUN_CLEAN_START 0
+#define RUN_FALSE_START 1
+#define RUN_NO_VERDICT 0xFF
+
+typedef struct {
+  uint32_t magic;
+  uint32_t generation;
+  uint32_t crc;            // Of magic and generation
+} HistorySectorHeader;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t sequence;       // Run number, one higher than the previous run
+  int64_t finalTimeUs;
+  int64_t startEdgeUs;     // Start pad release, on this unit's clock
+  int64_t stopEdgeUs;      // Stop pad press, on this unit's clock
+  int32_t rttUs;           // Link round trip when the run finished
+  int32_t driftPpb;        // Clock drift against the start unit (parts per billion)
+  uint32_t messages;       // Messages received from the start unit during the run
+  uint16_t duplicates;     // Duplicate start/reset signals among them
+  uint8_t clockSynced;     // Start edge mapped with a synchronised clock
+  uint8_t lane;            // Lane of this unit, LANE_NONE if not known (peer-table.h)
+  int32_t reactionUs;      // Start sequence reaction time, negative before the cue
+  uint8_t startVerdict;    // RUN_CLEAN_START, RUN_FALSE_START or RUN_NO_VERDICT
+  uint8_t reserved[7];
+  uint32_t crc;            // Of everything above
+} RunRecord;
+
+static_assert(sizeof(RunRecord) == HISTORY_RECORD_SIZE, "RunRecord must fill one slot");
+static_assert(sizeof(HistorySectorHeader) <= HISTORY_RECORD_SIZE, "Sector header must fit in one slot");
+
+struct RunHistory {
+  uint16_t sectors = 0;        // Sectors in use, 0 if there is no storage
+  uint16_t headSector = 0;     // Sector being filled
+  uint16_t headSlot = 0;       // Next free slot in it, HISTORY_SLOTS when full
+  uint32_t generation = 0;     // Generation of the head sector, 0 before the first write
+  uint32_t nextSequence = 1;
+};
+
+// Function to find the flash offset of a record slot
+inline uint32_t historySlotOffset(uint16_t sector, uint16_t slot) {
+  return (uint32_t)sector * HAL_STORAGE_SECTOR + (uint32_t)(slot + 1) * HISTORY_RECORD_SIZE;
+}
+
+// Function to read a sector header, returns false if it is missing or damaged
+inline bool historyReadHeader(uint16_t sector, uint32_t &generation) {
+  HistorySectorHeader header;
+  if (!halStorageRead((uint32_t)sector * HAL_STORAGE_SECTOR, &header, sizeof(header))) return false;
+  if (header.magic != HISTORY_SECTOR_MAGIC || header.crc != crc32Update(0, &header, 8)) return false;
+  generation = header.generation;
+  return true;
+}
+
+// Function to check whether a slot has been written to at all
+inline bool historySlotUsed(uint16_t sector, uint16_t slot) {
+  uint8_t bytes[HISTORY_RECORD_SIZE];
+  if (!halStorageRead(historySlotOffset(sector, slot), bytes, sizeof(bytes))) return true;
+  for (size_t i = 0; i < sizeof(bytes); i++) {
+    if (bytes[i] != 0xFF) return true;
+  }
+  return false;
+}
+
+// Function to read a record, returns false for a torn or empty slot
+inline bool historyReadSlot(uint16_t sector, uint16_t slot, RunRecord &record) {
+  if (!halStorageRead(historySlotOffset(sector, slot), &record, sizeof(record))) return false;
+  return record.magic == HISTORY_RECORD_MAGIC &&
+         record.crc == crc32Update(0, &record, offsetof(RunRecord, crc));
+}
+
+// Function to read up to n of the most recent runs, newest first; returns how many were found
+inline int historyReadRecent(const RunHistory &h, RunRecord *records, int n) {
+  if (h.generation == 0) return 0;
+  int found = 0;
+  uint16_t sector = h.headSector;
+  uint32_t generation = h.generation;
+  int slot = h.headSlot - 1;
+  while (found < n) {
+    if (slot < 0) {
+      // Continue in the previous sector if it is the previous generation
+      uint16_t prev = (sector + h.sectors - 1) % h.sectors;
+      uint32_t prevGeneration;
+      if (prev == h.headSector || !historyReadHeader(prev, prevGeneration) || prevGeneration != generation - 1) break;
+      sector = prev;
+      generation = prevGeneration;
+      slot = HISTORY_SLOTS - 1;
+    }
+    if (historyReadSlot(sector, slot, records[found])) found++;
+    slot--;
+  }
+  return found;
+}
+
+// Function to locate the end of the log, call once at boot
+// Returns false if there is no storage area
+inline bool historyBegin(RunHistory &h) {
+  h.sectors = min((uint32_t)HISTORY_SECTORS, halStorageSize() / HAL_STORAGE_SECTOR);
+  h.generation = 0;
+  h.nextSequence = 1;
+  if (h.sectors == 0) return false;
+
+  // Newest sector by generation
+  for (uint16_t sector = 0; sector < h.sectors; sector++) {
+    uint32_t generation;
+    if (historyReadHeader(sector, generation) && generation > h.generation) {
+      h.generation = generation;
+      h.headSector = sector;
+    }
+  }
+  if (h.generation == 0) {
+    // Nothing written yet - the first append starts on sector 0
+    h.headSector = h.sectors - 1;
+    h.headSlot = HISTORY_SLOTS;
+    return true;
+  }
+
+  // Slots fill in order, so the used ones are a prefix of the sector
+  uint16_t lo = 0, hi = HISTORY_SLOTS;
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2;
+    if (historySlotUsed(h.headSector, mid)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  h.headSlot = lo;
+
+  RunRecord last;
+  if (historyReadRecent(h, &last, 1) == 1) h.nextSequence = last.sequence + 1;
+  return true;
+}
+
+// Function to erase the next sector and start filling it, dropping its old runs
+inline bool historyAdvance(RunHistory &h) {
+  uint16_t sector = (h.headSector + 1) % h.sectors;
+  if (!halStorageErase((uint32_t)sector * HAL_STORAGE_SECTOR, HAL_STORAGE_SECTOR)) return false;
+
+  HistorySectorHeader header;
+  header.magic = HISTORY_SECTOR_MAGIC;
+  header.generation = h.generation + 1;
+  header.crc = crc32Update(0, &header, 8);
+  h.headSector = sector;
+  h.headSlot = 0;
+  h.generation = header.generation;
+  return halStorageWrite((uint32_t)sector * HAL_STORAGE_SECTOR, &header, sizeof(header));
+}
+
+// Function to erase the next sector ahead of time if the head sector is full,
+// so the next append only has to program one record
+inline bool historyPrepare(RunHistory &h) {
+  if (h.sectors == 0 || h.headSlot < HISTORY_SLOTS) return true;
+  return historyAdvance(h);
+}
+
+// Function to append a run, filling in its magic, sequence number and CRC
+inline bool historyAppend(RunHistory &h, RunRecord &record) {
+  if (h.sectors == 0) return false;
+  if (h.headSlot >= HISTORY_SLOTS && !historyAdvance(h)) return false;
+
+  record.magic = HISTORY_RECORD_MAGIC;
+  record.sequence = h.nextSequence++;
+  memset(record.reserved, 0xFF, sizeof(record.reserved));
+  record.crc = crc32Update(0, &record, offsetof(RunRecord, crc));
+  bool ok = halStorageWrite(historySlotOffset(h.headSector, h.headSlot), &record, sizeof(record));
+  h.headSlot++; // Even a failed write may have programmed part of the slot
+  return ok;
+}
+
+#endif
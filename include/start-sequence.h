@@ -0,0 +1,175 @@
+#ifndef START_SEQUENCE_H
+#define START_SEQUENCE_H
+
+#include <Arduino.h>
+
+// Start sequence for competition runs, on the start unit.
+//
+// With the sequence on, the climber steps on the pad and, START_READY_US
+// after the press, the unit sounds two short beeps a second apart and the
+// start cue a second after them. A one-shot timer (halTimerCreate()) switches
+// the cue output for each step, and startSequenceStep() stamps the cue as the
+// output goes on, so the cue time is when the climber got it. The run is timed
+// from the cue.
+//
+// startSequenceJudge() takes the pad release edge (pad-filter.h): the
+// reaction time is the release minus the cue. A release before the cue, or
+// less than the false start threshold after it, is a false start; a cue that
+// hasn't sounded yet is cancelled and the run is timed from the release
+// instead. Leaving the pad before the first beep is not a start at all. The
+// verdict goes to the top units with the start signal (wire-protocol.h).
+//
+// Nothing here touches the hardware; the sketch drives the cue output and
+// holds its spinlock around the calls, as the timer runs on the other core.
+
+#define START_READY_US 1500000          // Pad held this long before the first beep
+#define FALSE_START_DEFAULT_US 100000   // Reactions quicker than this are false starts
+#define FALSE_START_MAX_US 1000000
+
+// Cue output steps, from the pad press (microseconds)
+typedef struct {
+  int64_t atUs;
+  bool on;
+} CueStep;
+
+static const CueStep startCueSteps[] = {
+  { START_READY_US, true },             // First beep
+  { START_READY_US + 100000, false },
+  { START_READY_US + 1000000, true },   // Second beep
+  { START_READY_US + 1100000, false },
+  { START_READY_US + 2000000, true },   // Start cue
+  { START_READY_US + 2400000, false },
+};
+#define START_CUE_STEPS (int)(sizeof(startCueSteps) / sizeof(startCueSteps[0]))
+#define START_CUE_STEP 4                // The step that is the start cue
+
+typedef struct {
+  bool falseStart;
+  int64_t reactionUs;   // Release minus cue, negative for a release before it
+  int64_t startEdge;    // What the run is timed from: the cue, or the release if it came first
+} StartVerdict;
+
+struct StartSequence {
+  bool enabled = false;
+  volatile uint32_t falseStartUs = FALSE_START_DEFAULT_US;
+  bool armed = false;          // Pad pressed, steps still to play
+  int step = 0;                // Next step
+  int64_t armedAt = 0;         // Pad press edge the steps are timed from
+  int64_t cueTime = 0;         // When the cue went on, 0 until it has
+  uint32_t starts = 0;         // Judged releases, false starts included
+  uint32_t falseStarts = 0;
+  int64_t totalReactionUs = 0; // Of the starts that weren't false
+  int64_t bestReactionUs = 0;
+};
+
+// Function to arm the sequence on a pad press
+// Returns when the first step is due (halMicros() time)
+inline int64_t startSequenceArm(StartSequence &s, int64_t pressEdge) {
+  s.armed = true;
+  s.step = 0;
+  s.armedAt = pressEdge;
+  s.cueTime = 0;
+  return pressEdge + startCueSteps[0].atUs;
+}
+
+// Function to stop the sequence, e.g. on a reset; the caller turns the cue off
+inline void startSequenceCancel(StartSequence &s) {
+  s.armed = false;
+}
+
+// Function to take the next step, from the cue timer; now is the time the
+// output is switched, which is stamped if this step is the cue
+// Returns true with the output level in on if a step was due; a timer left
+// over from an earlier sequence fires early and only sets next. next is when
+// the following step is due (halMicros() time), 0 if there is none.
+inline bool startSequenceStep(StartSequence &s, int64_t now, bool &on, int64_t &next) {
+  next = 0;
+  if (!s.armed || s.step >= START_CUE_STEPS) return false;
+  int64_t due = s.armedAt + startCueSteps[s.step].atUs;
+  if (now < due) {
+    next = due;
+    return false;
+  }
+  on = startCueSteps[s.step].on;
+  if (s.step == START_CUE_STEP) s.cueTime = now;
+  s.step++;
+  if (s.step < START_CUE_STEPS) {
+    next = s.armedAt + startCueSteps[s.step].atUs;
+  } else {
+    s.armed = false;
+  }
+  return true;
+}
+
+// Function to judge a pad release
+// Returns false if the climber left the pad before the first beep, which
+// cancels the sequence and is not a start; otherwise fills in the verdict. A
+// cue that is still to come is cancelled, the caller turns its output off.
+inline bool startSequenceJudge(StartSequence &s, int64_t releaseEdge, StartVerdict &v) {
+  if (s.cueTime == 0 && (!s.armed || s.step == 0)) {
+    s.armed = false;
+    return false;
+  }
+
+  int64_t cue = s.cueTime;
+  if (cue == 0) {
+    s.armed = false;
+    cue = s.armedAt + startCueSteps[START_CUE_STEP].atUs;
+  }
+  v.reactionUs = releaseEdge - cue;
+  v.falseStart = v.reactionUs < (int64_t)s.falseStartUs;
+  v.startEdge = v.reactionUs >= 0 ? cue : releaseEdge;
+  s.cueTime = 0;  // Judged once; the cue output still goes off on time
+
+  s.starts++;
+  if (v.falseStart) {
+    s.falseStarts++;
+  } else {
+    s.totalReactionUs += v.reactionUs;
+    if (s.bestReactionUs == 0 || v.reactionUs < s.bestReactionUs) s.bestReactionUs = v.reactionUs;
+  }
+  return true;
+}
+
+// Function to print the sequence settings and reaction statistics
+inline void startSequencePrintStats(const StartSequence &s) {
+  Serial.printf("Start sequence %s, false start under %u us\n", s.enabled ? "on" : "off", s.falseStartUs);
+  uint32_t valid = s.starts - s.falseStarts;
+  Serial.printf("  %u starts, %u false, reaction avg %lld us best %lld us\n", s.starts, s.falseStarts,
+                valid > 0 ? (long long)(s.totalReactionUs / valid) : 0LL, (long long)s.bestReactionUs);
+}
+
+// Serial commands for the start sequence:
+//   c         turn the sequence on or off
+//   f<us>     set the false start threshold, ended by a newline
+//   r         print the settings and reaction statistics
+typedef struct {
+  bool active;      // Reading the digits of an f command
+  uint32_t value;
+} StartCommand;
+
+// Function to take one character of a start sequence command
+// Returns true when a setting was changed, for the caller to save it
+inline bool startSequenceCommand(StartSequence &s, StartCommand &cmd, int c) {
+  if (cmd.active) {
+    if (c >= '0' && c <= '9') {
+      cmd.value = cmd.value * 10 + (c - '0');
+      return false;
+    }
+    cmd.active = false;
+    if (cmd.value > FALSE_START_MAX_US) return false;
+    s.falseStartUs = cmd.value;
+    Serial.printf("False start threshold %u us\n", s.falseStartUs);
+    return true;
+  }
+  if (c == 'c') {
+    s.enabled = !s.enabled;
+    Serial.printf("Start sequence %s\n", s.enabled ? "on" : "off");
+    return true;
+  }
+  if (c == 'r') startSequencePrintStats(s);
+  else if (c == 'f') cmd.active = true, cmd.value = 0;
+  return false;
+}
+
+#endif
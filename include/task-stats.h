@@ -0,0 +1,66 @@
+#ifndef TASK_STATS_H
+#define TASK_STATS_H
+
+#include <Arduino.h>
+#include "hal.h"
+
+// Per-task CPU time and wake-up latency.
+//
+// A task calls taskStatsWake() when it wakes and taskStatsSleep() before it
+// blocks again; the time in between counts as busy. taskStatsLatency()
+// records how long an event waited before the task got to it (e.g. button
+// edge to timing task, digit boundary to frame pushed). The fields are only
+// written by the owning task and read elsewhere for printing.
+
+typedef struct {
+  const char *name;
+  uint32_t wakeups;
+  int64_t busyUs;
+  int64_t sinceUs;         // Start of the measurement window
+  int64_t wakeTime;
+  uint32_t latencySamples;
+  int64_t totalLatencyUs;
+  int64_t maxLatencyUs;
+} TaskStats;
+
+// Function to start a new measurement window
+inline void taskStatsReset(TaskStats &ts, const char *name) {
+  ts.name = name;
+  ts.wakeups = 0;
+  ts.busyUs = 0;
+  ts.sinceUs = halMicros();
+  ts.wakeTime = 0;
+  ts.latencySamples = 0;
+  ts.totalLatencyUs = 0;
+  ts.maxLatencyUs = 0;
+}
+
+// Function to mark the task as running
+inline void taskStatsWake(TaskStats &ts) {
+  ts.wakeTime = halMicros();
+  ts.wakeups++;
+}
+
+// Function to mark the task as about to block
+inline void taskStatsSleep(TaskStats &ts) {
+  ts.busyUs += halMicros() - ts.wakeTime;
+}
+
+// Function to record how long an event waited for the task
+inline void taskStatsLatency(TaskStats &ts, int64_t latencyUs) {
+  ts.latencySamples++;
+  ts.totalLatencyUs += latencyUs;
+  if (latencyUs > ts.maxLatencyUs) ts.maxLatencyUs = latencyUs;
+}
+
+// Function to print CPU share and latency for a task
+inline void taskStatsPrint(const TaskStats &ts) {
+  int64_t window = halMicros() - ts.sinceUs;
+  float cpu = window > 0 ? 100.0f * ts.busyUs / window : 0.0f;
+  Serial.printf("Task %s: cpu %.2f%%, %u wakeups, latency avg %lld us, max %lld us\n",
+                ts.name, cpu, ts.wakeups,
+                ts.latencySamples ? (long long)(ts.totalLatencyUs / ts.latencySamples) : 0LL,
+                (long long)ts.maxLatencyUs);
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef TRACE_BUFFER_H
+#define TRACE_BUFFER_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "hal.h"
+
+// Hot-path trace buffer.
+//
+// TRACE_BEGIN(event, arg) and TRACE_END(event) around a section record the CPU
+// cycle counter, the core and the event into a fixed in-RAM ring that keeps
+// the most recent TRACE_CAPACITY records. Sending 't' over Serial dumps the
+// ring in the binary format below (traceServiceRequests()), and
+// tools/trace-decode.py turns the dump into a timeline or Chrome trace JSON.
+//
+// Tracing is only compiled in with STOPWATCH_TRACE defined (add
+// -DSTOPWATCH_TRACE to build_flags); otherwise the macros expand to nothing.
+//
+// Dump format, little-endian:
+//   header  "STRC", u8 version, u8 record size, u16 CPU MHz,
+//           u32 records that follow, u32 older records overwritten
+//   record  u32 cycle count, u8 event, u8 flags, u16 argument
+// Each core has its own cycle counter, wrapping every 2^32 cycles (about 18 s
+// at 240 MHz); the decoder unwraps them separately.
+
+#ifndef TRACE_CAPACITY
+#define TRACE_CAPACITY 512   // Records kept, must be a power of two (8 bytes each)
+#endif
+
+#define TRACE_VERSION 1
+#define TRACE_FLAG_END 0x01    // Record ends a section
+#define TRACE_FLAG_CORE1 0x02  // Recorded on core 1
+
+// Traced sections, names in tools/trace-decode.py must match
+enum TraceEvent {
+  TRACE_CHECK_BUTTON,     // Button debounce and edge validation
+  TRACE_RADIO_RECEIVE,    // ESP-NOW receive callback, argument is the message type
+  TRACE_DISPLAY_UPDATE,   // updateStopwatchDisplay()
+  TRACE_SET_ROW,          // One mx.setRow() call, argument is panel * 8 + row
+  TRACE_EVENTS
+};
+
+typedef struct {
+  uint32_t cycles;
+  uint8_t event;
+  uint8_t flags;
+  uint16_t arg;
+} TraceRecord;
+
+typedef struct {
+  char magic[4];
+  uint8_t version;
+  uint8_t recordSize;
+  uint16_t cpuMhz;
+  uint32_t count;
+  uint32_t overwritten;
+} TraceDumpHeader;
+
+static_assert(sizeof(TraceRecord) == 8, "TraceRecord must stay 8 bytes");
+static_assert(sizeof(TraceDumpHeader) == 16, "TraceDumpHeader must stay 16 bytes");
+static_assert((TRACE_CAPACITY & (TRACE_CAPACITY - 1)) == 0, "TRACE_CAPACITY must be a power of two");
+
+struct TraceBuffer {
+  TraceRecord records[TRACE_CAPACITY];
+  std::atomic<uint32_t> head{0};        // Records written since the last dump
+  std::atomic<bool> enabled{true};      // Cleared while dumping
+};
+
+// Function to get the trace buffer, one for the whole program
+inline TraceBuffer &traceBuffer() {
+  static TraceBuffer buffer;
+  return buffer;
+}
+
+// Function to append a record, callable from any task on either core
+inline void traceRecord(uint8_t event, uint8_t flags, uint16_t arg) {
+  TraceBuffer &tb = traceBuffer();
+  if (!tb.enabled.load(std::memory_order_relaxed)) return;
+  uint32_t slot = tb.head.fetch_add(1, std::memory_order_relaxed);
+  TraceRecord &r = tb.records[slot & (TRACE_CAPACITY - 1)];
+  r.cycles = halCycleCount();
+  r.event = event;
+  r.flags = flags | (xPortGetCoreID() == 1 ? TRACE_FLAG_CORE1 : 0);
+  r.arg = arg;
+}
+
+// Function to write the buffer to Serial and start a new trace
+inline void traceDump() {
+  TraceBuffer &tb = traceBuffer();
+  tb.enabled.store(false);
+  uint32_t head = tb.head.load();
+  uint32_t count = head < TRACE_CAPACITY ? head : TRACE_CAPACITY;
+
+  TraceDumpHeader header;
+  memcpy(header.magic, "STRC", 4);
+  header.version = TRACE_VERSION;
+  header.recordSize = sizeof(TraceRecord);
+  header.cpuMhz = halCpuMhz();
+  header.count = count;
+  header.overwritten = head - count;
+  Serial.write((const uint8_t *)&header, sizeof(header));
+
+  // Oldest first, in at most two pieces around the end of the ring
+  uint32_t first = (head - count) & (TRACE_CAPACITY - 1);
+  uint32_t tail = min(count, (uint32_t)TRACE_CAPACITY - first);
+  Serial.write((const uint8_t *)&tb.records[first], tail * sizeof(TraceRecord));
+  Serial.write((const uint8_t *)&tb.records[0], (count - tail) * sizeof(TraceRecord));
+  Serial.flush();
+
+  tb.head.store(0);
+  tb.enabled.store(true);
+}
+
+#ifdef STOPWATCH_TRACE
+#define TRACE_BEGIN(event, arg) traceRecord((event), 0, (arg))
+#define TRACE_END(event) traceRecord((event), TRACE_FLAG_END, 0)
+#define TRACE_DUMP() traceDump()
+#else
+#define TRACE_BEGIN(event, arg) ((void)0)
+#define TRACE_END(event) ((void)0)
+#define TRACE_DUMP() ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef WIRE_PROTOCOL_H
+#define WIRE_PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "crc32.h"
+#include "peer-table.h"
+
+// ESP-NOW frame format between the units.
+//
+// A frame carries up to WIRE_MAX_EVENTS events (start, ack, ping, ...) so
+// replies and pings that fall due together share one transmission. The
+// sender's transmit time and the echo of the last frame it received (the
+// clock synchronisation fields) are carried once per frame. Fields are
+// little-endian with fixed widths, packed with no padding:
+//
+//   header  u8 version, u8 lane, u8 event count, u8 reserved (0),
+//           i64 timestamp, i64 echo time, i64 receive time
+//   event   u8 type, u8 lane mask, u32 sequence, i64 edge time   (per event)
+//   trailer u32 CRC-32 of everything before it
+//
+// A frame is rejected if it is shorter or longer than its event count says,
+// has another version or fails the CRC. Event types a receiver doesn't know
+// are passed through for it to ignore, so new ones can be added without a
+// version change; changing the layout needs a new WIRE_VERSION.
+
+#define WIRE_VERSION 1
+#define WIRE_MAX_EVENTS 4
+#define WIRE_HEADER_SIZE 28
+#define WIRE_EVENT_SIZE 14
+#define WIRE_CRC_SIZE 4
+#define WIRE_MAX_FRAME (WIRE_HEADER_SIZE + WIRE_MAX_EVENTS * WIRE_EVENT_SIZE + WIRE_CRC_SIZE)
+
+// One event with the timing fields of the frame it came in, as the sketches handle it
+typedef struct {
+  int messageType;  // 1 = start signal, 2 = reset signal, 3 = ping, 4 = pong, 5 = ack, 6 = lane result,
+                    // 7 = discovery (a ping from a top unit looking for a start unit),
+                    // 8 = start verdict (follows a start from the start sequence in the same frame),
+                    // 9 = ready (a climber stepped on the start pad; a hint, not acknowledged)
+  uint32_t sequence; // Start/reset: per-message sequence number, ack: sequence being acknowledged,
+                     // result, verdict: sequence of the start signal,
+                     // ping/discovery: ping number (0 = not numbered), pong: number of the ping answered
+  int64_t timestamp; // Sender's esp_timer clock when the frame was sent (microseconds)
+  int64_t edgeTime;  // Start signal: pad release edge (or start cue) on the sender's clock,
+                     // result: stop edge on the start unit's clock,
+                     // verdict: reaction time, negative before the cue,
+                     // ping/discovery: longest wait until the sender's next one (microseconds)
+  int64_t echoTime;  // Transmit time of the last frame received from the peer (peer clock)
+  int64_t recvTime;  // When that frame was received (sender's clock)
+  uint8_t lane;      // Lane of the top unit sending or addressed, LANE_NONE for a broadcast
+  uint8_t laneMask;  // Start/reset/ready: lanes taking part, verdict: 1 for a false start
+} Message;
+
+// A frame's header fields and events, to encode or decoded
+typedef struct {
+  uint8_t lane;
+  int64_t timestamp;
+  int64_t echoTime;
+  int64_t recvTime;
+  Message events[WIRE_MAX_EVENTS];
+  int count;
+} WireBatch;
+
+enum WireStatus { WIRE_OK, WIRE_TRUNCATED, WIRE_BAD_VERSION, WIRE_BAD_LENGTH, WIRE_BAD_CRC };
+
+// Function to empty a batch
+inline void wireBatchClear(WireBatch &b) {
+  b.count = 0;
+}
+
+// Function to add an event to a batch, returns false if it is full
+inline bool wireBatchAdd(WireBatch &b, int type, uint32_t sequence, int64_t edgeTime, uint8_t laneMask) {
+  if (b.count >= WIRE_MAX_EVENTS) return false;
+  Message &m = b.events[b.count++];
+  m.messageType = type;
+  m.sequence = sequence;
+  m.edgeTime = edgeTime;
+  m.laneMask = laneMask;
+  return true;
+}
+
+// Functions to store and load little-endian fields
+inline void wirePut(uint8_t *&p, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) *p++ = (uint8_t)(value >> (8 * i));
+}
+
+inline uint64_t wireGet(const uint8_t *&p, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; i++) value |= (uint64_t)*p++ << (8 * i);
+  return value;
+}
+
+// Function to encode a batch into a frame, out must hold WIRE_MAX_FRAME bytes
+// Returns the frame length
+inline size_t wireEncode(const WireBatch &b, uint8_t *out) {
+  uint8_t *p = out;
+  wirePut(p, WIRE_VERSION, 1);
+  wirePut(p, b.lane, 1);
+  wirePut(p, b.count, 1);
+  wirePut(p, 0, 1);
+  wirePut(p, b.timestamp, 8);
+  wirePut(p, b.echoTime, 8);
+  wirePut(p, b.recvTime, 8);
+  for (int i = 0; i < b.count; i++) {
+    const Message &m = b.events[i];
+    wirePut(p, m.messageType, 1);
+    wirePut(p, m.laneMask, 1);
+    wirePut(p, m.sequence, 4);
+    wirePut(p, m.edgeTime, 8);
+  }
+  wirePut(p, crc32Update(0, out, p - out), 4);
+  return p - out;
+}
+
+// Function to check and decode a frame; on WIRE_OK every event also carries the header fields
+inline WireStatus wireDecode(const uint8_t *data, size_t len, WireBatch &b) {
+  b.count = 0;
+  if (len < WIRE_HEADER_SIZE + WIRE_CRC_SIZE) return WIRE_TRUNCATED;
+
+  const uint8_t *p = data;
+  uint8_t version = wireGet(p, 1);
+  uint8_t lane = wireGet(p, 1);
+  uint8_t count = wireGet(p, 1);
+  if (version != WIRE_VERSION) return WIRE_BAD_VERSION;
+  if (count > WIRE_MAX_EVENTS || len != (size_t)WIRE_HEADER_SIZE + count * WIRE_EVENT_SIZE + WIRE_CRC_SIZE) {
+    return WIRE_BAD_LENGTH;
+  }
+  const uint8_t *crcField = data + len - WIRE_CRC_SIZE;
+  if ((uint32_t)wireGet(crcField, 4) != crc32Update(0, data, len - WIRE_CRC_SIZE)) return WIRE_BAD_CRC;
+
+  p++; // Reserved
+  b.lane = lane;
+  b.timestamp = wireGet(p, 8);
+  b.echoTime = wireGet(p, 8);
+  b.recvTime = wireGet(p, 8);
+  for (int i = 0; i < count; i++) {
+    Message &m = b.events[i];
+    m.messageType = wireGet(p, 1);
+    m.laneMask = wireGet(p, 1);
+    m.sequence = wireGet(p, 4);
+    m.edgeTime = wireGet(p, 8);
+    m.timestamp = b.timestamp;
+    m.echoTime = b.echoTime;
+    m.recvTime = b.recvTime;
+    m.lane = lane;
+  }
+  b.count = count;
+  return WIRE_OK;
+}
+
+#endif
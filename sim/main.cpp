@@ -0,0 +1,1523 @@
+// Stopwatch simulator - runs the sketches on the host against simulated pads,
+// display and radio, and checks the times they record.
+//
+// Usage: stopwatch-sim <scenario> [options]
+//   pair            bottom (start) and top (stop) units over the simulated radio
+//   race            one bottom unit starting a top unit on each of several lanes
+//   single          single-pad-stopwatch
+//   single-decimal  single-pad-stopwatch-single-decimal
+//   bench           pair start path latency per stage, as JSON lines (see runBench)
+//   wire            frame encoder/decoder round trips and malformed frames (see runWire)
+//   boot            power-on to connected for first pairing, restarts and swapped units (see runBoot)
+//   repair          more top units swapped in than ESP-NOW has peers for (see runRepair)
+//   bounce          start pad conditioning under contact chatter and glitches (see runBounce)
+//   reaction        pair with the start sequence: reaction times and false starts (see runReaction)
+//   link            pair link statistics and adaptive pings against the radio model (see runLink)
+//   sleep           pair with the start unit in low power mode (see runSleep)
+//   sync            pair clock synchronisation under asymmetric and jittery links (see runSync)
+//   history         run history in flash against power cuts mid-write (see runHistory)
+// Options:
+//   --runs N        runs to time (default 5, bench 100 per radio profile, wire thousands of frames)
+//   --seed N        random seed (default 1)
+//   --latency US    radio latency (default 1500)
+//   --down-latency US  radio latency of frames to the start unit (default --latency)
+//   --jitter US     extra random radio latency (default 500)
+//   --loss P        radio frame loss ratio, 0-1 (default 0)
+//   --rssi DBM      signal strength of received frames (default -60)
+//                   bench runs its built-in profiles unless a radio option is given
+//   --drift PPM     top unit clock drift against the bottom unit (default 20)
+//   --lanes N       race lanes, 2-4 (default 2)
+//   --trace FILE    bounce: replay a captured edge trace instead (see replayBounceTrace)
+//   --settle US     bounce: pad settle time (default the sketch's)
+//   --wrap S        start the units' clocks S seconds short of 2^32 ms, where a
+//                   32-bit millis() wraps after 49.7 days of uptime
+//   --wake-latency US  light sleep wake latency (default SIM_WAKE_LATENCY_US)
+//   --verbose       show the units' Serial output
+//
+// Exits non-zero if any run was not recorded or is off by more than the
+// scenario's tolerance.
+
+#include <Arduino.h>
+#include <MD_MAX72xx.h>
+#include <SPI.h>
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "hal.h"
+#include "matrix-transport.h"
+#include "matrix-frame.h"
+#include "digit-glyphs.h"
+#include "bcd-counter.h"
+#include "clock-sync.h"
+#include "event-queue.h"
+#include "task-stats.h"
+#include "trace-buffer.h"
+#include "deferred-log.h"
+#include "peer-table.h"
+#include "wire-protocol.h"
+#include "run-history.h"
+#include "pad-filter.h"
+#include "start-sequence.h"
+#include "link-stats.h"
+#include "low-power.h"
+#include "sim.h"
+
+// Each sketch gets its own namespace so several units can share the process.
+// Their headers are already included above, so the includes inside are no-ops.
+namespace bottomUnit {
+#include "../stopwatch-bottom-start.cpp"
+}
+namespace topUnit {
+#include "../stopwatch-top-stop.cpp"
+}
+// More copies of the sketches, for the race's other lanes and for units
+// booting again in the boot and repair scenarios
+namespace bottomUnit2 {
+#include "../stopwatch-bottom-start.cpp"
+}
+namespace bottomUnit3 {
+#include "../stopwatch-bottom-start.cpp"
+}
+namespace bottomUnit4 {
+#include "../stopwatch-bottom-start.cpp"
+}
+namespace bottomUnit5 {
+#include "../stopwatch-bottom-start.cpp"
+}
+namespace bottomUnit6 {
+#include "../stopwatch-bottom-start.cpp"
+}
+namespace topLane2 {
+#include "../stopwatch-top-stop.cpp"
+}
+namespace topLane3 {
+#include "../stopwatch-top-stop.cpp"
+}
+namespace topLane4 {
+#include "../stopwatch-top-stop.cpp"
+}
+namespace singlePad {
+#include "../single-pad-stopwatch"
+}
+namespace singleDecimal {
+#include "../single-pad-stopwatch-single-decimal"
+}
+
+static const int64_t SECOND_US = 1000000;
+static const int64_t MILLIS_WRAP_US = 4294967296LL * 1000;  // 2^32 ms
+
+// Units' MAC addresses - the sketches find each other by discovery
+static const uint8_t BOTTOM_MAC[6] = { 0xFC, 0xB4, 0x67, 0x4E, 0x7D, 0x58 };
+static const uint8_t TOP_MAC[6] = { 0xFC, 0xB4, 0x67, 0x4E, 0x7E, 0x38 };
+
+typedef struct {
+  int runs;
+  uint32_t seed;
+  SimRadioProfile radio;
+  bool customRadio;   // Radio options given on the command line
+  double driftPpm;
+  int lanes;
+  const char *trace;  // Edge trace to replay, NULL = none
+  uint32_t settleUs;  // Pad settle time, 0 = the sketch's
+  int64_t wrapUs;     // True time the units' clocks reach MILLIS_WRAP_US, -1 = start at zero
+  int64_t wakeLatencyUs;  // Light sleep wake latency
+} SimOptions;
+
+static uint32_t scenarioRandom = 1;
+
+// Function to draw run lengths, separate from the simulator's own random numbers
+static uint32_t nextRandom() {
+  scenarioRandom = scenarioRandom * 1664525u + 1013904223u;
+  return scenarioRandom >> 8;
+}
+
+// Function to get the radio model's round trip, up and down, without jitter
+static int64_t radioRoundTripUs(const SimRadioProfile &radio) {
+  return radio.latencyUs + (radio.downLatencyUs >= 0 ? radio.downLatencyUs : radio.latencyUs);
+}
+
+// Function to press (LOW) or release (HIGH) a pad with contact bounce
+static void bouncePin(SimNode *node, uint8_t pin, int level, int64_t at) {
+  simSetPin(node, pin, level, at);
+  simSetPin(node, pin, !level, at + 150);
+  simSetPin(node, pin, level, at + 400);
+}
+
+// Function to read the number on a display, ignoring blanks and the point
+static long displayValue(const std::string &text) {
+  long value = 0;
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] == '?') return -1;
+    if (text[i] >= '0' && text[i] <= '9') value = value * 10 + (text[i] - '0');
+  }
+  return value;
+}
+
+// Outcome of one timed climb on the pair
+typedef struct {
+  bool recorded;       // Top unit stopped and is showing a final time
+  int64_t errorUs;     // Final time minus the true climb time
+  std::string shown;   // What the top display showed
+} PairRun;
+
+// Function to add the bottom and top units and let them connect and synchronise
+static void startPair(const SimOptions &opt, SimNode **bottom, SimNode **top) {
+  *bottom = simAddNode("bottom", BOTTOM_MAC, bottomUnit::setup, bottomUnit::loop);
+  *top = simAddNode("top", TOP_MAC, topUnit::setup, topUnit::loop);
+  simSetClock(*top, 3217000, opt.driftPpm); // Powered up a few seconds before the bottom unit
+  simRun(12 * SECOND_US);
+}
+
+// Function to time one climb: the climber steps on the pad at t, leaves it a
+// second later and hits the stop pad runUs after that; the bottom unit resets
+// the pair afterwards. Latency probes cover the start only.
+static PairRun timePairRun(SimNode *bottom, SimNode *top, int64_t t, int64_t runUs) {
+  int64_t start = t + SECOND_US;
+  int64_t stop = start + runUs;
+
+  bouncePin(bottom, BUTTON_PAD_PIN, LOW, t);       // Climber steps on the start pad
+  simRun(start - 1000);
+  simClearProbes();
+  bouncePin(bottom, BUTTON_PAD_PIN, HIGH, start);  // and leaves it
+  bouncePin(top, BUTTON_PIN, LOW, stop);           // Hits the stop pad
+  bouncePin(top, BUTTON_PIN, HIGH, stop + 300000);
+  simRun(stop + 200000);
+
+  PairRun result;
+  result.recorded = topUnit::stopwatchState == topUnit::DISPLAYING;
+  result.errorUs = topUnit::finalTimeUs - runUs;
+  result.shown = simDisplayText(top);
+
+  // Reset from the bottom unit
+  simSetPin(bottom, RESET_BUTTON_PIN, LOW, stop + SECOND_US);
+  simSetPin(bottom, RESET_BUTTON_PIN, HIGH, stop + SECOND_US + 100000);
+  simRun(stop + 3 * SECOND_US);
+  return result;
+}
+
+// Bottom unit starts, top unit stops; checks the top unit's final time
+static int runPair(const SimOptions &opt) {
+  const int64_t toleranceUs = 1000;
+  SimNode *bottom, *top;
+  startPair(opt, &bottom, &top);
+
+  int failures = 0;
+  int64_t worstUs = 0;
+  for (int run = 1; run <= opt.runs; run++) {
+    int64_t runUs = 5 * SECOND_US + nextRandom() % (4 * SECOND_US);
+    PairRun r = timePairRun(bottom, top, simNow(), runUs);
+
+    bool ok = r.recorded && llabs(r.errorUs) <= toleranceUs &&
+              displayValue(r.shown) == (long)((runUs + r.errorUs) / topUnit::CENTISECOND_US);
+    if (r.recorded && llabs(r.errorUs) > worstUs) worstUs = llabs(r.errorUs);
+    if (!ok) failures++;
+    printf("run %d: actual %.6f s, measured %.6f s, error %+lld us, display \"%s\"%s\n",
+           run, runUs / 1e6, r.recorded ? (runUs + r.errorUs) / 1e6 : 0.0,
+           r.recorded ? (long long)r.errorUs : 0LL, r.shown.c_str(), ok ? "" : "  FAIL");
+  }
+
+  printf("pair: %d/%d runs ok, worst error %lld us (tolerance %lld us)\n",
+         opt.runs - failures, opt.runs, (long long)worstUs, (long long)toleranceUs);
+  return failures == 0 ? 0 : 1;
+}
+
+// A lane's top unit: its sketch copy and what the race scenario reads back
+typedef struct {
+  const char *name;
+  void (*setup)();
+  void (*loop)();
+  bool (*stopped)();       // Showing a final time
+  int64_t *finalTimeUs;
+  uint8_t *laneId;         // Lane the bottom unit gave it when it paired
+} LaneUnit;
+
+#define LANE_UNIT(ns, name) \
+  { name, ns::setup, ns::loop, [] { return ns::stopwatchState == ns::DISPLAYING; }, &ns::finalTimeUs, &ns::laneId }
+
+static const LaneUnit laneUnits[MAX_LANES] = {
+  LANE_UNIT(topUnit, "lane1"),
+  LANE_UNIT(topLane2, "lane2"),
+  LANE_UNIT(topLane3, "lane3"),
+  LANE_UNIT(topLane4, "lane4"),
+};
+
+// Several lanes started by one release; checks every lane's final time and
+// that the bottom unit placed the lanes in the order they really finished
+static int runRace(const SimOptions &opt) {
+  const int64_t toleranceUs = 1000;
+  int lanes = opt.lanes;
+
+  // The first unit keeps the pair's top unit MAC, the others get their own;
+  // they pair by discovery, so which lane each gets depends on the radio
+  SimNode *top[MAX_LANES];
+  SimNode *bottom = simAddNode("bottom", BOTTOM_MAC, bottomUnit::setup, bottomUnit::loop);
+  for (int i = 0; i < lanes; i++) {
+    uint8_t mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x01, (uint8_t)(i + 1) };
+    if (i == 0) memcpy(mac, TOP_MAC, 6);
+    top[i] = simAddNode(laneUnits[i].name, mac, laneUnits[i].setup, laneUnits[i].loop);
+    simSetClock(top[i], 3217000 + i * 1511000, opt.driftPpm * (i % 2 == 0 ? 1 : -1));
+  }
+  simRun(12 * SECOND_US);
+
+  // Bottom unit's entry for each unit
+  const LanePeer *lanePeer[MAX_LANES];
+  for (int i = 0; i < lanes; i++) {
+    uint8_t lane = *laneUnits[i].laneId;
+    lanePeer[i] = peerTableLane(bottomUnit::peers, lane);
+    if (lanePeer[i] == NULL) {
+      printf("race: %s not paired\n", laneUnits[i].name);
+      return 1;
+    }
+  }
+
+  int failures = 0;
+  int64_t worstUs = 0;
+  for (int run = 1; run <= opt.runs; run++) {
+    int64_t t = simNow();
+    int64_t start = t + SECOND_US;
+    int64_t runUs[MAX_LANES];
+    bouncePin(bottom, BUTTON_PAD_PIN, LOW, t);
+    bouncePin(bottom, BUTTON_PAD_PIN, HIGH, start);
+    int64_t last = start;
+    for (int i = 0; i < lanes; i++) {
+      runUs[i] = 5 * SECOND_US + nextRandom() % (4 * SECOND_US);
+      bouncePin(top[i], BUTTON_PIN, LOW, start + runUs[i]);
+      bouncePin(top[i], BUTTON_PIN, HIGH, start + runUs[i] + 300000);
+      last = std::max(last, start + runUs[i]);
+    }
+    simRun(last + 500000);
+
+    bool ok = true;
+    printf("run %d:", run);
+    for (int i = 0; i < lanes; i++) {
+      bool recorded = laneUnits[i].stopped();
+      int64_t errorUs = *laneUnits[i].finalTimeUs - runUs[i];
+      const LanePeer &peer = *lanePeer[i];
+      int64_t raceErrorUs = peer.stopEdgeTime - bottomUnit::raceStartEdge - runUs[i];
+
+      // Bottom unit's placing must match the true order
+      bool placed = peer.finished;
+      for (int j = 0; j < lanes; j++) {
+        const LanePeer &other = *lanePeer[j];
+        if (placed && other.finished && (runUs[j] < runUs[i]) != (other.stopEdgeTime < peer.stopEdgeTime)) placed = false;
+      }
+      bool laneOk = recorded && placed && llabs(errorUs) <= toleranceUs && llabs(raceErrorUs) <= toleranceUs;
+      if (recorded && llabs(errorUs) > worstUs) worstUs = llabs(errorUs);
+      if (!laneOk) ok = false;
+      printf(" lane %d %.6f s (error %+lld us, race clock %+lld us)%s", peer.lane, runUs[i] / 1e6,
+             (long long)errorUs, (long long)raceErrorUs, laneOk ? "" : " FAIL");
+    }
+    printf("\n");
+    if (!ok) failures++;
+
+    // Reset every lane from the bottom unit
+    simSetPin(bottom, RESET_BUTTON_PIN, LOW, last + SECOND_US);
+    simSetPin(bottom, RESET_BUTTON_PIN, HIGH, last + SECOND_US + 100000);
+    simRun(last + 3 * SECOND_US);
+  }
+
+  printf("race: %d lanes, %d/%d runs ok, worst error %lld us (tolerance %lld us)\n",
+         lanes, opt.runs - failures, opt.runs, (long long)worstUs, (long long)toleranceUs);
+  return failures == 0 ? 0 : 1;
+}
+
+// Function to run until ready() holds, returns the true time or -1 after timeoutUs
+static int64_t runUntilReady(bool (*ready)(), int64_t timeoutUs) {
+  int64_t deadline = simNow() + timeoutUs;
+  while (!ready()) {
+    if (simNow() >= deadline) return -1;
+    simRun(simNow() + 100);
+  }
+  return simNow();
+}
+
+// A top unit is ready once it is connected and its bottom unit has heard from it
+#define PAIR_READY(bottomNs, topNs, topMac) \
+  [] { \
+    const LanePeer *peer = peerTableFind(bottomNs::peers, topMac); \
+    return topNs::isConnectedToBottom && peer != NULL && peer->heard; \
+  }
+
+// Function to report one boot case: the slowest powered-up unit's own
+// boot-to-ready time (bootReadyUs, against BOOT_TARGET_US), and the time from
+// power-on and from the radio coming up until connected
+// A negative budget is not checked
+static bool reportBoot(const char *name, int64_t bootUs, int64_t powerOn, SimNode *radioNode,
+                       int64_t ready, int64_t budgetUs) {
+  const int64_t BOOT_TARGET_US = 300000;
+  int64_t radioUp = simRadioUpTime(radioNode);
+  bool ok = bootUs > 0 && bootUs <= BOOT_TARGET_US && ready >= 0 && (budgetUs < 0 || ready - radioUp <= budgetUs);
+  printf("%-16s boot to ready %7.3f ms, ", name, bootUs / 1e3);
+  if (ready < 0) {
+    printf("not connected  FAIL\n");
+    return false;
+  }
+  printf("connected %8.3f ms after power-on, %8.3f ms after radio up", (ready - powerOn) / 1e3, (ready - radioUp) / 1e3);
+  if (budgetUs >= 0) printf(" (budget %.0f ms)", budgetUs / 1e3);
+  printf("%s\n", ok ? "" : "  FAIL");
+  return ok;
+}
+
+// Time to ready after power-on: units pairing by discovery on their first
+// boot, reconnecting from their saved peers after a power cycle, and a
+// replaced top or bottom unit being paired in. Each unit must be ready for a
+// start within 300 ms of power-on (simulated Wi-Fi start-up and Serial
+// output included, bootloader not). A unit that knows its peer
+// must be ready one round trip after its radio comes up; discovery may take
+// another try if the other unit's radio isn't up yet. With --loss the times
+// are reported but not checked.
+static int runBoot(const SimOptions &opt) {
+  const int64_t roundTripUs = 10000;
+  bool check = opt.radio.lossRatio == 0;
+  static const uint8_t newTopMac[6] = { 0x02, 0x00, 0x00, 0x00, 0x01, 0x09 };
+  static const uint8_t newBottomMac[6] = { 0x02, 0x00, 0x00, 0x00, 0x02, 0x01 };
+  int failures = 0;
+
+  // First boot, nothing saved
+  int64_t powerOn = simNow();
+  SimNode *bottom = simAddNode("bottom", BOTTOM_MAC, bottomUnit::setup, bottomUnit::loop);
+  SimNode *top = simAddNode("top", TOP_MAC, topUnit::setup, topUnit::loop);
+  simSetClock(top, 3217000, opt.driftPpm);
+  int64_t ready = runUntilReady(PAIR_READY(bottomUnit, topUnit, TOP_MAC), 10 * SECOND_US);
+  int64_t discoveryUs = topUnit::RECONNECT_INTERVAL_US + roundTripUs;
+  if (!reportBoot("first boot", std::max(bottomUnit::bootReadyUs, topUnit::bootReadyUs), powerOn, top, ready, check ? discoveryUs : -1)) failures++;
+  simRun(simNow() + 2 * SECOND_US); // Settings saved
+
+  // Top unit power cycled
+  simPowerOff(top);
+  simRun(simNow() + SECOND_US);
+  powerOn = simNow();
+  top = simAddNode("top", TOP_MAC, topLane2::setup, topLane2::loop);
+  ready = runUntilReady(PAIR_READY(bottomUnit, topLane2, TOP_MAC), 10 * SECOND_US);
+  if (!reportBoot("top restart", topLane2::bootReadyUs, powerOn, top, ready, check ? roundTripUs : -1)) failures++;
+  simRun(simNow() + 2 * SECOND_US);
+
+  // Both power cycled
+  simPowerOff(top);
+  simPowerOff(bottom);
+  simRun(simNow() + SECOND_US);
+  powerOn = simNow();
+  bottom = simAddNode("bottom", BOTTOM_MAC, bottomUnit2::setup, bottomUnit2::loop);
+  top = simAddNode("top", TOP_MAC, topLane3::setup, topLane3::loop);
+  ready = runUntilReady(PAIR_READY(bottomUnit2, topLane3, TOP_MAC), 10 * SECOND_US);
+  if (!reportBoot("both restart", std::max(bottomUnit2::bootReadyUs, topLane3::bootReadyUs), powerOn, top, ready, check ? roundTripUs : -1)) failures++;
+  simRun(simNow() + 2 * SECOND_US);
+
+  // Top unit replaced by another board, which gets the next lane
+  simPowerOff(top);
+  powerOn = simNow();
+  top = simAddNode("newtop", newTopMac, topLane4::setup, topLane4::loop);
+  ready = runUntilReady(PAIR_READY(bottomUnit2, topLane4, newTopMac), 10 * SECOND_US);
+  if (!reportBoot("new top unit", topLane4::bootReadyUs, powerOn, top, ready, check ? roundTripUs : -1)) failures++;
+  simRun(simNow() + 2 * SECOND_US);
+
+  // Bottom unit replaced; the top unit looks for it once the old one has been
+  // silent for its connection timeout
+  simPowerOff(bottom);
+  powerOn = simNow();
+  bottom = simAddNode("newbottom", newBottomMac, bottomUnit3::setup, bottomUnit3::loop);
+  ready = runUntilReady(PAIR_READY(bottomUnit3, topLane4, newTopMac), 10 * SECOND_US);
+  int64_t rediscoverUs = topLane4::CONNECTION_TIMEOUT_US + topLane4::PING_INTERVAL_US + roundTripUs;
+  if (!reportBoot("new bottom unit", bottomUnit3::bootReadyUs, powerOn, bottom, ready, check ? rediscoverUs : -1)) failures++;
+
+  printf("boot: %d/5 cases ok\n", 5 - failures);
+  return failures == 0 ? 0 : 1;
+}
+
+// A top unit that only looks for a start unit, for boards that need no more
+// than a lane: it broadcasts discovery until a pong tells it its lane
+static uint8_t discoveryLane = LANE_NONE;
+
+static void discoveryReceive(const uint8_t *, const uint8_t *data, int len, int) {
+  WireBatch batch;
+  if (wireDecode(data, len, batch) != WIRE_OK) return;
+  for (int i = 0; i < batch.count; i++) {
+    if (batch.events[i].messageType == 4 && batch.lane != LANE_NONE) discoveryLane = batch.lane;
+  }
+}
+
+static void discoverySetup() {
+  discoveryLane = LANE_NONE;
+  halRadioBegin(discoveryReceive, NULL);
+  halRadioAddPeer(BROADCAST_MAC);
+}
+
+static void discoveryLoop() {
+  if (discoveryLane == LANE_NONE) {
+    WireBatch batch;
+    wireBatchClear(batch);
+    wireBatchAdd(batch, 7, 0, 0, 0);
+    batch.lane = LANE_NONE;
+    batch.timestamp = halMicros();
+    batch.echoTime = 0;
+    batch.recvTime = 0;
+    uint8_t frame[WIRE_MAX_FRAME];
+    halRadioSend(BROADCAST_MAC, frame, wireEncode(batch, frame));
+  }
+  halDelay(100);
+}
+
+#define REPAIR_BOARDS 24  // More than SIM_RADIO_MAX_PEERS
+
+// Top units swapped in on the start unit, more boards in all than its ESP-NOW
+// peer list holds. The first MAX_LANES take the free lanes. The start unit
+// then reboots before each group of MAX_LANES, and each board takes the next
+// lane whose unit hasn't been heard from since. Every board must get its lane,
+// and the start unit's peer list must hold the broadcast address and the
+// lanes' units, not the units they replaced.
+static int runRepair(const SimOptions &) {
+  static void (*const setups[])() = { bottomUnit::setup, bottomUnit2::setup, bottomUnit3::setup,
+                                      bottomUnit4::setup, bottomUnit5::setup, bottomUnit6::setup };
+  static void (*const loops[])() = { bottomUnit::loop, bottomUnit2::loop, bottomUnit3::loop,
+                                     bottomUnit4::loop, bottomUnit5::loop, bottomUnit6::loop };
+  uint8_t laneMacs[MAX_LANES][6];
+  SimNode *bottom = NULL;
+  int failures = 0;
+  int mostPeers = 0;
+
+  for (int board = 0; board < REPAIR_BOARDS; board++) {
+    if (board % MAX_LANES == 0) {
+      if (bottom != NULL) simPowerOff(bottom);
+      bottom = simAddNode("bottom", BOTTOM_MAC, setups[board / MAX_LANES], loops[board / MAX_LANES]);
+      simRun(simNow() + SECOND_US);
+    }
+
+    uint8_t mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x03, (uint8_t)board };
+    SimNode *top = simAddNode("top", mac, discoverySetup, discoveryLoop);
+    runUntilReady([] { return discoveryLane != LANE_NONE; }, 2 * SECOND_US);
+    simRun(simNow() + 100000);  // Lanes saved
+    simPowerOff(top);
+
+    uint8_t lane = board % MAX_LANES + 1;
+    int peers = simRadioPeerCount(bottom);
+    int expectedPeers = 1 + std::min(board + 1, MAX_LANES);
+    bool replacedGone = board < MAX_LANES || !simRadioIsPeer(bottom, laneMacs[lane - 1]);
+    mostPeers = std::max(mostPeers, peers);
+    if (discoveryLane != lane || !simRadioIsPeer(bottom, mac) || peers != expectedPeers || !replacedGone) {
+      printf("board %2d: lane %d (expected %d), %d peers (expected %d)%s  FAIL\n", board + 1, discoveryLane,
+             lane, peers, expectedPeers, replacedGone ? "" : ", replaced unit still a peer");
+      failures++;
+    }
+    memcpy(laneMacs[lane - 1], mac, 6);
+  }
+
+  printf("repair: %d/%d boards ok, start unit held at most %d ESP-NOW peers\n",
+         REPAIR_BOARDS - failures, REPAIR_BOARDS, mostPeers);
+  return failures == 0 ? 0 : 1;
+}
+
+// Radio conditions the bench runs under
+typedef struct {
+  const char *name;
+  SimRadioProfile radio;
+} BenchProfile;
+
+static const BenchProfile benchProfiles[] = {
+  { "ideal",     { 1000, 0, 0.0, -50 } },
+  { "typical",   { 1500, 500, 0.0, -60 } },
+  { "lossy",     { 1500, 500, 0.2, -80 } },
+  { "congested", { 4000, 3000, 0.1, -70 } },
+};
+
+// Stages of the start path, each from one probe to the next (-1 = the pad release itself)
+typedef struct {
+  const char *name;
+  int from;
+  int to;
+} BenchStage;
+
+static const BenchStage benchStages[] = {
+  { "edge",     -1,                  PROBE_PAD_EDGE },
+  { "debounce", PROBE_PAD_EDGE,      PROBE_DEBOUNCED },
+  { "send",     PROBE_DEBOUNCED,     PROBE_RADIO_SEND },
+  { "radio",    PROBE_RADIO_SEND,    PROBE_RADIO_RECEIVE },
+  { "dispatch", PROBE_RADIO_RECEIVE, PROBE_STATE_UPDATE },
+  { "display",  PROBE_STATE_UPDATE,  PROBE_DISPLAY_PUSH },
+  { "total",    -1,                  PROBE_DISPLAY_PUSH },
+};
+
+#define BENCH_STAGES (sizeof(benchStages) / sizeof(benchStages[0]))
+
+// Function to print p50/p99/max of a set of samples as a JSON object
+static void printPercentiles(const char *name, std::vector<int64_t> &samples) {
+  std::sort(samples.begin(), samples.end());
+  int64_t p50 = 0, p99 = 0, max = 0;
+  if (!samples.empty()) {
+    size_t n = samples.size();
+    p50 = samples[(n * 50 + 99) / 100 - 1];  // Nearest rank
+    p99 = samples[(n * 99 + 99) / 100 - 1];
+    max = samples[n - 1];
+  }
+  printf("\"%s\":{\"p50\":%lld,\"p99\":%lld,\"max\":%lld}",
+         name, (long long)p50, (long long)p99, (long long)max);
+}
+
+// Start path latency per stage, final time error and the start signal's ack
+// latency (from the send to the first ack) under each radio profile, one JSON
+// line per profile (microseconds), with the bottom unit's retransmits per run
+// (start and reset signals)
+static int runBench(const SimOptions &opt) {
+  std::vector<BenchProfile> profiles;
+  if (opt.customRadio) {
+    BenchProfile custom = { "custom", opt.radio };
+    profiles.push_back(custom);
+  } else {
+    profiles.assign(benchProfiles, benchProfiles + sizeof(benchProfiles) / sizeof(benchProfiles[0]));
+  }
+
+  SimNode *bottom, *top;
+  simSetRadio(profiles[0].radio);
+  startPair(opt, &bottom, &top);
+
+  int missed = 0;
+  for (size_t p = 0; p < profiles.size(); p++) {
+    simSetRadio(profiles[p].radio);
+    std::vector<int64_t> stageSamples[BENCH_STAGES];
+    std::vector<int64_t> errorSamples;
+    std::vector<int64_t> ackSamples;
+    std::vector<int64_t> retransmitSamples;
+    int profileMissed = 0;
+
+    for (int run = 0; run < opt.runs; run++) {
+      int64_t release = simNow() + SECOND_US;
+      int64_t runUs = 2 * SECOND_US + nextRandom() % (2 * SECOND_US);
+      uint32_t retransmits = bottomUnit::peers.lanes[0].link.retransmits;
+      PairRun r = timePairRun(bottom, top, simNow(), runUs);
+      retransmitSamples.push_back(bottomUnit::peers.lanes[0].link.retransmits - retransmits);
+      if (simProbeTime(PROBE_START_ACKED) >= 0 && simProbeTime(PROBE_RADIO_SEND) >= 0) {
+        ackSamples.push_back(simProbeTime(PROBE_START_ACKED) - simProbeTime(PROBE_RADIO_SEND));
+      }
+
+      bool complete = r.recorded;
+      for (size_t i = 0; i < BENCH_STAGES; i++) {
+        if (simProbeTime(benchStages[i].to) < 0) complete = false;
+      }
+      if (!complete) {
+        profileMissed++;
+        continue;
+      }
+      for (size_t i = 0; i < BENCH_STAGES; i++) {
+        int64_t from = benchStages[i].from < 0 ? release : simProbeTime(benchStages[i].from);
+        stageSamples[i].push_back(simProbeTime(benchStages[i].to) - from);
+      }
+      errorSamples.push_back(llabs(r.errorUs));
+    }
+
+    printf("{\"profile\":\"%s\",\"latency_us\":%lld,\"jitter_us\":%lld,\"loss\":%.3f,"
+           "\"runs\":%d,\"missed\":%d,\"stages\":{",
+           profiles[p].name, (long long)profiles[p].radio.latencyUs,
+           (long long)profiles[p].radio.jitterUs, profiles[p].radio.lossRatio,
+           opt.runs, profileMissed);
+    for (size_t i = 0; i < BENCH_STAGES; i++) {
+      printPercentiles(benchStages[i].name, stageSamples[i]);
+      printf(",");
+    }
+    printPercentiles("error", errorSamples);
+    printf(",");
+    printPercentiles("ack", ackSamples);
+    printf("},");
+    printPercentiles("retransmits", retransmitSamples);
+    printf("}\n");
+    missed += profileMissed;
+  }
+  return missed == 0 ? 0 : 1;
+}
+
+// Function to draw a random 64-bit value
+static int64_t nextRandom64() {
+  return (int64_t)(((uint64_t)nextRandom() << 40) ^ ((uint64_t)nextRandom() << 16) ^ nextRandom());
+}
+
+// Function to compare a decoded batch with the one encoded
+static bool sameBatch(const WireBatch &a, const WireBatch &b) {
+  if (a.lane != b.lane || a.timestamp != b.timestamp || a.echoTime != b.echoTime ||
+      a.recvTime != b.recvTime || a.count != b.count) return false;
+  for (int i = 0; i < a.count; i++) {
+    const Message &x = a.events[i];
+    const Message &y = b.events[i];
+    if (x.messageType != y.messageType || x.sequence != y.sequence || x.edgeTime != y.edgeTime ||
+        x.laneMask != y.laneMask || y.timestamp != b.timestamp || y.lane != b.lane) return false;
+  }
+  return true;
+}
+
+// Wire format: random batches must decode to exactly what was encoded, and
+// truncated, extended and bit-flipped copies must be rejected, as must random
+// frames with a valid version and length (only the CRC can catch those)
+static int runWire(const SimOptions &opt) {
+  int frames = opt.runs * 1000;
+  int roundTripFailures = 0;
+  int accepted = 0;
+  int corrupted = 0;
+  for (int i = 0; i < frames; i++) {
+    WireBatch in;
+    wireBatchClear(in);
+    in.lane = nextRandom() % (MAX_LANES + 1);
+    in.timestamp = nextRandom64();
+    in.echoTime = nextRandom64();
+    in.recvTime = nextRandom64();
+    int count = nextRandom() % (WIRE_MAX_EVENTS + 1);
+    for (int e = 0; e < count; e++) {
+      wireBatchAdd(in, nextRandom() % 256, nextRandom() ^ (nextRandom() << 24), nextRandom64(), nextRandom() % 256);
+    }
+
+    uint8_t frame[WIRE_MAX_FRAME + 1];
+    size_t len = wireEncode(in, frame);
+    WireBatch out;
+    if (wireDecode(frame, len, out) != WIRE_OK || !sameBatch(in, out)) roundTripFailures++;
+
+    // Truncated and extended
+    corrupted += 2;
+    if (wireDecode(frame, nextRandom() % len, out) == WIRE_OK) accepted++;
+    frame[len] = nextRandom();
+    if (wireDecode(frame, len + 1, out) == WIRE_OK) accepted++;
+
+    // One to three bits flipped, always within CRC-32's detection distance
+    uint8_t flipped[WIRE_MAX_FRAME];
+    memcpy(flipped, frame, len);
+    int bits = 1 + nextRandom() % 3;
+    for (int b = 0; b < bits; b++) {
+      uint32_t bit = nextRandom() % (len * 8);
+      flipped[bit / 8] ^= 1 << (bit % 8);
+    }
+    corrupted++;
+    if (memcmp(flipped, frame, len) != 0 && wireDecode(flipped, len, out) == WIRE_OK) accepted++;
+
+    // Random contents behind a plausible header
+    uint8_t noise[WIRE_MAX_FRAME];
+    int noiseCount = nextRandom() % (WIRE_MAX_EVENTS + 1);
+    size_t noiseLen = WIRE_HEADER_SIZE + noiseCount * WIRE_EVENT_SIZE + WIRE_CRC_SIZE;
+    for (size_t b = 0; b < noiseLen; b++) noise[b] = nextRandom();
+    noise[0] = WIRE_VERSION;
+    noise[2] = noiseCount;
+    corrupted++;
+    if (wireDecode(noise, noiseLen, out) == WIRE_OK) accepted++;
+  }
+
+  printf("wire: %d frames, %d round trip failures, %d of %d malformed frames accepted\n",
+         frames, roundTripFailures, accepted, corrupted);
+  return roundTripFailures == 0 && accepted == 0 ? 0 : 1;
+}
+
+// A unit running no sketch, for driving a module directly (simActAs())
+static void idleSetup() {}
+static void idleLoop() {}
+
+// Function to commit a run to the history as the top unit's history task
+// does: append it, then erase the next sector if this one is full
+// Returns whether the record was written whole
+static bool commitRun(RunHistory &h, RunRecord &record) {
+  memset(&record, 0, sizeof(record));
+  record.finalTimeUs = 5 * SECOND_US + nextRandom() % (4 * SECOND_US);
+  record.startEdgeUs = nextRandom64() >> 8;
+  record.stopEdgeUs = record.startEdgeUs + record.finalTimeUs;
+  record.rttUs = 3000 + nextRandom() % 1000;
+  record.driftPpb = (int32_t)(nextRandom() % 40000) - 20000;
+  record.messages = nextRandom() % 100;
+  record.clockSynced = 1;
+  record.lane = 1;
+  record.startVerdict = RUN_NO_VERDICT;
+  bool written = historyAppend(h, record);
+  historyPrepare(h);
+  return written;
+}
+
+// Function to boot on the flash as it is and check the last runs read back:
+// the newest HISTORY_CHECK_RUNS of the complete ones, newest first, exactly
+// as they were written
+// Returns false if they don't, with h ready for further runs either way
+static bool historyRecovered(RunHistory &h, const std::vector<RunRecord> &complete) {
+  const int HISTORY_CHECK_RUNS = 100;  // More than a sector, fewer than the ring drops
+  RunRecord records[HISTORY_CHECK_RUNS];
+  h = RunHistory();
+  if (!historyBegin(h)) return false;
+  int expected = std::min((int)complete.size(), HISTORY_CHECK_RUNS);
+  if (historyReadRecent(h, records, HISTORY_CHECK_RUNS) != expected) return false;
+  for (int i = 0; i < expected; i++) {
+    if (memcmp(&records[i], &complete[complete.size() - 1 - i], sizeof(RunRecord)) != 0) return false;
+  }
+  return expected == 0 || h.nextSequence == complete.back().sequence + 1;
+}
+
+// Run history in flash against power loss. Runs are committed as the top
+// unit's history task does, and the power is cut partway through one
+// commit's flash work: at every byte of its record and of a new sector's
+// header, and at every slot boundary of a sector erase. The cuts fall on the
+// very first run, and on the first, a middle and the last slot of a sector,
+// both before the ring of sectors has wrapped and after. At the next boot
+// historyBegin() must find the end of the log and the last runs written
+// whole must read back exactly, so a torn record is never returned; three
+// more runs must then follow on with the next run numbers, and read back
+// after another boot.
+static int runHistory(const SimOptions &) {
+  SimNode *unit = simAddNode("top", TOP_MAC, idleSetup, idleLoop);
+  simActAs(unit);
+  const int RING_RUNS = HISTORY_SECTORS * HISTORY_SLOTS;
+
+  // Runs committed before the torn one, and its flash work in order:
+  // bytes, and the step the cuts go through them
+  typedef struct {
+    const char *what;
+    int before;
+    int64_t work[3][2];
+  } TornCommit;
+  const int64_t RECORD[2] = { HISTORY_RECORD_SIZE, 1 };
+  const int64_t ERASE[2] = { HAL_STORAGE_SECTOR, HISTORY_RECORD_SIZE };
+  const int64_t HEADER[2] = { sizeof(HistorySectorHeader), 1 };
+  const TornCommit commits[] = {
+    { "first run", 0, { { ERASE[0], ERASE[1] }, { HEADER[0], HEADER[1] }, { RECORD[0], RECORD[1] } } },
+    { "first slot", HISTORY_SLOTS, { { RECORD[0], RECORD[1] } } },
+    { "middle slot", HISTORY_SLOTS + HISTORY_SLOTS / 2, { { RECORD[0], RECORD[1] } } },
+    { "last slot", 2 * HISTORY_SLOTS - 1, { { RECORD[0], RECORD[1] }, { ERASE[0], ERASE[1] }, { HEADER[0], HEADER[1] } } },
+    { "first slot, wrapped", RING_RUNS + HISTORY_SLOTS, { { RECORD[0], RECORD[1] } } },
+    { "middle slot, wrapped", RING_RUNS + HISTORY_SLOTS + HISTORY_SLOTS / 2, { { RECORD[0], RECORD[1] } } },
+    { "last slot, wrapped", RING_RUNS + 2 * HISTORY_SLOTS - 1,
+      { { RECORD[0], RECORD[1] }, { ERASE[0], ERASE[1] }, { HEADER[0], HEADER[1] } } },
+  };
+
+  int totalCuts = 0;
+  int totalFailures = 0;
+  for (size_t c = 0; c < sizeof(commits) / sizeof(commits[0]); c++) {
+    const TornCommit &commit = commits[c];
+    std::vector<int64_t> cuts;
+    int64_t at = 0;
+    for (int w = 0; w < 3 && commit.work[w][0] > 0; w++) {
+      for (int64_t b = 0; b < commit.work[w][0]; b += commit.work[w][1]) cuts.push_back(at + b);
+      at += commit.work[w][0];
+    }
+    cuts.push_back(at);  // The commit finishes just before the cut
+
+    int failures = 0;
+    int torn = 0;
+    for (size_t i = 0; i < cuts.size(); i++) {
+      simStorageCut(unit, -1);
+      halStorageErase(0, halStorageSize());
+      RunHistory h;
+      historyBegin(h);
+      std::vector<RunRecord> complete;
+      RunRecord record;
+      for (int run = 0; run < commit.before; run++) {
+        commitRun(h, record);
+        complete.push_back(record);
+      }
+
+      // Power lost partway through the commit, and back
+      simStorageCut(unit, cuts[i]);
+      if (commitRun(h, record)) complete.push_back(record);
+      else torn++;
+      simStorageCut(unit, -1);
+      bool ok = historyRecovered(h, complete);
+
+      for (int run = 0; ok && run < 3; run++) {
+        if (!commitRun(h, record)) ok = false;
+        complete.push_back(record);
+      }
+      ok = ok && historyRecovered(h, complete);
+      if (!ok) {
+        failures++;
+        printf("  %s: cut after %lld bytes not recovered\n", commit.what, (long long)cuts[i]);
+      }
+    }
+    printf("%s: %d cuts through %lld bytes, %d records torn, %d not recovered%s\n", commit.what, (int)cuts.size(),
+           (long long)at, torn, failures, failures == 0 ? "" : "  FAIL");
+    totalCuts += cuts.size();
+    totalFailures += failures;
+  }
+  simActAs(NULL);
+
+  printf("history: %d power cuts, %d not recovered\n", totalCuts, totalFailures);
+  return totalFailures == 0 ? 0 : 1;
+}
+
+// Radio conditions the clock synchronisation runs under: symmetric, with the
+// down link slower than the up link, and with heavy jitter and loss
+static const BenchProfile syncProfiles[] = {
+  { "symmetric",          { 1500, 500, 0.0, -60 } },
+  { "asymmetric",         { 1500, 500, 0.0, -60, 4500 } },
+  { "jittery",            { 1500, 5000, 0.1, -70 } },
+  { "asymmetric jittery", { 1000, 3000, 0.1, -70, 4000 } },
+};
+
+// Clock synchronisation (clock-sync.h) on the pair under each radio profile,
+// at the --drift of the top unit's clock and at drifts near and beyond the
+// 200 ppm crystal bound, changed without a step in the clock. Each drift runs
+// long enough to refill the window, then the top unit's estimate is sampled
+// every second.
+//
+// The drift must be within SYNC_DRIFT_PPM of the truth, and beyond the bound
+// at CLOCK_SYNC_MAX_DRIFT. The offset error must stay within half the link's
+// asymmetry, which no round trip can see, plus SYNC_OFFSET_US. Beyond the
+// bound, the drift the clamp leaves out is also carried from the newest sample.
+static int runSync(const SimOptions &opt) {
+  const int64_t SETTLE_US = 800 * SECOND_US;  // A full window at the idle ping rate, lost frames included
+  const int SAMPLES = 30;
+  const int64_t SYNC_OFFSET_US = 500;
+  const double SYNC_DRIFT_PPM = 3;
+  std::vector<BenchProfile> profiles;
+  if (opt.customRadio) {
+    BenchProfile custom = { "custom", opt.radio };
+    profiles.push_back(custom);
+  } else {
+    profiles.assign(syncProfiles, syncProfiles + sizeof(syncProfiles) / sizeof(syncProfiles[0]));
+  }
+  const double drifts[] = { opt.driftPpm, 150, -150, 350, -350 };
+
+  SimNode *bottom, *top;
+  simSetRadio(profiles[0].radio);
+  startPair(opt, &bottom, &top);
+
+  int failures = 0;
+  for (size_t p = 0; p < profiles.size(); p++) {
+    const SimRadioProfile &radio = profiles[p].radio;
+    simSetRadio(radio);
+    int64_t roundTripUs = radioRoundTripUs(radio);
+    int64_t asymmetryUs = llabs(roundTripUs - 2 * radio.latencyUs);
+    for (size_t d = 0; d < sizeof(drifts) / sizeof(drifts[0]); d++) {
+      simSetDrift(top, drifts[d]);
+      simRun(simNow() + SETTLE_US);
+
+      // The bottom unit's clock is true time, so its rate against the top unit's is 1 / (1 + drift)
+      double trueDrift = 1 / (1 + drifts[d] * 1e-6) - 1;
+      bool clamped = fabs(trueDrift) > CLOCK_SYNC_MAX_DRIFT;
+      double expected = clamped ? (trueDrift > 0 ? CLOCK_SYNC_MAX_DRIFT : -CLOCK_SYNC_MAX_DRIFT) : trueDrift;
+      double unseenDrift = fabs(trueDrift - expected);
+      int64_t worstExcessUs = INT64_MIN;
+      int64_t worstOffsetUs = 0;
+      double worstDriftPpm = 0;
+      bool outOfBound = false;
+      for (int i = 0; i < SAMPLES; i++) {
+        simRun(simNow() + SECOND_US);
+        const ClockSync &cs = topUnit::clockSync;
+        int64_t topTime = simLocalTime(top);
+        int64_t errorUs = clockSyncOffsetAt(cs, topTime) - (simLocalTime(bottom) - topTime);
+        int64_t boundUs = asymmetryUs / 2 + SYNC_OFFSET_US + (int64_t)(unseenDrift * (topTime - cs.refTime));
+        double errorPpm = (cs.drift - expected) * 1e6;
+        if (!cs.valid || !cs.driftValid) errorUs = INT64_MAX / 2, errorPpm = 1e6;
+        if (fabs(cs.drift) > CLOCK_SYNC_MAX_DRIFT || fabs(errorPpm) > SYNC_DRIFT_PPM) outOfBound = true;
+        if (llabs(errorUs) - boundUs > worstExcessUs) worstExcessUs = llabs(errorUs) - boundUs;
+        if (llabs(errorUs) > llabs(worstOffsetUs)) worstOffsetUs = errorUs;
+        if (fabs(errorPpm) > fabs(worstDriftPpm)) worstDriftPpm = errorPpm;
+      }
+      bool ok = worstExcessUs <= 0 && !outOfBound;
+      if (!ok) failures++;
+      printf("%s, drift %+.0f ppm: offset error up to %+lld us (%lld us inside the bound), "
+             "drift %s %+.3f ppm (allowed %.0f)%s\n",
+             profiles[p].name, drifts[d], (long long)worstOffsetUs, (long long)-worstExcessUs,
+             clamped ? "off the clamp by" : "error up to", worstDriftPpm, SYNC_DRIFT_PPM, ok ? "" : "  FAIL");
+    }
+  }
+
+  printf("sync: %s\n", failures == 0 ? "ok" : "FAIL");
+  return failures == 0 ? 0 : 1;
+}
+
+// Function to replay a captured edge trace through the pad filter and print
+// its bounce statistics; the trace is "edge <us> <level>" lines, as a unit
+// prints them for the e command (other lines are skipped)
+static int replayBounceTrace(const SimOptions &opt) {
+  FILE *in = fopen(opt.trace, "r");
+  if (in == NULL) {
+    fprintf(stderr, "cannot open %s\n", opt.trace);
+    return 2;
+  }
+
+  static PadFilter pad;
+  int events[4] = { 0, 0, 0, 0 };
+  int edges = 0;
+  int lastLevel = HIGH;
+  int64_t lastUs = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), in) != NULL) {
+    const char *edge = strstr(line, "edge ");
+    long long timeUs;
+    int level;
+    if (edge == NULL || sscanf(edge, "edge %lld %d", &timeUs, &level) != 2) continue;
+    if (edges++ == 0) {
+      padFilterReset(pad, !level);
+      if (opt.settleUs > 0) pad.settleUs = opt.settleUs;
+    }
+    // Decide whatever settled before this edge, then queue it; captured
+    // times already have the filter delay taken off
+    events[padFilterUpdate(pad, timeUs, lastLevel)]++;
+    padFilterEdge(pad, timeUs + PAD_GLITCH_NS / 1000, level);
+    lastLevel = level;
+    lastUs = timeUs;
+  }
+  fclose(in);
+  if (edges == 0) {
+    fprintf(stderr, "no edges in %s\n", opt.trace);
+    return 2;
+  }
+  events[padFilterUpdate(pad, lastUs + pad.settleUs, lastLevel)]++;
+
+  printf("bounce: %d edges replayed, %d presses, %d releases, %d glitches\n",
+         edges, events[PAD_PRESSED], events[PAD_RELEASED], events[PAD_GLITCH]);
+  simSetVerbose(true);
+  padFilterPrintStats(pad, "Trace");
+  return 0;
+}
+
+// Start pad conditioning on a lone bottom unit: presses and releases that
+// chatter must be decided at their first edge within a tick of the settle
+// time, pulses that get through the pulse counter filter but return to the
+// old level must count as glitches, and spikes shorter than the filter must
+// never reach the sketch
+static int bounceLevel = HIGH;  // Level the pad is going to, for runUntilReady()
+
+static int runBounce(const SimOptions &opt) {
+  if (opt.trace != NULL) return replayBounceTrace(opt);
+
+  SimNode *bottom = simAddNode("bottom", BOTTOM_MAC, bottomUnit::setup, bottomUnit::loop);
+  simRun(SECOND_US);
+  PadFilter &pad = bottomUnit::startPad;
+  if (opt.settleUs > 0) pad.settleUs = opt.settleUs;
+
+  int transitions = opt.runs * 20;
+  int failures = 0, glitches = 0;
+  uint32_t edges = 0;
+  int64_t worstDecideUs = 0;
+  int level = HIGH;
+  int64_t t = simNow() + 100000;
+  for (int i = 0; i < transitions; i++) {
+    // A spike the filter drops, and now and then a glitch long enough to pass it
+    simSetPin(bottom, BUTTON_PAD_PIN, !level, t);
+    simSetPin(bottom, BUTTON_PAD_PIN, level, t + 2 + nextRandom() % 8);
+    t += 5000;
+    if (nextRandom() % 4 == 0) {
+      simSetPin(bottom, BUTTON_PAD_PIN, !level, t);
+      simSetPin(bottom, BUTTON_PAD_PIN, level, t + 50 + nextRandom() % 250);
+      glitches++;
+      t += 20000;
+    }
+
+    // The press or release: its first edge, then bounces dying out within 2.2 ms
+    level = !level;
+    int64_t expectedUs = simLocalTime(bottom) + (t - simNow());  // The unit's clock doesn't drift
+    simSetPin(bottom, BUTTON_PAD_PIN, level, t);
+    int64_t lastEdge = t;
+    int bounces = nextRandom() % 6;
+    for (int b = 0; b < bounces; b++) {
+      lastEdge += 20 + nextRandom() % 250;
+      simSetPin(bottom, BUTTON_PAD_PIN, !level, lastEdge);
+      lastEdge += 20 + nextRandom() % 150;
+      simSetPin(bottom, BUTTON_PAD_PIN, level, lastEdge);
+    }
+    edges += 1 + 2 * bounces;
+
+    simRun(lastEdge);
+    bounceLevel = level;
+    int64_t decided = runUntilReady([] { return bottomUnit::startPad.level == bounceLevel; }, 20000);
+    int64_t decideUs = decided - lastEdge;
+    bool ok = decided >= 0 && decideUs <= (int64_t)pad.settleUs + 1100 && pad.eventTime == expectedUs;
+    if (decided >= 0 && decideUs > worstDecideUs) worstDecideUs = decideUs;
+    if (!ok) {
+      failures++;
+      printf("transition %d: %s with %d bounces, decided %lld us after the last edge, edge error %lld us  FAIL\n",
+             i + 1, level == LOW ? "press" : "release", bounces, (long long)decideUs,
+             (long long)(pad.eventTime - expectedUs));
+    }
+    t = simNow() + 50000 + nextRandom() % 200000;
+  }
+  simRun(t);
+
+  uint32_t counted = pad.stats[0].edges + pad.stats[1].edges;
+  bool statsOk = (int)pad.glitches == glitches && counted == edges && pad.edges.overflows.load() == 0;
+  printf("bounce: %d/%d transitions ok, decided at most %lld us after the last edge (settle %u us), "
+         "%u/%d glitches, %u/%u edges counted%s\n",
+         transitions - failures, transitions, (long long)worstDecideUs, pad.settleUs,
+         pad.glitches, glitches, counted, edges, statsOk ? "" : "  FAIL");
+  return failures == 0 && statsOk ? 0 : 1;
+}
+
+// Start sequence on the pair: the climber leaves the start pad at a set time
+// from the cue - after the false start threshold, inside it, before the cue,
+// or before the first beep. The top unit must get the reaction time and
+// verdict with the start and time the run from the cue, or from the release
+// if it came first; the cue must not sound after an early release, and
+// leaving before the first beep must not start a run.
+static int runReaction(const SimOptions &opt) {
+  const int64_t toleranceUs = 1000;
+  SimNode *bottom, *top;
+  startPair(opt, &bottom, &top);
+  StartSequence &seq = bottomUnit::startSequence;
+  seq.enabled = true;
+
+  static const char *const kinds[] = { "clean", "clean", "before cue", "inside threshold", "before beeps" };
+  int failures = 0, falseStarts = 0;
+  for (int run = 1; run <= opt.runs; run++) {
+    int kind = run % 5;
+    int64_t reactionUs;
+    if (kind == 2) reactionUs = -(int64_t)(20000 + nextRandom() % 1500000);
+    else if (kind == 3) reactionUs = nextRandom() % seq.falseStartUs;
+    else if (kind == 4) reactionUs = -(startCueSteps[START_CUE_STEP].atUs - startCueSteps[0].atUs) - 500000;
+    else reactionUs = seq.falseStartUs + nextRandom() % 300000;
+    bool started = kind != 4;
+    bool falseStart = reactionUs < (int64_t)seq.falseStartUs;
+
+    // Step on the pad; the cue is due a fixed time after the press edge
+    int64_t t = simNow();
+    bouncePin(bottom, BUTTON_PAD_PIN, LOW, t);
+    simRun(t + 100000);
+    int64_t toTrue = simNow() - simLocalTime(bottom);  // The bottom unit's clock doesn't drift
+    int64_t cue = seq.armedAt + startCueSteps[START_CUE_STEP].atUs + toTrue;
+    int64_t release = cue + reactionUs;
+    int64_t startEdge = reactionUs >= 0 ? cue : release;
+    int64_t runUs = 5 * SECOND_US + nextRandom() % (4 * SECOND_US);
+    int64_t stop = startEdge + runUs;
+
+    bouncePin(bottom, BUTTON_PAD_PIN, HIGH, release);
+    simRun(cue + 1000);
+    bool cueSounded = simLedValue(bottom, CUE_PIN) == HIGH;
+    if (started) {
+      bouncePin(top, BUTTON_PIN, LOW, stop);
+      bouncePin(top, BUTTON_PIN, HIGH, stop + 300000);
+    }
+    simRun(std::max(stop, cue) + 200000);
+
+    bool ok;
+    int64_t errorUs = 0;
+    if (started) {
+      errorUs = topUnit::finalTimeUs - runUs;
+      ok = topUnit::stopwatchState == topUnit::DISPLAYING && llabs(errorUs) <= toleranceUs &&
+           topUnit::raceHasVerdict && topUnit::raceFalseStart == falseStart &&
+           topUnit::raceReactionUs == reactionUs && bottomUnit::raceStartEdge == startEdge - toTrue &&
+           cueSounded == (reactionUs >= 0);
+      if (topUnit::raceFalseStart) falseStarts++;
+      printf("run %d: %s, reaction %+.6f s, top got %+.6f s%s, run error %+lld us, cue %s%s\n",
+             run, kinds[kind], reactionUs / 1e6, topUnit::raceReactionUs / 1e6,
+             topUnit::raceFalseStart ? " FALSE START" : "", (long long)errorUs,
+             cueSounded ? "sounded" : "silent", ok ? "" : "  FAIL");
+    } else {
+      ok = topUnit::stopwatchState == topUnit::WAITING && !cueSounded && !seq.armed;
+      printf("run %d: %s, no start, cue %s%s\n", run, kinds[kind], cueSounded ? "sounded" : "silent",
+             ok ? "" : "  FAIL");
+    }
+    if (!ok) failures++;
+
+    // Reset from the bottom unit
+    int64_t end = simNow();
+    simSetPin(bottom, RESET_BUTTON_PIN, LOW, end + SECOND_US);
+    simSetPin(bottom, RESET_BUTTON_PIN, HIGH, end + SECOND_US + 100000);
+    simRun(end + 3 * SECOND_US);
+  }
+
+  printf("reaction: %d/%d runs ok, %d false starts, start unit counted %u starts and %u false\n",
+         opt.runs - failures, opt.runs, falseStarts, seq.starts, seq.falseStarts);
+  return failures == 0 ? 0 : 1;
+}
+
+// Function to check that both units of the pair count each other as
+// connected, every second until the given true time
+static bool stayConnected(SimNode *bottom, int64_t untilUs) {
+  bool connected = true;
+  while (simNow() < untilUs) {
+    simRun(std::min(simNow() + SECOND_US, untilUs));
+    uint8_t lanes = peerTableConnected(bottomUnit::peers, simLocalTime(bottom), bottomUnit::CONNECTION_TIMEOUT_US);
+    if (!topUnit::isConnectedToBottom || lanes == 0) connected = false;
+  }
+  return connected;
+}
+
+// Function to check a measured loss ratio against the expected one, within
+// three standard deviations for the number of samples
+static bool lossClose(double measured, double expected, uint32_t samples) {
+  if (samples == 0) return false;
+  return fabs(measured - expected) <= 3 * sqrt(expected * (1 - expected) / samples) + 0.01;
+}
+
+// Link statistics and adaptive pings on the pair. Idle, the top unit must
+// back off to PING_BACKOFF_INTERVAL_US; a climber on the start pad must bring
+// the pings to PING_ACTIVE_INTERVAL_US until the run is over, and the units
+// must stay connected throughout. With loss, lost pings make the top unit
+// reconnect quickly now and then, so only the connection is checked, and
+// only up to 20% loss: beyond, three round trips lost in a row are common. The statistics must match the radio model:
+// round trips between twice the latency and twice the latency plus jitter,
+// RSSI within the model's spread, ping loss near the model's loss (both ways
+// for the top unit, one way for the bottom unit), and no retransmits without loss.
+static int runLink(const SimOptions &opt) {
+  SimNode *bottom, *top;
+  startPair(opt, &bottom, &top);
+  int failures = 0;
+
+  // A long idle spell: regular pings, then backing off
+  int64_t idleEnd = simNow() + topUnit::IDLE_BACKOFF_US + 40 * SECOND_US;
+  bool connected = stayConnected(bottom, idleEnd - 40 * SECOND_US);
+  uint32_t pings = topUnit::pingSequence;
+  connected = stayConnected(bottom, idleEnd) && connected;
+  int64_t idlePings = topUnit::pingSequence - pings;
+  int64_t expectedIdle = 40 * SECOND_US / topUnit::PING_BACKOFF_INTERVAL_US;
+  bool lossless = opt.radio.lossRatio == 0;
+  bool holdsLink = opt.radio.lossRatio <= 0.2;
+  bool ok = (connected || !holdsLink) && (!lossless || llabs(idlePings - expectedIdle) <= 1);
+  if (!ok) failures++;
+  printf("idle: %lld pings in 40 s (expected %lld)%s%s\n", (long long)idlePings, (long long)expectedIdle,
+         connected ? "" : ", connection lost", ok ? "" : "  FAIL");
+
+  for (int run = 1; run <= opt.runs; run++) {
+    // Climber on the pad for a second, then the run; pings quick throughout
+    int64_t t = simNow();
+    int64_t runUs = 5 * SECOND_US + nextRandom() % (4 * SECOND_US);
+    int64_t stop = t + SECOND_US + runUs;
+    bouncePin(bottom, BUTTON_PAD_PIN, LOW, t);
+    simRun(t + 100000);
+    pings = topUnit::pingSequence;
+    bouncePin(bottom, BUTTON_PAD_PIN, HIGH, t + SECOND_US);
+    bouncePin(top, BUTTON_PIN, LOW, stop);
+    bouncePin(top, BUTTON_PIN, HIGH, stop + 300000);
+    simRun(stop);
+    int64_t activePings = topUnit::pingSequence - pings;
+    int64_t expectedActive = (stop - t - 100000) / topUnit::PING_ACTIVE_INTERVAL_US;
+
+    // After the run, back to regular pings
+    simRun(stop + 2 * SECOND_US);
+    simSetPin(bottom, RESET_BUTTON_PIN, LOW, simNow());
+    simSetPin(bottom, RESET_BUTTON_PIN, HIGH, simNow() + 100000);
+    simRun(simNow() + SECOND_US);
+    pings = topUnit::pingSequence;
+    connected = stayConnected(bottom, simNow() + 20 * SECOND_US);
+    int64_t afterPings = topUnit::pingSequence - pings;
+    int64_t expectedAfter = 20 * SECOND_US / topUnit::PING_INTERVAL_US;
+
+    bool recorded = topUnit::stopwatchState == topUnit::DISPLAYING || topUnit::stopwatchState == topUnit::WAITING;
+    ok = recorded && (connected || !holdsLink) &&
+         (!lossless || (llabs(activePings - expectedActive) <= 2 && llabs(afterPings - expectedAfter) <= 1));
+    if (!ok) failures++;
+    printf("run %d: %lld pings in %.1f s on the pad and climbing (expected %lld), %lld in 20 s after (expected %lld)%s%s\n",
+           run, (long long)activePings, (stop - t - 100000) / 1e6, (long long)expectedActive,
+           (long long)afterPings, (long long)expectedAfter, connected ? "" : ", connection lost", ok ? "" : "  FAIL");
+  }
+
+  // Statistics against the radio model
+  const SimRadioProfile &radio = opt.radio;
+  double p = radio.lossRatio;
+  const LinkStats &topLink = topUnit::link;
+  const LinkStats &bottomLink = bottomUnit::peers.lanes[0].link;
+  for (int unit = 0; unit < 2; unit++) {
+    const LinkStats &ls = unit == 0 ? topLink : bottomLink;
+    const char *name = unit == 0 ? "top" : "bottom";
+    int64_t rttAvg = ls.rttSamples > 0 ? ls.rttTotalUs / ls.rttSamples : 0;
+    int64_t roundTripUs = radioRoundTripUs(radio);
+    bool rttOk = ls.rttSamples > 0 && ls.rttMinUs >= roundTripUs - 100 &&
+                 ls.rttMaxUs <= roundTripUs + 2 * radio.jitterUs + 100 &&
+                 llabs(rttAvg - (roundTripUs + radio.jitterUs)) <= radio.jitterUs / 2 + 100;
+    bool rssiOk = ls.frames > 0 && ls.rssiMin >= radio.rssiDbm - SIM_RSSI_SPREAD &&
+                  ls.rssiMax <= radio.rssiDbm + SIM_RSSI_SPREAD &&
+                  llabs(ls.rssiTotal / ls.frames - radio.rssiDbm) <= 1;
+    double loss = unit == 0 ? linkStatsPingLoss(ls) : linkStatsPingMissed(ls);
+    double expectedLoss = unit == 0 ? 1 - (1 - p) * (1 - p) : p;
+    uint32_t samples = unit == 0 ? ls.pingsAnswered + ls.pingsLost : ls.pingsSeen + ls.pingsMissed;
+    bool lossOk = p == 0 ? loss == 0 && samples > 0 : lossClose(loss, expectedLoss, samples);
+    bool retransmitsOk = p > 0 || (ls.retransmits == 0 && ls.sendFailures == 0);
+    ok = rttOk && rssiOk && lossOk && retransmitsOk;
+    if (!ok) failures++;
+    printf("%s link: %u frames, RSSI avg %lld min %d max %d dBm, round trip avg %lld min %lld max %lld us "
+           "over %u samples, %s loss %.1f%% of %u (expected %.1f%%), %u retransmits, %u failed deliveries%s\n",
+           name, ls.frames, ls.frames > 0 ? ls.rssiTotal / ls.frames : 0LL, ls.rssiMin, ls.rssiMax,
+           (long long)rttAvg, (long long)ls.rttMinUs, (long long)ls.rttMaxUs, ls.rttSamples,
+           unit == 0 ? "round trip" : "ping", 100 * loss, samples, 100 * expectedLoss,
+           ls.retransmits, ls.sendFailures, ok ? "" : "  FAIL");
+  }
+
+  printf("link: %s\n", failures == 0 ? "ok" : "FAIL");
+  return failures == 0 ? 0 : 1;
+}
+
+// Function to estimate a unit's average current from the true time it slept
+// over a period, at the figures in low-power.h (milliamps)
+static double simCurrentMa(int64_t asleepUs, int64_t periodUs) {
+  double asleep = (double)asleepUs / periodUs;
+  return (asleep * LOW_POWER_SLEEP_UA + (1 - asleep) * LOW_POWER_AWAKE_UA) / 1000.0;
+}
+
+// Function to idle the pair in low power mode for a period and check that
+// the start unit slept and answered every ping; awake per ping it may use
+// the wake guard, a round trip and a few ticks. With loss the pair drops now
+// and then, and the start unit only hears the top unit reconnecting at its
+// next ping slot or scan, so the pair must be connected again within a scan
+// interval, up to 20% loss as in runLink.
+static bool idleAsleep(const SimOptions &opt, SimNode *bottom, const char *what, int64_t periodUs) {
+  uint32_t pings = topUnit::pingSequence;
+  uint32_t answered = topUnit::link.pingsAnswered;
+  int64_t slept = simSleepTime(bottom);
+  bool connected = stayConnected(bottom, simNow() + periodUs);
+  pings = topUnit::pingSequence - pings;
+  answered = topUnit::link.pingsAnswered - answered;
+  slept = simSleepTime(bottom) - slept;
+  bool recovered = connected;
+  int64_t recoverBy = simNow() + SLEEP_SCAN_INTERVAL_US + SECOND_US;
+  while (!recovered && simNow() < recoverBy) {
+    simRun(simNow() + 100000);
+    recovered = topUnit::isConnectedToBottom &&
+                peerTableConnected(bottomUnit::peers, simLocalTime(bottom), bottomUnit::CONNECTION_TIMEOUT_US) != 0;
+  }
+
+  int64_t awakePerPing = pings > 0 ? (periodUs - slept) / pings : periodUs;
+  int64_t awakeBound = SLEEP_PING_GUARD_US + radioRoundTripUs(opt.radio) + 2 * opt.radio.jitterUs + 3000;
+  bool lossless = opt.radio.lossRatio == 0;
+  bool ok = lossless ? connected && pings > 0 && answered + 1 >= pings && awakePerPing <= awakeBound
+                     : recovered || opt.radio.lossRatio > 0.2;
+  printf("%s: %u pings in %.0f s, %u answered, asleep %.2f%%, awake %.1f ms per ping, %.2f mA%s%s\n",
+         what, pings, periodUs / 1e6, answered, 100.0 * slept / periodUs, awakePerPing / 1000.0,
+         simCurrentMa(slept, periodUs), connected ? "" : recovered ? ", dropped and reconnected" : ", connection lost",
+         ok ? "" : "  FAIL");
+  return ok;
+}
+
+// Low power mode on the start unit. Idle, it must sleep between the top
+// unit's pings and still answer them, at the regular and the backed off
+// ping rate. A pad press must wake it and be stamped within stampToleranceUs
+// of the true edge, at the simulator's wake latency (--wake-latency) rather
+// than the one the sketch assumes, and the run must be timed as usual. The
+// reset button must wake it and reset the top unit without a pad press being
+// stamped, and so must a tap on it released before the unit is up. The
+// unit's own count of the time asleep must match the simulator's.
+static int runSleep(const SimOptions &opt) {
+  const int64_t toleranceUs = 1000;
+  const int64_t stampToleranceUs = 200;  // Wake press stamp against the true edge
+  SimNode *bottom, *top;
+  startPair(opt, &bottom, &top);
+  bottomUnit::lowPower.enabled = true;
+  lowPowerReset(bottomUnit::lowPower, simLocalTime(bottom));
+  int64_t since = simNow();
+  int64_t sleptSince = simSleepTime(bottom);
+  int failures = 0;
+
+  // Regular pings, then backed off once the top unit has been idle a minute
+  simRun(simNow() + 2 * SECOND_US);
+  if (!idleAsleep(opt, bottom, "idle", 30 * SECOND_US)) failures++;
+  simRun(simNow() + topUnit::IDLE_BACKOFF_US);
+  if (!idleAsleep(opt, bottom, "idle backed off", 60 * SECOND_US)) failures++;
+
+  std::vector<int64_t> latencies;
+  int64_t worstStampUs = 0;
+  for (int run = 1; run <= opt.runs; run++) {
+    // The climber steps on the pad of the sleeping unit, unless it is up for a ping
+    int64_t t = simNow();
+    bool asleep = simSleepingSince(bottom) >= 0;
+    int64_t toTrue = t - simLocalTime(bottom);  // The bottom unit's clock doesn't drift
+    bouncePin(bottom, BUTTON_PAD_PIN, LOW, t);
+    simRun(t + 100000);
+    int64_t edge, woke;
+    simLastPinWake(bottom, &edge, &woke);
+    bool wokeByPad = !asleep || (edge == t && woke > t);
+    int64_t latencyUs = asleep ? woke - edge : 0;
+    int64_t stampUs = bottomUnit::startPad.eventTime + toTrue - t;
+    bool pressed = bottomUnit::startPad.level == LOW;
+    if (asleep && wokeByPad) latencies.push_back(latencyUs);
+    if (llabs(stampUs) > worstStampUs) worstStampUs = llabs(stampUs);
+
+    // and leaves it a second later, the run is timed awake
+    int64_t start = t + SECOND_US;
+    int64_t runUs = 5 * SECOND_US + nextRandom() % (4 * SECOND_US);
+    int64_t stop = start + runUs;
+    bouncePin(bottom, BUTTON_PAD_PIN, HIGH, start);
+    bouncePin(top, BUTTON_PIN, LOW, stop);
+    bouncePin(top, BUTTON_PIN, HIGH, stop + 300000);
+    simRun(stop + 200000);
+    int64_t errorUs = topUnit::finalTimeUs - runUs;
+    bool recorded = topUnit::stopwatchState == topUnit::DISPLAYING && llabs(errorUs) <= toleranceUs;
+
+    // Asleep again, the reset button wakes the unit and resets the top unit
+    simRun(stop + 10 * SECOND_US);
+    bool sleptAfter = simLedValue(bottom, LED_RED_PIN) == 0 && bottomUnit::currentLEDState == bottomUnit::LED_OFF;
+    int64_t reset = simNow();
+    asleep = simSleepingSince(bottom) >= 0;
+    uint32_t padWakes = bottomUnit::lowPower.padWakes;
+    uint32_t padEdges = bottomUnit::startPad.captured;
+    simSetPin(bottom, RESET_BUTTON_PIN, LOW, reset);
+    simSetPin(bottom, RESET_BUTTON_PIN, HIGH, reset + 100000);
+    simRun(reset + SECOND_US);
+    simLastPinWake(bottom, &edge, &woke);
+    bool wokeByReset = (!asleep || edge == reset) && topUnit::stopwatchState == topUnit::WAITING;
+    bool noPadPress = bottomUnit::lowPower.padWakes == padWakes && bottomUnit::startPad.captured == padEdges;
+    simRun(simNow() + 10 * SECOND_US);
+
+    bool ok = wokeByPad && pressed && llabs(stampUs) <= stampToleranceUs && recorded && sleptAfter && wokeByReset &&
+              noPadPress;
+    if (!ok) failures++;
+    printf("run %d: %s %lld us after the press, stamped %+lld us off, run error %+lld us%s%s%s%s\n",
+           run, asleep ? "woke" : "awake, no wake", (long long)latencyUs, (long long)stampUs, (long long)errorUs,
+           sleptAfter ? "" : ", still awake after the run", wokeByReset ? "" : ", reset didn't wake it",
+           noPadPress ? "" : ", reset stamped a pad press", ok ? "" : "  FAIL");
+  }
+
+  // A tap on the reset button too short to be polled still wakes the unit,
+  // which finds both pins up and must not make a pad press of it
+  while (simSleepingSince(bottom) < 0) simRun(simNow() + 1000);
+  {
+    int64_t tap = simNow();
+    uint32_t padWakes = bottomUnit::lowPower.padWakes;
+    uint32_t padEdges = bottomUnit::startPad.captured;
+    simSetPin(bottom, RESET_BUTTON_PIN, LOW, tap);
+    simSetPin(bottom, RESET_BUTTON_PIN, HIGH, tap + opt.wakeLatencyUs / 2);
+    simRun(tap + SECOND_US);
+    int64_t edge, woke;
+    simLastPinWake(bottom, &edge, &woke);
+    bool woken = edge == tap && woke > tap;
+    bool noPadPress = bottomUnit::lowPower.padWakes == padWakes && bottomUnit::startPad.captured == padEdges &&
+                      bottomUnit::startPad.level == HIGH && !bottomUnit::startPad.inBurst;
+    bool ok = woken && noPadPress;
+    if (!ok) failures++;
+    printf("reset tap: %s, %s%s\n", woken ? "woke the unit" : "didn't wake the unit",
+           noPadPress ? "no pad press" : "stamped a pad press", ok ? "" : "  FAIL");
+  }
+
+  // The unit's estimate against the simulator's
+  int64_t periodUs = simNow() - since;
+  int64_t sleptUs = simSleepTime(bottom) - sleptSince;
+  int64_t sleeping = simSleepingSince(bottom) >= 0 ? simNow() - simSleepingSince(bottom) : 0;  // Not counted by the unit yet
+  const LowPower &lp = bottomUnit::lowPower;
+  int64_t unitMa = lowPowerCurrentUa(lp, simLocalTime(bottom));
+  bool estimateOk = llabs(lp.asleepUs + sleeping - sleptUs) <= (int64_t)lp.sleeps + 1 && lp.padWakes == latencies.size();
+  if (!estimateOk) failures++;
+  std::sort(latencies.begin(), latencies.end());
+  int64_t p50 = latencies.empty() ? 0 : latencies[latencies.size() / 2];
+  int64_t worst = latencies.empty() ? 0 : latencies.back();
+  printf("overall: asleep %.2f%% (unit counted %.2f%%), %.2f mA (unit estimate %.2f mA), %u sleeps, "
+         "%u timer and %u pin wakes, %u pad presses%s\n",
+         100.0 * sleptUs / periodUs, 100.0 * (lp.asleepUs + sleeping) / periodUs, simCurrentMa(sleptUs, periodUs), unitMa / 1000.0,
+         lp.sleeps, lp.timerWakes, lp.pinWakes, lp.padWakes, estimateOk ? "" : "  FAIL");
+  printf("wake to timestamp: p50 %lld us, max %lld us, stamps at most %lld us off (sketch assumes %d us)\n",
+         (long long)p50, (long long)worst, (long long)worstStampUs, HAL_WAKE_LATENCY_US);
+  printf("sleep: %s\n", failures == 0 ? "ok" : "FAIL");
+  return failures == 0 ? 0 : 1;
+}
+
+// Single pad start/stop/reset; checks the paused display against the run length
+static int runSingle(const SimOptions &opt, const char *name, void (*setup)(), void (*loop)(), int64_t tickUs) {
+  static const uint8_t mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+  const uint8_t pin = 33; // BUTTON_PIN in both single-pad sketches
+  SimNode *unit = simAddNode(name, mac, setup, loop);
+
+  int64_t t = 5 * SECOND_US;
+  simRun(t);
+
+  int failures = 0;
+  for (int run = 1; run <= opt.runs; run++) {
+    int64_t runUs = 5 * SECOND_US + nextRandom() % (4 * SECOND_US);
+    int64_t start = t + 500000;
+    int64_t stop = start + runUs;
+
+    bouncePin(unit, pin, LOW, t);        // Press and release to start
+    bouncePin(unit, pin, HIGH, start);
+    bouncePin(unit, pin, LOW, stop);     // Press to pause
+    bouncePin(unit, pin, HIGH, stop + 300000);
+    simRun(stop + 200000);
+
+    // Start and stop are both seen after the debounce delay, allow one tick either way
+    std::string shown = simDisplayText(unit);
+    long value = displayValue(shown);
+    long expected = (long)(runUs / tickUs);
+    bool ok = value >= expected - 1 && value <= expected + 1;
+    if (!ok) failures++;
+    printf("run %d: actual %.6f s, display \"%s\", expected %ld ticks%s\n",
+           run, runUs / 1e6, shown.c_str(), expected, ok ? "" : "  FAIL");
+
+    // Press again to reset
+    bouncePin(unit, pin, LOW, stop + SECOND_US);
+    bouncePin(unit, pin, HIGH, stop + SECOND_US + 100000);
+    t = stop + 3 * SECOND_US;
+    simRun(t);
+  }
+
+  printf("%s: %d/%d runs ok\n", name, opt.runs - failures, opt.runs);
+  return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s pair|race|single|single-decimal|bench|wire|boot|bounce|reaction|link|sleep|sync|history [--runs N] [--seed N] [--latency US] [--down-latency US] "
+                    "[--jitter US] [--loss P] [--rssi DBM] [--drift PPM] [--lanes N] [--trace FILE] [--settle US] [--wrap S] [--wake-latency US] [--verbose]\n", argv[0]);
+    return 2;
+  }
+
+  SimOptions opt;
+  opt.runs = 0;
+  opt.seed = 1;
+  opt.radio.latencyUs = 1500;
+  opt.radio.jitterUs = 500;
+  opt.radio.lossRatio = 0.0;
+  opt.radio.rssiDbm = -60;
+  opt.customRadio = false;
+  opt.driftPpm = 20;
+  opt.lanes = 2;
+  opt.trace = NULL;
+  opt.settleUs = 0;
+  opt.wrapUs = -1;
+  opt.wakeLatencyUs = SIM_WAKE_LATENCY_US;
+  for (int i = 2; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : "0";
+    if (strcmp(arg, "--verbose") == 0) { simSetVerbose(true); continue; }
+    if (strcmp(arg, "--runs") == 0) opt.runs = atoi(value);
+    else if (strcmp(arg, "--seed") == 0) opt.seed = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--latency") == 0) opt.radio.latencyUs = atoll(value), opt.customRadio = true;
+    else if (strcmp(arg, "--down-latency") == 0) opt.radio.downLatencyUs = atoll(value), opt.customRadio = true;
+    else if (strcmp(arg, "--jitter") == 0) opt.radio.jitterUs = atoll(value), opt.customRadio = true;
+    else if (strcmp(arg, "--loss") == 0) opt.radio.lossRatio = atof(value), opt.customRadio = true;
+    else if (strcmp(arg, "--rssi") == 0) opt.radio.rssiDbm = atoi(value), opt.customRadio = true;
+    else if (strcmp(arg, "--drift") == 0) opt.driftPpm = atof(value);
+    else if (strcmp(arg, "--lanes") == 0) opt.lanes = std::min(std::max(atoi(value), 2), MAX_LANES);
+    else if (strcmp(arg, "--trace") == 0) opt.trace = value;
+    else if (strcmp(arg, "--settle") == 0) opt.settleUs = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--wrap") == 0) opt.wrapUs = (int64_t)(atof(value) * SECOND_US);
+    else if (strcmp(arg, "--wake-latency") == 0) opt.wakeLatencyUs = atoll(value);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+
+  simSeed(opt.seed);
+  simSetRadio(opt.radio);
+  simSetWakeLatency(opt.wakeLatencyUs);
+  scenarioRandom = opt.seed;
+  if (opt.wrapUs >= 0) {
+    simSetUptime(MILLIS_WRAP_US - opt.wrapUs);
+    printf("unit clocks pass 2^32 ms %.3f s after power-on\n", opt.wrapUs / 1e6);
+  }
+
+  bool bench = strcmp(argv[1], "bench") == 0;
+  if (opt.runs == 0) opt.runs = bench ? 100 : 5;
+
+  int result;
+  if (bench) {
+    result = runBench(opt);
+  } else if (strcmp(argv[1], "pair") == 0) {
+    result = runPair(opt);
+  } else if (strcmp(argv[1], "race") == 0) {
+    result = runRace(opt);
+  } else if (strcmp(argv[1], "boot") == 0) {
+    result = runBoot(opt);
+  } else if (strcmp(argv[1], "repair") == 0) {
+    result = runRepair(opt);
+  } else if (strcmp(argv[1], "bounce") == 0) {
+    result = runBounce(opt);
+  } else if (strcmp(argv[1], "reaction") == 0) {
+    result = runReaction(opt);
+  } else if (strcmp(argv[1], "link") == 0) {
+    result = runLink(opt);
+  } else if (strcmp(argv[1], "sync") == 0) {
+    result = runSync(opt);
+  } else if (strcmp(argv[1], "history") == 0) {
+    result = runHistory(opt);
+  } else if (strcmp(argv[1], "sleep") == 0) {
+    result = runSleep(opt);
+  } else if (strcmp(argv[1], "wire") == 0) {
+    result = runWire(opt);
+  } else if (strcmp(argv[1], "single") == 0) {
+    result = runSingle(opt, "single", singlePad::setup, singlePad::loop, 10000);
+  } else if (strcmp(argv[1], "single-decimal") == 0) {
+    result = runSingle(opt, "decimal", singleDecimal::setup, singleDecimal::loop, 100000);
+  } else {
+    fprintf(stderr, "unknown scenario %s\n", argv[1]);
+    return 2;
+  }
+
+  // Simulated tasks are still parked in their threads
+  fflush(stdout);
+  _Exit(result);
+}
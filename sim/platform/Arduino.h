@@ -0,0 +1,93 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+// Host stand-in for the parts of the Arduino core and FreeRTOS the sketches
+// use besides the HAL: basic types, Serial, tasks, notifications and
+// critical sections. Implemented in sim.cpp on the simulator's virtual clock.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define IRAM_ATTR
+
+uint32_t esp_random();
+
+// Serial - lines go to stdout prefixed with the virtual time and unit name
+class HardwareSerial {
+public:
+  void begin(unsigned long baud);
+  void setTxBufferSize(size_t size);
+  void print(const char *s);
+  void print(char c);
+  void print(int n) { printNumber(n); }
+  void print(unsigned int n) { printNumber(n); }
+  void print(long n) { printNumber(n); }
+  void print(unsigned long n) { printNumber(n); }
+  void print(long long n) { printNumber(n); }
+  void print(unsigned long long n) { printNumber(n); }
+  void print(double d, int digits = 2);
+  void println() { print('\n'); }
+  template <typename T> void println(T value) { print(value); println(); }
+  void println(double d, int digits) { print(d, digits); println(); }
+  int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  size_t write(const uint8_t *data, size_t len);
+  int available() { return 0; }   // No Serial input in the simulator
+  int read() { return -1; }
+  void flush() {}
+private:
+  void printNumber(long long n);
+};
+
+extern HardwareSerial Serial;
+
+// FreeRTOS - tasks run one at a time; a task only gives up the (simulated)
+// CPU when it blocks, and the highest priority ready task runs next
+typedef void *TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFFu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+typedef struct { int unused; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+#define portYIELD_FROM_ISR() ((void)0)
+
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void *), const char *name, uint32_t stackDepth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+BaseType_t xPortGetCoreID();
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *previousWake, TickType_t increment);
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+void xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef SIM_MD_MAX72XX_H
+#define SIM_MD_MAX72XX_H
+
+// Host stand-in for the MD_MAX72XX names the sketches use. The display itself
+// is SimMatrix (sim-matrix.h).
+
+class MD_MAX72XX {
+public:
+  enum moduleType_t { PAROLA_HW, GENERIC_HW, ICSTATION_HW, FC16_HW,
+                      DR0CR0RR0_HW, DR0CR0RR1_HW, DR0CR1RR0_HW, DR0CR1RR1_HW,
+                      DR1CR0RR0_HW, DR1CR0RR1_HW, DR1CR1RR0_HW, DR1CR1RR1_HW };
+  enum controlRequest_t { SHUTDOWN, SCANLIMIT, INTENSITY, TEST, DECODE, UPDATE, WRAPAROUND };
+  enum controlValue_t { OFF = 0, ON = 1 };
+};
+
+#endif
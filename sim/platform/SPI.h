@@ -0,0 +1,6 @@
+#ifndef SIM_SPI_H
+#define SIM_SPI_H
+
+// Host stand-in, the simulated display needs no bus
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef SIM_MATRIX_H
+#define SIM_MATRIX_H
+
+#include <Arduino.h>
+#include <MD_MAX72xx.h>
+#include "sim.h"
+
+// Simulated MAX72XX chain with the MatrixTransport interface.
+//
+// Keeps the register image the chain would show. With automatic updates off
+// (as frameBegin() sets them) setRow() only stages rows and update() latches
+// them, counting one transaction per changed digit register like the real
+// transport. Drawing a row costs SIM_MATRIX_ROW_US and queueing a transaction
+// SIM_SPI_QUEUE_US of CPU; the transactions are then clocked out one after
+// another at SIM_SPI_CLOCK_HZ, and update() waits (counted in waits) only for
+// a register whose previous transaction is still going out, like the real
+// transport. The panels show a row as soon as it is queued.
+
+#define SIM_MATRIX_MAX_DEVICES 8
+#define SIM_MATRIX_ROWS 8
+
+class SimMatrix {
+public:
+  SimMatrix(MD_MAX72XX::moduleType_t, uint8_t, uint8_t, uint8_t, uint8_t numDevices = 1)
+    : numDevices(numDevices > SIM_MATRIX_MAX_DEVICES ? SIM_MATRIX_MAX_DEVICES : numDevices) {}
+
+  // Statistics, as MatrixTransport
+  uint32_t transactions = 0;
+  uint32_t waits = 0;
+
+  uint8_t numDevices;
+  uint8_t shown[SIM_MATRIX_MAX_DEVICES][SIM_MATRIX_ROWS] = {};  // What the panels show
+
+  // Function to attach the display to the unit being set up
+  bool begin() {
+    simAttachMatrix(this);
+    return true;
+  }
+
+  // Function to apply a control request, only UPDATE changes behaviour
+  bool control(MD_MAX72XX::controlRequest_t mode, int value) {
+    if (mode == MD_MAX72XX::UPDATE) {
+      _autoUpdate = (value == MD_MAX72XX::ON);
+      if (_autoUpdate) update();
+    }
+    return true;
+  }
+
+  // Function to stage one row of one device
+  bool setRow(uint8_t dev, uint8_t row, uint8_t value) {
+    if (dev >= numDevices || row >= SIM_MATRIX_ROWS) return false;
+    _drawUs += SIM_MATRIX_ROW_US;
+    if (_staged[dev][row] != value) {
+      _staged[dev][row] = value;
+      _dirty |= (1 << row);
+    }
+    if (_autoUpdate) update();
+    return true;
+  }
+
+  // Function to blank every device
+  void clear() {
+    for (int dev = 0; dev < numDevices; dev++) {
+      for (int row = 0; row < SIM_MATRIX_ROWS; row++) setRow(dev, row, 0);
+    }
+  }
+
+  // Function to latch the staged rows, charging the drawing and queueing in one
+  // go (one task switch per frame keeps the simulator fast)
+  void update() {
+    int64_t transferUs = ((int64_t)numDevices * 16 * 1000000 + SIM_SPI_CLOCK_HZ - 1) / SIM_SPI_CLOCK_HZ;
+    int64_t cpuUs = _drawUs;
+    for (int row = 0; row < SIM_MATRIX_ROWS; row++) {
+      if (!(_dirty & (1 << row))) continue;
+      if (_sentAt[row] > simNow()) {
+        waits++;
+        simWaitUntil(_sentAt[row]);
+      }
+      cpuUs += SIM_SPI_QUEUE_US;
+    }
+    simSpendCpu(cpuUs);
+    _drawUs = 0;
+
+    for (int row = 0; row < SIM_MATRIX_ROWS; row++) {
+      if (!(_dirty & (1 << row))) continue;
+      _busIdleAt = std::max(_busIdleAt, simNow()) + transferUs;
+      _sentAt[row] = _busIdleAt;
+      for (int dev = 0; dev < numDevices; dev++) shown[dev][row] = _staged[dev][row];
+      transactions++;
+    }
+    _dirty = 0;
+  }
+
+  // Function to block until everything queued has been sent
+  void flush() {
+    simWaitUntil(_busIdleAt);
+  }
+
+private:
+  bool _autoUpdate = true;
+  uint8_t _staged[SIM_MATRIX_MAX_DEVICES][SIM_MATRIX_ROWS] = {};
+  uint8_t _dirty = 0;
+  int64_t _sentAt[SIM_MATRIX_ROWS] = {};  // True time each register's last transaction is out
+  int64_t _busIdleAt = 0;                 // True time the last queued transaction is out
+  int64_t _drawUs = 0;                    // CPU time of the rows drawn since the last update()
+};
+
+#endif
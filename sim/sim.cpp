@@ -0,0 +1,854 @@
+#include <Arduino.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include "hal.h"
+#include "digit-glyphs.h"
+#include "sim.h"
+#include "sim-matrix.h"
+
+// Scheduler, HAL and platform implementation for the simulator (see sim.h).
+//
+// Every simulated task is a host thread, but only one of them (or the
+// scheduler) runs at a time: control is handed over explicitly under simLock,
+// which keeps runs deterministic and lets sketch code use plain globals.
+
+#define SIM_MAX_PINS 40
+#define SIM_NEVER INT64_MAX
+#define SIM_ACK_US 100   // Delivery to send callback on the sender
+#define SIM_CPU_MHZ 240  // Clock the cycle counter runs at
+#define SIM_STORAGE_SIZE (64 * 1024)
+
+struct SimTask {
+  SimNode *node;
+  const char *name;
+  UBaseType_t priority;
+  BaseType_t core;
+  void (*entry)(void *);
+  void *arg;
+  std::condition_variable resume;
+  bool running = false;
+  bool deleted = false;
+  bool waitingNotify = false;   // Blocked in ulTaskNotifyTake()
+  bool busy = false;            // Spending CPU time (simSpendCpu()), holding its core
+  int64_t wakeAt = 0;           // True time the task is ready again
+  uint32_t notifications = 0;
+  uint64_t lastRun = 0;         // Round robin among equal priorities
+};
+
+struct SimTimer {
+  SimNode *node;
+  void (*callback)(void *);
+  void *arg;
+  uint32_t generation;          // Bumped on start/stop so stale expiries are ignored
+};
+
+struct SimNode {
+  std::string name;
+  uint8_t mac[6];
+  int64_t bootTime = 0;         // True time the unit powered up
+  bool powered = true;          // False once powered off
+  int64_t radioUpTime = -1;     // True time of halRadioBegin()
+  std::vector<std::vector<uint8_t>> radioPeers;  // ESP-NOW peer list (halRadioAddPeer())
+  int64_t clockOffset = 0;
+  double drift = 0;
+  int pins[SIM_MAX_PINS];
+  void (*isr[SIM_MAX_PINS])();
+  int isrMode[SIM_MAX_PINS];
+  int64_t glitchUs[SIM_MAX_PINS];   // Pulse counter filter length, 0 = plain interrupt
+  int filtered[SIM_MAX_PINS];       // Level out of the filter
+  int64_t pinChanged[SIM_MAX_PINS]; // True time of the last change
+  int leds[SIM_MAX_PINS];           // PWM duty, or the level of a digital output
+  HalRadioReceive onReceive = NULL;
+  HalRadioSent onSent = NULL;
+  SimMatrix *matrix = NULL;
+  std::vector<uint8_t> storage;   // Flash contents, erased (0xFF) at power-up of a new unit
+  int64_t storageBudget = -1;     // Bytes to program or erase before a power cut (simStorageCut), -1 = no cut
+  std::map<std::string, std::vector<uint8_t> > config;  // Settings (halConfigWrite)
+  void (*setup)();
+  void (*loop)();
+  std::string serialLine;
+  int64_t uartCharUs = 0;       // Time to send one character, 0 before Serial.begin()
+  int64_t uartIdleAt = 0;       // True time the UART has sent everything queued
+  size_t txBufferSize = 0;      // Serial.setTxBufferSize()
+  int wakeLevel[SIM_MAX_PINS];  // Level that ends a light sleep, -1 = not a wake pin
+  SimTask *sleeper = NULL;      // Task in halLightSleep(), NULL while awake
+  HalWakeCause wakeCause = HAL_WAKE_TIMER;
+  int64_t sleepStart = 0;
+  int64_t asleepUs = 0;         // True time spent in light sleep
+  int64_t wakeEdge = -1;        // True time of the pin change that last woke the unit
+  int64_t wokeAt = -1;          // and of its waking
+};
+
+struct SimEvent {
+  int64_t at;
+  uint64_t order;
+  SimNode *node;
+  std::function<void()> action;
+  bool operator>(const SimEvent &other) const {
+    return at != other.at ? at > other.at : order > other.order;
+  }
+};
+
+HardwareSerial Serial;
+
+static std::mutex simLock;
+static std::condition_variable schedulerWake;
+static std::vector<SimTask *> tasks;
+static std::vector<SimNode *> nodes;
+static std::priority_queue<SimEvent, std::vector<SimEvent>, std::greater<SimEvent> > events;
+static uint64_t eventOrder = 0;
+static uint64_t runOrder = 0;
+static int64_t trueTime = 0;
+static SimTask *currentTask = NULL;
+static SimNode *currentNode = NULL;
+static uint32_t randomState = 1;
+static SimRadioProfile radio = { 1500, 500, 0.0, -60 };
+static int64_t wakeLatencyUs = SIM_WAKE_LATENCY_US;
+static bool verbose = false;
+static int64_t uptimeUs = 0;  // Every unit's clock reading at power-up (simSetUptime)
+static int64_t probeTimes[PROBE_COUNT] = { -1, -1, -1, -1, -1, -1, -1 };
+
+// Function to draw the next pseudo-random number (xorshift32)
+static uint32_t simRandom() {
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+// Function to convert true time to a unit's local clock
+static int64_t localAt(SimNode *node, int64_t t) {
+  int64_t sinceBoot = t - node->bootTime;
+  return uptimeUs + node->clockOffset + sinceBoot + (int64_t)(sinceBoot * node->drift);
+}
+
+// Function to find the first true time at which a unit's clock reaches local
+static int64_t trueAt(SimNode *node, int64_t local) {
+  int64_t t = node->bootTime + (int64_t)((local - uptimeUs - node->clockOffset) / (1.0 + node->drift));
+  while (localAt(node, t) < local) t++;
+  while (localAt(node, t - 1) >= local) t--;
+  return t < trueTime ? trueTime : t;
+}
+
+// Function to queue an action at a true time, in a unit's context
+static void schedule(int64_t at, SimNode *node, std::function<void()> action) {
+  SimEvent ev = { at, eventOrder++, node, action };
+  events.push(ev);
+}
+
+// Function to hand the CPU back to the scheduler until resumed (task thread)
+static void yieldToScheduler(SimTask *task) {
+  std::unique_lock<std::mutex> lock(simLock);
+  task->running = false;
+  schedulerWake.notify_one();
+  task->resume.wait(lock, [task] { return task->running; });
+}
+
+// Function to block the running task until wakeAt or, optionally, a notification
+static void blockUntil(int64_t wakeAt, bool waitNotify) {
+  SimTask *task = currentTask;
+  task->wakeAt = wakeAt;
+  task->waitingNotify = waitNotify;
+  yieldToScheduler(task);
+}
+
+// Function to find the true time a task sleeping for ticks wakes (tick aligned)
+static int64_t tickDeadline(TickType_t ticks) {
+  SimNode *node = currentTask->node;
+  int64_t tick = localAt(node, trueTime) / 1000;
+  return trueAt(node, (tick + ticks) * 1000);
+}
+
+static void taskThread(SimTask *task) {
+  {
+    std::unique_lock<std::mutex> lock(simLock);
+    task->resume.wait(lock, [task] { return task->running; });
+  }
+  task->entry(task->arg);
+  vTaskDelete(NULL);
+}
+
+// Function to run a task until it blocks (scheduler thread)
+static void runTask(SimTask *task) {
+  std::unique_lock<std::mutex> lock(simLock);
+  task->waitingNotify = false;
+  task->lastRun = ++runOrder;
+  currentTask = task;
+  currentNode = task->node;
+  task->running = true;
+  task->resume.notify_one();
+  schedulerWake.wait(lock, [task] { return !task->running; });
+  currentTask = NULL;
+  currentNode = NULL;
+}
+
+// Function to check whether a task can run: not while its unit light sleeps,
+// except to wake the task that put it to sleep
+static bool taskAwake(const SimTask *t) {
+  return t->node->sleeper == NULL || t->node->sleeper == t;
+}
+
+// Function to check whether a task's core is held by another task of its unit
+// spending CPU time at the same or a higher priority
+static bool coreHeld(const SimTask *t) {
+  for (size_t i = 0; i < tasks.size(); i++) {
+    const SimTask *b = tasks[i];
+    if (b != t && b->busy && !b->deleted && b->node == t->node && b->core == t->core &&
+        b->priority >= t->priority) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Function to pick the highest priority ready task
+static SimTask *pickTask() {
+  SimTask *best = NULL;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    SimTask *t = tasks[i];
+    if (t->deleted || !taskAwake(t)) continue;
+    if (t->wakeAt > trueTime || coreHeld(t)) continue;
+    if (best == NULL || t->priority > best->priority ||
+        (t->priority == best->priority && t->lastRun < best->lastRun)) {
+      best = t;
+    }
+  }
+  return best;
+}
+
+// Arduino loopTask: setup() once, then loop() forever
+static void arduinoLoopTask(void *arg) {
+  SimNode *node = (SimNode *)arg;
+  node->setup();
+  for (;;) {
+    node->loop();
+    blockUntil(trueAt(node, localAt(node, trueTime) + SIM_LOOP_COST_US), false);
+  }
+}
+
+// Simulator control
+
+void simSeed(uint32_t seed) {
+  randomState = seed != 0 ? seed : 1;
+}
+
+void simSetRadio(const SimRadioProfile &profile) {
+  radio = profile;
+}
+
+void simSetWakeLatency(int64_t us) {
+  wakeLatencyUs = us;
+}
+
+SimNode *simAddNode(const char *name, const uint8_t *mac, void (*setup)(), void (*loop)()) {
+  SimNode *node = new SimNode();
+  node->name = name;
+  memcpy(node->mac, mac, 6);
+  node->bootTime = trueTime;
+  for (int pin = 0; pin < SIM_MAX_PINS; pin++) {
+    node->pins[pin] = HIGH;   // Pads and buttons idle high on their pull-ups
+    node->isr[pin] = NULL;
+    node->isrMode[pin] = 0;
+    node->glitchUs[pin] = 0;
+    node->filtered[pin] = HIGH;
+    node->pinChanged[pin] = 0;
+    node->leds[pin] = 0;
+    node->wakeLevel[pin] = -1;
+  }
+  node->storage.assign(SIM_STORAGE_SIZE, 0xFF);
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (!nodes[i]->powered && memcmp(nodes[i]->mac, mac, 6) == 0) {
+      node->storage = nodes[i]->storage;
+      node->config = nodes[i]->config;
+    }
+  }
+  node->setup = setup;
+  node->loop = loop;
+  nodes.push_back(node);
+
+  SimNode *caller = currentNode;
+  currentNode = node;
+  xTaskCreatePinnedToCore(arduinoLoopTask, "loopTask", 8192, node, 1, NULL, 1);
+  currentNode = caller;
+  return node;
+}
+
+void simStorageCut(SimNode *node, int64_t bytes) {
+  node->storageBudget = bytes;
+}
+
+void simActAs(SimNode *node) {
+  currentNode = node;
+}
+
+void simPowerOff(SimNode *node) {
+  node->powered = false;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    if (tasks[i]->node == node) tasks[i]->deleted = true;  // Threads stay parked
+  }
+}
+
+void simSetClock(SimNode *node, int64_t offsetUs, double driftPpm) {
+  node->clockOffset = offsetUs;
+  node->drift = driftPpm * 1e-6;
+}
+
+void simSetDrift(SimNode *node, double driftPpm) {
+  int64_t sinceBoot = trueTime - node->bootTime;
+  double drift = driftPpm * 1e-6;
+  node->clockOffset += (int64_t)(sinceBoot * node->drift) - (int64_t)(sinceBoot * drift);
+  node->drift = drift;
+}
+
+void simSetUptime(int64_t us) {
+  uptimeUs = us;
+}
+
+// Function to end a unit's light sleep, its wake latency from now
+static void wakeFromPin(SimNode *node) {
+  if (node->sleeper == NULL || node->wakeCause == HAL_WAKE_PIN) return;
+  int64_t latency = wakeLatencyUs - SIM_WAKE_JITTER_US + simRandom() % (2 * SIM_WAKE_JITTER_US + 1);
+  node->wakeCause = HAL_WAKE_PIN;
+  node->wakeEdge = trueTime;
+  node->sleeper->wakeAt = std::min(node->sleeper->wakeAt, trueTime + latency);
+}
+
+void simSetPin(SimNode *node, uint8_t pin, int level, int64_t atUs) {
+  schedule(atUs, node, [node, pin, level] {
+    int old = node->pins[pin];
+    node->pins[pin] = level;
+    if (node->wakeLevel[pin] == level) wakeFromPin(node);
+    if (old == level || node->isr[pin] == NULL) return;
+    node->pinChanged[pin] = trueTime;
+    if (node->glitchUs[pin] > 0) {
+      // The filter passes a level once it has held for the filter length
+      int64_t changed = trueTime;
+      schedule(trueTime + node->glitchUs[pin], node, [node, pin, level, changed] {
+        if (node->pinChanged[pin] != changed || node->filtered[pin] == level) return;
+        node->filtered[pin] = level;
+        if (node->sleeper == NULL) node->isr[pin]();  // The pulse counter is stopped in light sleep
+      });
+      return;
+    }
+    int mode = node->isrMode[pin];
+    if (node->sleeper != NULL) return;
+    if (mode == CHANGE || (mode == RISING && level == HIGH) || (mode == FALLING && level == LOW)) {
+      node->isr[pin]();
+    }
+  });
+}
+
+void simRun(int64_t untilUs) {
+  for (;;) {
+    while (!events.empty() && events.top().at <= trueTime) {
+      SimEvent ev = events.top();
+      events.pop();
+      if (ev.node != NULL && !ev.node->powered) continue;
+      currentNode = ev.node;
+      ev.action();
+      currentNode = NULL;
+    }
+
+    SimTask *task = pickTask();
+    if (task != NULL) {
+      runTask(task);
+      continue;
+    }
+
+    // Nothing can run now - jump to the next thing that happens
+    int64_t next = events.empty() ? SIM_NEVER : events.top().at;
+    for (size_t i = 0; i < tasks.size(); i++) {
+      if (!tasks[i]->deleted && taskAwake(tasks[i]) && !coreHeld(tasks[i]) && tasks[i]->wakeAt < next) {
+        next = tasks[i]->wakeAt;
+      }
+    }
+    if (next > untilUs) {
+      trueTime = untilUs;
+      return;
+    }
+    trueTime = next;
+  }
+}
+
+void simSpendCpu(int64_t us) {
+  if (currentTask == NULL || us <= 0) return;
+  currentTask->busy = true;
+  blockUntil(trueTime + us, false);
+  currentTask->busy = false;
+}
+
+void simWaitUntil(int64_t atUs) {
+  if (currentTask != NULL && atUs > trueTime) blockUntil(atUs, false);
+}
+
+int64_t simNow() {
+  return trueTime;
+}
+
+// Function to find a peer in the unit's ESP-NOW peer list, -1 if it isn't one
+static int radioPeerIndex(SimNode *node, const uint8_t *mac) {
+  for (size_t i = 0; i < node->radioPeers.size(); i++) {
+    if (memcmp(node->radioPeers[i].data(), mac, 6) == 0) return (int)i;
+  }
+  return -1;
+}
+
+int64_t simRadioUpTime(SimNode *node) {
+  return node->radioUpTime;
+}
+
+int simRadioPeerCount(SimNode *node) {
+  return (int)node->radioPeers.size();
+}
+
+bool simRadioIsPeer(SimNode *node, const uint8_t *mac) {
+  return radioPeerIndex(node, mac) >= 0;
+}
+
+int64_t simLocalTime(SimNode *node) {
+  return localAt(node, trueTime);
+}
+
+int64_t simSleepTime(SimNode *node) {
+  return node->asleepUs + (node->sleeper != NULL ? trueTime - node->sleepStart : 0);
+}
+
+int64_t simSleepingSince(SimNode *node) {
+  return node->sleeper != NULL ? node->sleepStart : -1;
+}
+
+void simLastPinWake(SimNode *node, int64_t *edgeUs, int64_t *wokeUs) {
+  *edgeUs = node->wakeEdge;
+  *wokeUs = node->wokeAt;
+}
+
+std::string simDisplayText(SimNode *node) {
+  std::string text;
+  SimMatrix *m = node->matrix;
+  if (m == NULL) return text;
+  for (int panel = 0; panel < m->numDevices; panel++) {
+    char c = '?';
+    bool point = false;
+    for (int variant = 0; variant < GLYPH_VARIANTS && c == '?'; variant++) {
+      for (int g = 0; g < GLYPH_COUNT; g++) {
+        if (memcmp(m->shown[panel], glyphTable[variant][g], SIM_MATRIX_ROWS) == 0) {
+          c = g == GLYPH_BLANK ? ' ' : '0' + g;
+          point = variant == GLYPH_LEFT_DECIMAL;
+          break;
+        }
+      }
+    }
+    text += c;
+    if (point) text += '.';
+  }
+  return text;
+}
+
+int simLedValue(SimNode *node, uint8_t pin) {
+  return pin < SIM_MAX_PINS ? node->leds[pin] : 0;
+}
+
+void simSetVerbose(bool on) {
+  verbose = on;
+}
+
+void simClearProbes() {
+  for (int i = 0; i < PROBE_COUNT; i++) probeTimes[i] = -1;
+}
+
+int64_t simProbeTime(int probe) {
+  return probe >= 0 && probe < PROBE_COUNT ? probeTimes[probe] : -1;
+}
+
+void simAttachMatrix(SimMatrix *matrix) {
+  currentNode->matrix = matrix;
+}
+
+// HAL - clock
+
+int64_t halMicros() {
+  return localAt(currentNode, trueTime);
+}
+
+int64_t halMicrosSinceBoot() {
+  return localAt(currentNode, trueTime) - localAt(currentNode, currentNode->bootTime);
+}
+
+uint32_t halCycleCount() {
+  return (uint32_t)(halMicros() * SIM_CPU_MHZ);
+}
+
+uint32_t halCpuMhz() {
+  return SIM_CPU_MHZ;
+}
+
+void halDelay(unsigned long ms) {
+  SimNode *node = currentTask->node;
+  blockUntil(trueAt(node, localAt(node, trueTime) + (int64_t)ms * 1000), false);
+}
+
+HalTimer halTimerCreate(void (*callback)(void *), void *arg, const char *) {
+  SimTimer *timer = new SimTimer();
+  timer->node = currentNode;
+  timer->callback = callback;
+  timer->arg = arg;
+  timer->generation = 0;
+  return timer;
+}
+
+void halTimerStartOnce(HalTimer timer, int64_t us) {
+  uint32_t generation = ++timer->generation;
+  SimNode *node = timer->node;
+  int64_t at = trueAt(node, localAt(node, trueTime) + (us > 0 ? us : 0));
+  schedule(at, node, [timer, generation] {
+    if (timer->generation == generation) timer->callback(timer->arg);
+  });
+}
+
+void halTimerStop(HalTimer timer) {
+  timer->generation++;
+}
+
+// HAL - GPIO and LED PWM
+
+void halPinMode(uint8_t, uint8_t) {}
+
+int halDigitalRead(uint8_t pin) {
+  return pin < SIM_MAX_PINS ? currentNode->pins[pin] : LOW;
+}
+
+void halAttachInterrupt(uint8_t pin, void (*handler)(), int mode) {
+  if (pin >= SIM_MAX_PINS) return;
+  currentNode->isr[pin] = handler;
+  currentNode->isrMode[pin] = mode;
+}
+
+bool halAttachFilteredInterrupt(uint8_t pin, void (*handler)(), uint32_t glitchNs) {
+  if (pin >= SIM_MAX_PINS) return false;
+  currentNode->isr[pin] = handler;
+  currentNode->isrMode[pin] = CHANGE;
+  currentNode->glitchUs[pin] = max((int64_t)1, (int64_t)glitchNs / 1000);
+  currentNode->filtered[pin] = currentNode->pins[pin];
+  return true;
+}
+
+void halLedWrite(uint8_t pin, int value) {
+  if (pin < SIM_MAX_PINS) currentNode->leds[pin] = value;
+}
+
+void halDigitalWrite(uint8_t pin, int level) {
+  if (pin < SIM_MAX_PINS) currentNode->leds[pin] = level;
+}
+
+// HAL - light sleep
+
+void halSleepWakeOnPin(uint8_t pin, int level) {
+  if (pin < SIM_MAX_PINS) currentNode->wakeLevel[pin] = level;
+}
+
+void halSleepWakeOnSerial() {}
+
+HalWakeCause halLightSleep(int64_t us) {
+  SimNode *node = currentNode;
+  node->wakeCause = HAL_WAKE_TIMER;
+  node->sleeper = currentTask;
+  node->sleepStart = trueTime;
+  currentTask->wakeAt = trueAt(node, localAt(node, trueTime) + us);
+  for (int pin = 0; pin < SIM_MAX_PINS; pin++) {
+    if (node->wakeLevel[pin] == node->pins[pin]) wakeFromPin(node);  // Level triggered
+  }
+  blockUntil(currentTask->wakeAt, false);
+  node->sleeper = NULL;
+  node->asleepUs += trueTime - node->sleepStart;
+  if (node->wakeCause == HAL_WAKE_PIN) node->wokeAt = trueTime;
+  return node->wakeCause;
+}
+
+// HAL - peer radio
+
+bool halRadioBegin(HalRadioReceive onReceive, HalRadioSent onSent) {
+  if (currentTask != NULL) blockUntil(trueTime + SIM_RADIO_START_US, false);
+  currentNode->onReceive = onReceive;
+  currentNode->onSent = onSent;
+  currentNode->radioUpTime = trueTime;
+  return true;
+}
+
+bool halRadioAddPeer(const uint8_t *mac) {
+  if (radioPeerIndex(currentNode, mac) >= 0) return true;
+  if (currentNode->radioPeers.size() >= SIM_RADIO_MAX_PEERS) return false;
+  currentNode->radioPeers.push_back(std::vector<uint8_t>(mac, mac + 6));
+  return true;
+}
+
+void halRadioRemovePeer(const uint8_t *mac) {
+  int i = radioPeerIndex(currentNode, mac);
+  if (i >= 0) currentNode->radioPeers.erase(currentNode->radioPeers.begin() + i);
+}
+
+bool halRadioSend(const uint8_t *mac, const uint8_t *data, size_t len) {
+  static const uint8_t broadcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+  if (radioPeerIndex(currentNode, mac) < 0) return false;  // esp_now_send() only sends to peers
+  simSpendCpu(SIM_RADIO_SEND_US);  // The frame leaves once esp_now_send() returns
+  SimNode *from = currentNode;
+  std::vector<uint8_t> frame(data, data + len);
+  bool isBroadcast = memcmp(mac, broadcast, 6) == 0;
+  // Whether a unicast frame got through is known once it arrives: a unit in
+  // light sleep doesn't receive
+  std::shared_ptr<bool> delivered = std::make_shared<bool>(isBroadcast);
+  int64_t latency = radio.latencyUs;
+
+  for (size_t i = 0; i < nodes.size(); i++) {
+    SimNode *to = nodes[i];
+    if (to == from || !to->powered || (!isBroadcast && memcmp(to->mac, mac, 6) != 0)) continue;
+    bool down = to->name == "bottom" && radio.downLatencyUs >= 0;
+    latency = (down ? radio.downLatencyUs : radio.latencyUs) + (radio.jitterUs > 0 ? simRandom() % (radio.jitterUs + 1) : 0);
+    bool lost = simRandom() < radio.lossRatio * 4294967296.0;
+    if (lost || to->onReceive == NULL) continue;
+    int rssi = radio.rssiDbm - SIM_RSSI_SPREAD + (int)(simRandom() % (2 * SIM_RSSI_SPREAD + 1));
+    schedule(trueTime + latency, to, [to, from, frame, rssi, isBroadcast, delivered] {
+      if (to->sleeper != NULL) return;
+      if (!isBroadcast) *delivered = true;
+      to->onReceive(from->mac, frame.data(), (int)frame.size(), rssi);
+    });
+  }
+
+  if (from->onSent != NULL) {
+    uint8_t dest[6];
+    memcpy(dest, mac, 6);
+    std::vector<uint8_t> destMac(dest, dest + 6);
+    schedule(trueTime + latency + SIM_ACK_US, from, [from, destMac, delivered] {
+      from->onSent(destMac.data(), *delivered);
+    });
+  }
+  return true;
+}
+
+void halRadioMacAddress(uint8_t *mac) {
+  memcpy(mac, currentNode->mac, 6);
+}
+
+// HAL - storage
+
+// Function to take up to len bytes of flash work out of the unit's budget
+// before a power cut, returns how many get done
+static size_t storageAllowance(SimNode *node, size_t len) {
+  if (node->storageBudget < 0) return len;
+  size_t done = (size_t)std::min((int64_t)len, node->storageBudget);
+  node->storageBudget -= done;
+  return done;
+}
+
+uint32_t halStorageSize() {
+  return SIM_STORAGE_SIZE;
+}
+
+bool halStorageRead(uint32_t offset, void *data, size_t len) {
+  if (offset + len > SIM_STORAGE_SIZE) return false;
+  memcpy(data, &currentNode->storage[offset], len);
+  return true;
+}
+
+bool halStorageWrite(uint32_t offset, const void *data, size_t len) {
+  if (offset + len > SIM_STORAGE_SIZE) return false;
+  const uint8_t *bytes = (const uint8_t *)data;
+  size_t done = storageAllowance(currentNode, len);
+  for (size_t i = 0; i < done; i++) currentNode->storage[offset + i] &= bytes[i];  // Programming only clears bits
+  return done == len;
+}
+
+bool halStorageErase(uint32_t offset, size_t len) {
+  if (offset % HAL_STORAGE_SECTOR != 0 || len % HAL_STORAGE_SECTOR != 0 || offset + len > SIM_STORAGE_SIZE) return false;
+  size_t done = storageAllowance(currentNode, len);
+  memset(&currentNode->storage[offset], 0xFF, done);
+  return done == len;
+}
+
+// HAL - settings
+
+bool halConfigRead(const char *key, void *data, size_t len) {
+  std::map<std::string, std::vector<uint8_t> >::const_iterator it = currentNode->config.find(key);
+  if (it == currentNode->config.end() || it->second.size() != len) return false;
+  memcpy(data, it->second.data(), len);
+  return true;
+}
+
+bool halConfigWrite(const char *key, const void *data, size_t len) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  currentNode->config[key].assign(bytes, bytes + len);
+  return true;
+}
+
+// HAL - latency probes
+
+void halProbe(HalProbe probe) {
+  if (probeTimes[probe] < 0) probeTimes[probe] = trueTime;
+}
+
+// Platform - FreeRTOS
+
+BaseType_t xTaskCreatePinnedToCore(void (*entry)(void *), const char *name, uint32_t,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+  SimTask *task = new SimTask();
+  task->node = currentNode;
+  task->name = name;
+  task->priority = priority;
+  task->core = core;
+  task->entry = entry;
+  task->arg = arg;
+  task->wakeAt = trueTime;
+  tasks.push_back(task);
+  if (handle != NULL) *handle = task;
+  std::thread(taskThread, task).detach();
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t handle) {
+  SimTask *task = handle != NULL ? (SimTask *)handle : currentTask;
+  task->deleted = true;
+  if (task != currentTask) return;
+  // Park this thread for good
+  std::unique_lock<std::mutex> lock(simLock);
+  task->running = false;
+  schedulerWake.notify_one();
+  task->resume.wait(lock, [] { return false; });
+}
+
+// Interrupts, timers and radio callbacks run outside any task and count as core 0
+BaseType_t xPortGetCoreID() {
+  return currentTask != NULL ? currentTask->core : 0;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  blockUntil(ticks == 0 ? trueTime : tickDeadline(ticks), false);
+}
+
+void vTaskDelayUntil(TickType_t *previousWake, TickType_t increment) {
+  *previousWake += increment;
+  SimNode *node = currentTask->node;
+  // The tick count wraps like FreeRTOS's: find the wake tick nearest to now
+  int64_t nowTicks = localAt(node, trueTime) / 1000;
+  int64_t wakeTicks = nowTicks + (int32_t)(*previousWake - (TickType_t)nowTicks);
+  blockUntil(trueAt(node, wakeTicks * 1000), false);
+}
+
+TickType_t xTaskGetTickCount() {
+  return (TickType_t)(localAt(currentNode, trueTime) / 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return currentTask;
+}
+
+// A task waiting for the notification runs SIM_TASK_WAKE_US later
+void xTaskNotifyGive(TaskHandle_t handle) {
+  if (handle == NULL) return;
+  SimTask *task = (SimTask *)handle;
+  task->notifications++;
+  if (task->waitingNotify) task->wakeAt = std::min(task->wakeAt, trueTime + SIM_TASK_WAKE_US);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t handle, BaseType_t *higherPriorityTaskWoken) {
+  xTaskNotifyGive(handle);
+  if (higherPriorityTaskWoken != NULL) *higherPriorityTaskWoken = pdFALSE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait) {
+  SimTask *task = currentTask;
+  if (task->notifications == 0 && ticksToWait != 0) {
+    blockUntil(ticksToWait == portMAX_DELAY ? SIM_NEVER : tickDeadline(ticksToWait), true);
+  }
+  uint32_t value = task->notifications;
+  if (value > 0) {
+    task->notifications = clearOnExit ? 0 : value - 1;
+  }
+  return value;
+}
+
+uint32_t esp_random() {
+  return simRandom();
+}
+
+// Platform - Serial
+
+// Function to queue Serial output on a unit's UART; a task blocks until it
+// fits in the FIFO and TX buffer
+static void uartQueue(SimNode *node, size_t len) {
+  if (node->uartCharUs == 0) return;
+  int64_t idleAt = std::max(node->uartIdleAt, trueTime) + (int64_t)len * node->uartCharUs;
+  node->uartIdleAt = idleAt;
+  int64_t room = (int64_t)(SIM_UART_FIFO + node->txBufferSize) * node->uartCharUs;
+  if (currentTask != NULL && idleAt - trueTime > room) blockUntil(idleAt - room, false);
+}
+
+// Function to collect Serial output into lines tagged with time and unit
+static void serialWrite(const char *s, size_t len) {
+  SimNode *node = currentNode;
+  if (node != NULL) uartQueue(node, len);
+  for (size_t i = 0; i < len; i++) {
+    if (node == NULL) {
+      if (verbose) putchar(s[i]);
+      continue;
+    }
+    if (s[i] != '\n') {
+      node->serialLine += s[i];
+      continue;
+    }
+    if (verbose) {
+      printf("%12.6f %-8s %s\n", trueTime / 1e6, node->name.c_str(), node->serialLine.c_str());
+    }
+    node->serialLine.clear();
+  }
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+  if (currentNode != NULL && baud > 0) currentNode->uartCharUs = 10000000 / baud;  // 8N1
+}
+
+void HardwareSerial::setTxBufferSize(size_t size) {
+  if (currentNode != NULL) currentNode->txBufferSize = size;
+}
+
+void HardwareSerial::print(const char *s) {
+  serialWrite(s, strlen(s));
+}
+
+void HardwareSerial::print(char c) {
+  serialWrite(&c, 1);
+}
+
+void HardwareSerial::print(double d, int digits) {
+  char buf[64];
+  int n = snprintf(buf, sizeof(buf), "%.*f", digits, d);
+  serialWrite(buf, n);
+}
+
+void HardwareSerial::printNumber(long long n) {
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "%lld", n);
+  serialWrite(buf, len);
+}
+
+size_t HardwareSerial::write(const uint8_t *data, size_t len) {
+  serialWrite((const char *)data, len);
+  return len;
+}
+
+int HardwareSerial::printf(const char *format, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (n > (int)sizeof(buf) - 1) n = sizeof(buf) - 1;
+  if (n > 0) serialWrite(buf, n);
+  return n;
+}
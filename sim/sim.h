@@ -0,0 +1,165 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <string>
+
+// Deterministic host simulator for the stopwatch sketches.
+//
+// Each simulated unit (node) runs a sketch's setup()/loop() plus any tasks it
+// creates, against its own GPIO pins, LEDs, display and radio, and its own
+// clock (offset and drift against simulated true time). Time is virtual: it
+// only moves when every task is blocked, straight to the next timer, task
+// wake-up, pin change or radio delivery, so runs are much faster than real
+// time and identical for the same seed.
+//
+// Each unit's radio keeps an ESP-NOW peer list of at most SIM_RADIO_MAX_PEERS
+// addresses, the broadcast address included, and sends only to addresses on it.
+//
+// Code runs in zero virtual time; an Arduino loop() pass costs
+// SIM_LOOP_COST_US so polling sketches still let time advance, bringing up
+// the radio blocks the caller for SIM_RADIO_START_US, and Serial output
+// blocks a task while the UART's FIFO and TX buffer are full, draining at the
+// baud rate. Tasks are not preempted while running, and interrupts and
+// callbacks run between tasks.
+//
+// The steps of the start path that take measurable time on the ESP32 are
+// charged a modelled cost: a task waiting for a notification runs
+// SIM_TASK_WAKE_US after it, halRadioSend() spends SIM_RADIO_SEND_US of the
+// calling task's CPU, and the display (sim-matrix.h) spends SIM_MATRIX_ROW_US
+// per row drawn and SIM_SPI_QUEUE_US per SPI transaction, which is clocked
+// out at SIM_SPI_CLOCK_HZ. These are typical ESP-IDF figures at 240 MHz, not
+// measurements from the units. While a task spends CPU time, tasks of its
+// unit on the same core at its priority or lower wait.
+//
+// A unit in light sleep (halLightSleep()) runs nothing: its tasks wait, its
+// pulse counter filters pass no edges, and frames sent to it are lost. A wake
+// pin ends the sleep the wake latency later (simSetWakeLatency()), give or
+// take SIM_WAKE_JITTER_US. The latency is the simulator's own, not the
+// HAL_WAKE_LATENCY_US the sketches assume, so their compensation for it is
+// checked against a latency they don't know.
+
+#define SIM_LOOP_COST_US 50   // Virtual time used by one pass of an Arduino loop()
+#define SIM_RADIO_START_US 80000  // halRadioBegin(): Wi-Fi start and esp_now_init, a typical figure
+#define SIM_UART_FIFO 128     // Bytes the UART holds without a driver TX buffer
+#define SIM_RSSI_SPREAD 3     // Received signal strength varies this much either way (dB)
+#define SIM_RADIO_MAX_PEERS 20 // ESP-NOW peer list size (ESP_NOW_MAX_TOTAL_PEER_NUM)
+#define SIM_WAKE_LATENCY_US 450 // Light sleep wake latency, until set
+#define SIM_WAKE_JITTER_US 50 // Light sleep wake latency varies this much either way
+#define SIM_TASK_WAKE_US 8    // Notification to the task running, including a yield to the other core
+#define SIM_RADIO_SEND_US 40  // esp_now_send(): frame copy and hand-off to the Wi-Fi task
+#define SIM_MATRIX_ROW_US 1   // Drawing one row into the frame (glyph lookup and setRow())
+#define SIM_SPI_QUEUE_US 12   // spi_device_queue_trans() for one display transaction
+#define SIM_SPI_CLOCK_HZ 10000000 // Display SPI clock, MATRIX_SPI_CLOCK
+
+class SimMatrix;
+struct SimNode;
+
+// Radio model for every link. Frames go up from the start unit (the unit
+// named "bottom") to the top units and down the other way; the latencies
+// differ for an asymmetric link.
+typedef struct {
+  int64_t latencyUs;   // Send to receive callback, going up (and down unless downLatencyUs is set)
+  int64_t jitterUs;    // Uniformly distributed extra latency
+  double lossRatio;    // Probability a frame is lost (the sender sees a failed delivery)
+  int rssiDbm;         // Signal strength of received frames, give or take SIM_RSSI_SPREAD
+  int64_t downLatencyUs = -1;  // Send to receive callback going down, -1 = latencyUs
+} SimRadioProfile;
+
+// Function to seed the simulator's random numbers (radio jitter and loss, esp_random)
+void simSeed(uint32_t seed);
+
+// Function to set the radio model
+void simSetRadio(const SimRadioProfile &profile);
+
+// Function to set the light sleep wake latency, from a wake pin reaching its
+// level to halLightSleep() returning
+void simSetWakeLatency(int64_t us);
+
+// Function to add a unit running a sketch, it boots at the current time
+// A unit with the MAC of one that was powered off is the same board booting
+// again: it keeps that unit's flash and settings
+SimNode *simAddNode(const char *name, const uint8_t *mac, void (*setup)(), void (*loop)());
+
+// Function to cut a unit's power: its tasks, timers and radio stop for good
+void simPowerOff(SimNode *node);
+
+// Function to cut a unit's power partway through its flash work: once the
+// given number of bytes more have been programmed or erased, the write or
+// erase under way stops there and fails, and so does every one after it
+// until the cut is lifted with -1. An erase clears its range from the start.
+void simStorageCut(SimNode *node, int64_t bytes);
+
+// Function to make the HAL calls of code run from a scenario, outside any
+// task, act on the given unit, so a module can be driven directly
+void simActAs(SimNode *node);
+
+// Function to set a unit's clock against true time: local = true + offset + true * drift
+void simSetClock(SimNode *node, int64_t offsetUs, double driftPpm);
+
+// Function to change a unit's clock drift from now on, without a step in its clock
+void simSetDrift(SimNode *node, double driftPpm);
+
+// Function to start every unit's clock at the given reading instead of zero,
+// as if the units had been powered that long (microseconds)
+void simSetUptime(int64_t us);
+
+// Function to change an input pin at a given true time, firing any attached interrupt
+void simSetPin(SimNode *node, uint8_t pin, int level, int64_t atUs);
+
+// Function to run until the given true time
+void simRun(int64_t untilUs);
+
+// Function to spend CPU time in the running task (simulated HAL and devices);
+// outside a task it does nothing, as interrupts and callbacks take no time
+void simSpendCpu(int64_t us);
+
+// Function to block the running task until a true time, leaving its core to
+// other tasks (e.g. while DMA finishes a transfer)
+void simWaitUntil(int64_t atUs);
+
+// Function to read the true time
+int64_t simNow();
+
+// Function to read the true time a unit brought up its radio (halRadioBegin), -1 if not yet
+int64_t simRadioUpTime(SimNode *node);
+
+// Function to read how many peers a unit has in its ESP-NOW peer list
+int simRadioPeerCount(SimNode *node);
+
+// Function to check whether a MAC is in a unit's ESP-NOW peer list
+bool simRadioIsPeer(SimNode *node, const uint8_t *mac);
+
+// Function to read a unit's local clock at the current true time
+int64_t simLocalTime(SimNode *node);
+
+// Function to read the true time a unit has spent in light sleep
+int64_t simSleepTime(SimNode *node);
+
+// Function to read the true time a unit went into the light sleep it is in, -1 if awake
+int64_t simSleepingSince(SimNode *node);
+
+// Function to read the true times of the pin change that last woke a unit
+// from light sleep and of its waking, -1 if none has
+void simLastPinWake(SimNode *node, int64_t *edgeUs, int64_t *wokeUs);
+
+// Function to read what a unit's display shows, e.g. " 7.43"
+// Digits are decoded from the glyph tables; '?' marks a panel showing anything else
+std::string simDisplayText(SimNode *node);
+
+// Function to read an LED channel's PWM duty, or a digital output's level
+int simLedValue(SimNode *node, uint8_t pin);
+
+// Function to show or hide the units' Serial output
+void simSetVerbose(bool verbose);
+
+// Function to forget the latency probes hit so far (HalProbe in hal.h)
+void simClearProbes();
+
+// Function to read the true time a probe was first hit since simClearProbes(), -1 if not yet
+int64_t simProbeTime(int probe);
+
+// Used by SimMatrix::begin() to attach itself to the running unit
+void simAttachMatrix(SimMatrix *matrix);
+
+#endif
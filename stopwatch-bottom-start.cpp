@@ -1,10 +1,13 @@
-#include <esp_now.h>
-#include <WiFi.h>
-#include <esp_wifi.h>
-
-// Device MAC addresses
-uint8_t topDeviceMAC[] = {0xFC, 0xB4, 0x67, 0x4E, 0x7E, 0x38}; // Top device MAC
-uint8_t bottomDeviceMAC[] = {0xFC, 0xB4, 0x67, 0x4E, 0x7D, 0x58}; // This device MAC
+#include "hal.h"
+#include "clock-sync.h"
+#include "peer-table.h"
+#include "wire-protocol.h"
+#include "event-queue.h"
+#include "trace-buffer.h"
+#include "deferred-log.h"
+#include "pad-filter.h"
+#include "start-sequence.h"
+#include "low-power.h"
 
 // Pin definitions
 #define BUTTON_PAD_PIN 33    // Button pad (two metal pads)
@@ -12,31 +15,91 @@ uint8_t bottomDeviceMAC[] = {0xFC, 0xB4, 0x67, 0x4E, 0x7D, 0x58}; // This device
 #define LED_RED_PIN 19       // RGB LED Red
 #define LED_GREEN_PIN 23     // RGB LED Green  
 #define LED_BLUE_PIN 18      // RGB LED Blue
+#define CUE_PIN 26           // Start cue buzzer or strobe driver, active high
+
+// Serial output is queued for the UART driver, so startup text doesn't hold up the boot
+#define SERIAL_TX_BUFFER 1024
+
+// Log drain task, Serial output never holds up the loop or the radio callbacks
+#define LOG_CORE 0
+#define LOG_PRIORITY 1
+#define LOG_STACK_SIZE 4096
 
-// Button variables
-unsigned long lastDebounceTime = 0;
-unsigned long resetLastDebounceTime = 0;
-unsigned long debounceDelay = 5; // 50ms debounce delay for better responsiveness
-byte buttonState = HIGH;
-byte lastButtonState = HIGH;
+// Reset button variables
+int64_t resetLastDebounceTime = 0;
+int64_t debounceDelay = 5000; // 5ms debounce delay for better responsiveness (microseconds)
 byte resetButtonState = HIGH;
 byte lastResetButtonState = HIGH;
 
+// Button pad, conditioned by pad-filter.h; its interrupt wakes loop()
+PadFilter startPad;
+PadCommand padCommand;
+TaskHandle_t loopTaskHandle = NULL;
+const uint32_t LOOP_INTERVAL = 10;  // Longest loop() sleep, for the reset button and retransmits (ms)
+int64_t releaseEdgeTime = 0;        // Validated pad release edge (microseconds)
+
+// Start sequence for competition runs (start-sequence.h), turned on over Serial;
+// its timer callback runs on the other core, cueMux guards the sequence
+StartSequence startSequence;
+StartCommand startCommand;
+HalTimer cueTimer = NULL;
+portMUX_TYPE cueMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Low power mode (low-power.h), turned on over Serial; the unit light sleeps
+// between the top units' pings while nothing needs it awake
+LowPower lowPower;
+int64_t lastActivityTime = 0;             // Last pad press or release, reset or lane result
+volatile int framesInFlight = 0;          // Sent and not yet confirmed by the send callback
+portMUX_TYPE radioMux = portMUX_INITIALIZER_UNLOCKED;
+
 // LED states
-enum LEDState { LED_OFF, LED_WHITE, LED_ORANGE };
+enum LEDState { LED_OFF, LED_WHITE, LED_ORANGE, LED_RED };
 LEDState currentLEDState = LED_OFF;
 
-// Communication message types
+// Messages waiting for the log drain task
+DeferredLog eventLog;
+
+// Boot-to-ready time, from power-up until a start can be sent (microseconds)
+int64_t bootReadyUs = 0;
+
+// Top units by lane, with clock synchronisation against each
+PeerTable peers;
+const int64_t CONNECTION_TIMEOUT_US = 3000000; // Lane counts as connected for 3 seconds after a message
+bool lanesChanged = false;                     // A unit was paired, loop() saves the table
+
+// Received messages, handed from the Wi-Fi task to loop()
 typedef struct {
-  int messageType; // 1 = start signal, 2 = reset signal, 3 = ping, 4 = pong
-  unsigned long timestamp;
-} Message;
+  Message msg;
+  int64_t rxTime;   // esp_timer time the callback ran (microseconds)
+  uint8_t mac[6];
+  int rssi;         // Of the frame (dBm)
+  bool firstInFrame;
+} RadioEvent;
+
+EventQueue<RadioEvent, 16> radioEvents;
+
+// Current race - lanes started together, decided on our clock
+uint32_t raceSequence = 0;   // Sequence number of the start signal
+int64_t raceStartEdge = 0;   // Pad release edge or start cue (microseconds)
+uint8_t raceLanes = 0;       // Lanes taking part, 0 after a reset
+
+// Reliable delivery of start/reset signals
+const int64_t RETRY_INTERVAL_US = 20000; // Retransmit an unacknowledged signal every 20ms
+const int MAX_RETRIES = 8;                // Give up after this many retransmits
+uint32_t nextSequence = 0;
+Message pendingMsg;                      // Last start/reset signal, kept until acknowledged
+Message pendingVerdict;                  // Start verdict sent with it, messageType 0 if none
+volatile uint8_t pendingLanes = 0;       // Lanes that haven't acknowledged it yet
+volatile bool sendFailed = false;        // MAC-level delivery failure, retry straight away
+int retryCount = 0;
+int64_t lastSendTime = 0;
+int64_t firstSendTime = 0;
 
 // Function to set RGB LED color
 void setLEDColor(int red, int green, int blue) {
-  analogWrite(LED_RED_PIN, red);
-  analogWrite(LED_GREEN_PIN, green);
-  analogWrite(LED_BLUE_PIN, blue);
+  halLedWrite(LED_RED_PIN, red);
+  halLedWrite(LED_GREEN_PIN, green);
+  halLedWrite(LED_BLUE_PIN, blue);
 }
 
 // Function to turn LED off
@@ -57,38 +120,175 @@ void setLEDOrange() {
   currentLEDState = LED_ORANGE;
 }
 
+// Function to set LED to red, for a false start
+void setLEDRed() {
+  setLEDColor(255, 0, 0);
+  currentLEDState = LED_RED;
+}
+
+// Interrupt handler for the button pad - stamps every edge through the glitch
+// filter, checkButtonPad() decides once the pad has settled
+void IRAM_ATTR onPadEdge() {
+  padFilterEdge(startPad, halMicros(), halDigitalRead(BUTTON_PAD_PIN));
+  halProbe(PROBE_PAD_EDGE);
+
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(loopTaskHandle, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
 // Function to handle button pad events
+// On a release event the edge time is available in releaseEdgeTime
 byte checkButtonPad() {
-  byte reading = digitalRead(BUTTON_PAD_PIN);
+  PadEvent event = padFilterUpdate(startPad, halMicros(), halDigitalRead(BUTTON_PAD_PIN));
+  if (event == PAD_NONE) {
+    return 0; // No event
+  }
+  if (event == PAD_GLITCH) {
+    logEvent(eventLog, LOG_PAD_GLITCH, startPad.lastEdges, startPad.lastSettleUs);
+    return 0;
+  }
+
+  logEvent(eventLog, LOG_PAD_SETTLED, startPad.level, startPad.lastEdges, startPad.lastSettleUs);
+  if (event == PAD_PRESSED) {
+    return 1; // Pressed (climber stepped on pad)
+  }
+  releaseEdgeTime = startPad.eventTime;
+  halProbe(PROBE_DEBOUNCED);
+  return 2; // Released (climber released pad to start climbing)
+}
+
+// Function to work out how long loop() may sleep: until the pad can be
+// decided, but no longer than LOOP_INTERVAL
+TickType_t loopSleepTicks() {
+  int64_t dueUs = padFilterDueIn(startPad, halMicros());
+  if (dueUs < 0) return pdMS_TO_TICKS(LOOP_INTERVAL);
+  return pdMS_TO_TICKS(max((int64_t)1, min((dueUs + 999) / 1000, (int64_t)LOOP_INTERVAL)));
+}
 
-  if (reading != lastButtonState) {
-    lastDebounceTime = millis();
+// Function to print the link statistics of each lane (link-stats.h)
+void printLinkStats() {
+  for (uint8_t lane = 1; lane <= MAX_LANES; lane++) {
+    LanePeer *peer = peerTableLane(peers, lane);
+    if (peer == NULL) continue;
+    char name[16];
+    snprintf(name, sizeof(name), "Lane %d", lane);
+    linkStatsPrint(peer->link, name);
+    Serial.printf("  pinged every %lld ms\n", (long long)(peer->pingIntervalUs / 1000));
   }
+}
 
-  if ((millis() - lastDebounceTime) > debounceDelay) {
-    if (reading != buttonState) {
-      buttonState = reading;
-      if (buttonState == LOW) {
-        return 1; // Pressed (climber stepped on pad)
-      } else {
-        return 2; // Released (climber released pad to start climbing)
-      }
-    }
+// Cue timer callback (esp_timer task) - switches the cue output for the next
+// step of the start sequence; the cue is stamped as its output goes on
+void onCueTimer(void *) {
+  bool on;
+  int64_t next;
+  portENTER_CRITICAL(&cueMux);
+  if (startSequenceStep(startSequence, halMicros(), on, next)) {
+    halDigitalWrite(CUE_PIN, on ? HIGH : LOW);
   }
+  portEXIT_CRITICAL(&cueMux);
+  if (next > 0) halTimerStartOnce(cueTimer, next - halMicros());
+}
 
-  lastButtonState = reading;
-  return 0; // No event
+// Function to arm the start sequence when the climber steps on the pad
+void armStartSequence(int64_t pressEdge) {
+  portENTER_CRITICAL(&cueMux);
+  int64_t due = startSequenceArm(startSequence, pressEdge);
+  portEXIT_CRITICAL(&cueMux);
+  halTimerStartOnce(cueTimer, due - halMicros());
+  logEvent(eventLog, LOG_START_ARMED, (pressEdge + startCueSteps[START_CUE_STEP].atUs - halMicros()) / 1000000.0);
+}
+
+// Function to stop the start sequence and silence the cue
+void cancelStartSequence() {
+  portENTER_CRITICAL(&cueMux);
+  startSequenceCancel(startSequence);
+  halDigitalWrite(CUE_PIN, LOW);
+  portEXIT_CRITICAL(&cueMux);
+  halTimerStop(cueTimer);
+}
+
+// Function to check whether a race is under way: a lane that hasn't
+// finished, up to SLEEP_RACE_AWAKE_US after the start
+bool raceUnderWay(int64_t now) {
+  if (raceLanes == 0 || now - raceStartEdge >= SLEEP_RACE_AWAKE_US) return false;
+  for (uint8_t lane = 1; lane <= MAX_LANES; lane++) {
+    if ((raceLanes & LANE_BIT(lane)) && !peers.lanes[lane - 1].finished) return true;
+  }
+  return false;
+}
+
+// Function to check that nothing needs the unit awake: both pads up and
+// settled, no signal waiting for its ack or frame still going out, no
+// received message waiting, no start sequence playing, no race under way, and SLEEP_AWAKE_HOLD_US since the
+// last pad press, reset or lane result
+bool unitIdle(int64_t now) {
+  if (startPad.level != HIGH || padFilterDueIn(startPad, now) >= 0 || halDigitalRead(BUTTON_PAD_PIN) != HIGH) return false;
+  if (resetButtonState != HIGH || halDigitalRead(RESET_BUTTON_PIN) != HIGH) return false;
+  if (pendingLanes != 0 || framesInFlight > 0 || startSequence.armed || lanesChanged) return false;
+  if (queueDepth(radioEvents) > 0) return false;
+  return now - lastActivityTime >= SLEEP_AWAKE_HOLD_US && !raceUnderWay(now);
+}
+
+// Function to light sleep in low power mode until the next ping is due, if
+// the unit is idle; the pad or the reset button wakes it sooner
+// Returns false if it stays awake
+bool sleepIfIdle() {
+  if (!lowPower.enabled) return false;
+  int64_t now = halMicros();
+  if (!unitIdle(now)) return false;
+  int64_t wake = lowPowerPlan(lowPower, peers, now, CONNECTION_TIMEOUT_US);
+  if (wake - now < SLEEP_MIN_US) return false;
+
+  if (currentLEDState != LED_OFF) turnLEDOff();  // The LED PWM stops in light sleep
+  HalWakeCause cause = halLightSleep(wake - now);
+  int64_t woke = halMicros();
+  lowPowerSlept(lowPower, woke - now, cause);
+
+  // A pad press that woke the unit never reached the pad interrupt, stamp it
+  // from the wake; the reset button is polled, so its wakes need nothing
+  if (cause == HAL_WAKE_PIN && halDigitalRead(BUTTON_PAD_PIN) == LOW) {
+    padFilterMissedEdge(startPad, woke - HAL_WAKE_LATENCY_US, LOW);
+    lowPower.padWakes++;
+  }
+  return true;
+}
+
+// Function to act on commands from Serial: t dumps the trace buffer, l
+// prints the link statistics, the others set up the start sequence (start-sequence.h),
+// low power mode (low-power.h) or tune the pad (pad-filter.h), and changed settings are saved
+void serviceSerialCommands() {
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if (c == 't') {
+      TRACE_DUMP();
+    } else if (c == 'l') {
+      printLinkStats();
+    } else if (startSequenceCommand(startSequence, startCommand, c)) {
+      uint8_t enabled = startSequence.enabled;
+      uint32_t falseStartUs = startSequence.falseStartUs;
+      halConfigWrite("sequence", &enabled, sizeof(enabled));
+      halConfigWrite("falsestart", &falseStartUs, sizeof(falseStartUs));
+    } else if (lowPowerCommand(lowPower, c, halMicros())) {
+      uint8_t enabled = lowPower.enabled;
+      halConfigWrite("lowpower", &enabled, sizeof(enabled));
+    } else if (padFilterCommand(startPad, padCommand, c, "Start pad")) {
+      uint32_t settleUs = startPad.settleUs;
+      halConfigWrite("settle", &settleUs, sizeof(settleUs));
+    }
+  }
 }
 
 // Function to handle reset button events
 byte checkResetButton() {
-  byte reading = digitalRead(RESET_BUTTON_PIN);
+  byte reading = halDigitalRead(RESET_BUTTON_PIN);
 
   if (reading != lastResetButtonState) {
-    resetLastDebounceTime = millis();
+    resetLastDebounceTime = halMicros();
   }
 
-  if ((millis() - resetLastDebounceTime) > debounceDelay) {
+  if ((halMicros() - resetLastDebounceTime) > debounceDelay) {
     if (reading != resetButtonState) {
       resetButtonState = reading;
       if (resetButtonState == LOW) {
@@ -102,170 +302,535 @@ byte checkResetButton() {
 }
 
 // Callback function for ESP-NOW send status
-void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status) {
-  Serial.print("Last Packet Send Status: ");
-  if (status == ESP_NOW_SEND_SUCCESS) {
-    Serial.println("Delivery Success");
+void OnDataSent(const uint8_t *mac_addr, bool delivered) {
+  portENTER_CRITICAL(&radioMux);
+  if (framesInFlight > 0) framesInFlight--;
+  bool allSent = framesInFlight == 0;
+  portEXIT_CRITICAL(&radioMux);
+  if (allSent && lowPower.enabled) xTaskNotifyGive(loopTaskHandle); // Back to sleep once the pong is out
+  if (delivered) {
+    logEvent(eventLog, LOG_DELIVERY_SUCCESS);
   } else {
-    Serial.println("Delivery Fail");
+    logEvent(eventLog, LOG_DELIVERY_FAIL);
+    LanePeer *peer = peerTableFind(peers, mac_addr);
+    if (peer != NULL) peer->link.sendFailures++;
+    if (pendingLanes != 0) {
+      sendFailed = true;
+    }
+  }
+}
+
+// Function to record a lane's stop edge, and decide the race once every lane has finished
+void recordLaneResult(LanePeer &peer, uint32_t sequence, int64_t stopEdgeTime) {
+  // Ignore results from an earlier race, lanes not in this one and repeats
+  if (sequence != raceSequence || !(raceLanes & LANE_BIT(peer.lane)) || peer.finished) return;
+  peer.finished = true;
+  peer.stopEdgeTime = stopEdgeTime;
+  lastActivityTime = halMicros();
+
+  // Place among the lanes finished so far, and the winner once all have
+  int place = 1;
+  bool allFinished = true;
+  LanePeer *winner = NULL;
+  LanePeer *second = NULL;
+  for (uint8_t lane = 1; lane <= MAX_LANES; lane++) {
+    LanePeer *other = peerTableLane(peers, lane);
+    if (other == NULL || !(raceLanes & LANE_BIT(lane))) continue;
+    if (!other->finished) {
+      allFinished = false;
+      continue;
+    }
+    if (other != &peer && other->stopEdgeTime < stopEdgeTime) place++;
+    if (winner == NULL || other->stopEdgeTime < winner->stopEdgeTime) {
+      second = winner;
+      winner = other;
+    } else if (second == NULL || other->stopEdgeTime < second->stopEdgeTime) {
+      second = other;
+    }
+  }
+
+  logEvent(eventLog, LOG_LANE_FINISHED, peer.lane, (stopEdgeTime - raceStartEdge) / 1000000.0, place);
+  if (allFinished && second != NULL) {
+    logEvent(eventLog, LOG_RACE_WON, winner->lane, (second->stopEdgeTime - winner->stopEdgeTime) / 1000000.0);
+  }
+}
+
+// Function to save the top unit of each lane, so they reconnect without discovery after a reboot
+void saveLanes() {
+  uint8_t macs[MAX_LANES][6];
+  memset(macs, 0, sizeof(macs));
+  for (uint8_t lane = 1; lane <= MAX_LANES; lane++) {
+    LanePeer *peer = peerTableLane(peers, lane);
+    if (peer != NULL) memcpy(macs[lane - 1], peer->mac, 6);
+  }
+  halConfigWrite("lanes", macs, sizeof(macs));
+}
+
+// Function to give a top unit that is looking for a start unit a lane: the
+// first free one, or else one whose unit hasn't been heard from since we booted
+// Returns NULL if every lane is in use
+LanePeer *pairTopUnit(const uint8_t *mac) {
+  uint8_t lane = LANE_NONE;
+  for (uint8_t l = 1; l <= MAX_LANES && lane == LANE_NONE; l++) {
+    if (peerTableLane(peers, l) == NULL) lane = l;
+  }
+  for (uint8_t l = 1; l <= MAX_LANES && lane == LANE_NONE; l++) {
+    if (!peers.lanes[l - 1].heard) lane = l;
+  }
+  if (lane == LANE_NONE) {
+    logEvent(eventLog, LOG_NO_FREE_LANE);
+    return NULL;
   }
+
+  // The unit the lane is taken from gives up its ESP-NOW peer, which holds at most 20
+  LanePeer *old = peerTableLane(peers, lane);
+  if (old != NULL) halRadioRemovePeer(old->mac);
+  if (!halRadioAddPeer(mac)) {
+    if (old != NULL) halRadioAddPeer(old->mac);
+    logEvent(eventLog, LOG_NO_FREE_LANE);
+    return NULL;
+  }
+
+  LanePeer *peer = peerTableAdd(peers, mac, lane);
+  lanesChanged = true;
+  logEvent(eventLog, LOG_LANE_PAIRED, lane);
+  return peer;
+}
+
+// Function to send a batch of events as one frame, to one lane or broadcast to all (peer NULL)
+// A frame to one lane also echoes its last frame, for its clock synchronisation
+bool sendFrame(const LanePeer *peer, WireBatch &batch) {
+  batch.lane = peer != NULL ? peer->lane : LANE_NONE;
+  batch.timestamp = halMicros();
+  batch.echoTime = peer != NULL ? peer->lastPeerTxTime : 0;
+  batch.recvTime = peer != NULL ? peer->lastPeerRxTime : 0;
+  uint8_t frame[WIRE_MAX_FRAME];
+  size_t len = wireEncode(batch, frame);
+  if (!halRadioSend(peer != NULL ? peer->mac : BROADCAST_MAC, frame, len)) return false;
+  portENTER_CRITICAL(&radioMux);
+  framesInFlight++;
+  portEXIT_CRITICAL(&radioMux);
+  return true;
+}
+
+// Function to handle a received message from a top unit (loop task)
+// Replies are added to the batch going back in one frame, returns the unit they go to, NULL if none
+LanePeer *processRadioEvent(const RadioEvent &ev, WireBatch &replies) {
+  const Message &msg = ev.msg;
+  int64_t rxTime = ev.rxTime;
+  if (ev.firstInFrame) logEvent(eventLog, LOG_MESSAGE_FROM, ev.mac[0], ev.mac[1], ev.mac[2], ev.mac[3], ev.mac[4], ev.mac[5]);
+
+  LanePeer *peer = peerTableFind(peers, ev.mac);
+  if (peer == NULL) {
+    // A unit we don't know gets a lane if it is looking for a start unit
+    if (msg.messageType == 7) peer = pairTopUnit(ev.mac);
+    if (peer == NULL) {
+      logEvent(eventLog, LOG_UNKNOWN_UNIT);
+      return NULL;
+    }
+  }
+  if (ev.firstInFrame) {
+    peer->heard = true;
+    peer->lastSeen = rxTime;
+    linkStatsFrame(peer->link, ev.rssi, msg.echoTime, msg.recvTime, msg.timestamp, rxTime);
+  }
+
+  if (msg.messageType == 3 || msg.messageType == 7) { // Ping or discovery received
+    logEvent(eventLog, LOG_PING_RECEIVED);
+    linkStatsPingSeen(peer->link, msg.sequence);
+    peer->pingIntervalUs = msg.edgeTime;
+    peer->lastPingTime = rxTime;
+    // The ping echoes our last frame to the top unit, which gives us a sample too
+    clockSyncAddSample(peer->clockSync, msg.echoTime, msg.recvTime, msg.timestamp, rxTime);
+    // Pong response with the ping's number, its frame also tells the top unit its lane
+    wireBatchAdd(replies, 4, msg.sequence, 0, 0);
+  } else if (msg.messageType == 5) { // Ack received
+    if ((pendingLanes & LANE_BIT(peer->lane)) && msg.sequence == pendingMsg.sequence) {
+      pendingLanes &= ~LANE_BIT(peer->lane);
+      if (pendingMsg.messageType == 1) halProbe(PROBE_START_ACKED);
+      logEvent(eventLog, LOG_SIGNAL_ACKED, msg.sequence, peer->lane, rxTime - firstSendTime, retryCount);
+    }
+  } else if (msg.messageType == 6) { // Lane result
+    // Acknowledge every copy, the top unit retransmits until it hears one
+    wireBatchAdd(replies, 5, msg.sequence, 0, 0);
+    recordLaneResult(*peer, msg.sequence, msg.edgeTime);
+  }
+
+  peer->lastPeerTxTime = msg.timestamp;
+  peer->lastPeerRxTime = rxTime;
+  return peer;
+}
+
+// Function to process everything the receive callback has queued; replies
+// to the events of one frame go back together in one frame
+void drainRadioEvents() {
+  RadioEvent ev;
+  WireBatch replies;
+  wireBatchClear(replies);
+  LanePeer *replyTo = NULL;
+  while (queuePop(radioEvents, ev)) {
+    if (ev.firstInFrame && replies.count > 0) {
+      sendFrame(replyTo, replies);
+      wireBatchClear(replies);
+    }
+    LanePeer *peer = processRadioEvent(ev, replies);
+    if (peer != NULL) replyTo = peer;
+  }
+  if (replies.count > 0) sendFrame(replyTo, replies);
 }
 
 // Callback function for receiving ESP-NOW data
-void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
-  Message msg;
-  memcpy(&msg, incomingData, sizeof(msg));
-  
-  Serial.print("Message received from: ");
-  for (int i = 0; i < 6; i++) {
-    Serial.printf("%02X", mac[i]);
-    if (i < 5) Serial.print(":");
+// Runs in the Wi-Fi task: only timestamp and queue the message, loop() does the rest
+void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len, int rssi) {
+  int64_t rxTime = halMicros();
+  WireBatch batch;
+  WireStatus status = wireDecode(incomingData, len, batch);
+  TRACE_BEGIN(TRACE_RADIO_RECEIVE, batch.count > 0 ? batch.events[0].messageType : 0);
+  if (status != WIRE_OK) {
+    logEvent(eventLog, LOG_BAD_FRAME, status, len);
+    TRACE_END(TRACE_RADIO_RECEIVE);
+    return;
   }
-  Serial.println();
-  
-  if (msg.messageType == 3) { // Ping received
-    Serial.println("Ping received - Sending pong");
-    // Send pong response
-    Message pongMsg;
-    pongMsg.messageType = 4;
-    pongMsg.timestamp = millis();
-    esp_now_send(topDeviceMAC, (uint8_t *) &pongMsg, sizeof(pongMsg));
+
+  // One radio event per event in the frame
+  RadioEvent ev;
+  ev.rxTime = rxTime;
+  memcpy(ev.mac, mac, 6);
+  ev.rssi = rssi;
+  for (int i = 0; i < batch.count; i++) {
+    ev.msg = batch.events[i];
+    ev.firstInFrame = i == 0;
+    queuePush(radioEvents, ev);
   }
+  xTaskNotifyGive(loopTaskHandle);
+  TRACE_END(TRACE_RADIO_RECEIVE);
 }
 
-// Function to send start signal to top device
-void sendStartSignal() {
-  Message msg;
-  msg.messageType = 1; // Start signal
-  msg.timestamp = millis();
-  
-  esp_err_t result = esp_now_send(topDeviceMAC, (uint8_t *) &msg, sizeof(msg));
+// Function to (re)transmit the pending start/reset signal, to one lane or
+// broadcast to all (peer NULL)
+// Retransmits keep the sequence number and edge time, only the send time is refreshed
+bool transmitPending(const LanePeer *peer) {
+  WireBatch batch;
+  wireBatchClear(batch);
+  wireBatchAdd(batch, pendingMsg.messageType, pendingMsg.sequence, pendingMsg.edgeTime, pendingMsg.laneMask);
+  if (pendingVerdict.messageType != 0) {
+    wireBatchAdd(batch, pendingVerdict.messageType, pendingVerdict.sequence, pendingVerdict.edgeTime, pendingVerdict.laneMask);
+  }
+  lastSendTime = halMicros();
+  return sendFrame(peer, batch);
+}
+
+// Function to choose the lanes a start/reset goes to: those connected, or
+// every lane with a unit if none has been heard from
+uint8_t signalLanes() {
+  uint8_t lanes = peerTableConnected(peers, halMicros(), CONNECTION_TIMEOUT_US);
+  return lanes != 0 ? lanes : peers.configured;
+}
+
+// Function to queue a start/reset signal for reliable delivery, with the
+// start sequence's verdict (NULL if none) riding along in the same frame
+// A new signal replaces one that is still waiting for its ack. It goes out as
+// one frame: a broadcast reaches every lane at once, a single lane is sent
+// unicast to keep the MAC-level retries
+bool sendReliable(int messageType, int64_t edgeTime, uint8_t laneMask, const StartVerdict *verdict) {
+  pendingMsg.messageType = messageType;
+  pendingMsg.sequence = ++nextSequence;
+  pendingMsg.edgeTime = edgeTime;
+  pendingMsg.laneMask = laneMask;
+  pendingVerdict.messageType = 0;
+  if (verdict != NULL) {
+    pendingVerdict.messageType = 8;
+    pendingVerdict.sequence = pendingMsg.sequence;
+    pendingVerdict.edgeTime = verdict->reactionUs;
+    pendingVerdict.laneMask = verdict->falseStart ? 1 : 0;
+  }
+  retryCount = 0;
+  sendFailed = false;
+  pendingLanes = laneMask;
+  firstSendTime = halMicros();
+
+  const LanePeer *only = NULL;
+  for (uint8_t lane = 1; lane <= MAX_LANES; lane++) {
+    if (laneMask == LANE_BIT(lane)) only = peerTableLane(peers, lane);
+  }
+  return transmitPending(only);
+}
+
+// Function to retransmit the pending signal to each lane until it is acknowledged
+void serviceRetransmit() {
+  uint8_t lanes = pendingLanes;
+  if (lanes == 0) return;
+  if (!sendFailed && halMicros() - lastSendTime < RETRY_INTERVAL_US) return;
+
+  if (retryCount >= MAX_RETRIES) {
+    pendingLanes = 0;
+    logEvent(eventLog, LOG_SIGNAL_GAVE_UP, pendingMsg.sequence, lanes);
+    return;
+  }
+
+  sendFailed = false;
+  retryCount++;
+  logEvent(eventLog, LOG_RETRANSMIT, pendingMsg.sequence, retryCount);
+  for (uint8_t lane = 1; lane <= MAX_LANES; lane++) {
+    LanePeer *peer = peerTableLane(peers, lane);
+    if (peer != NULL && (lanes & LANE_BIT(lane))) {
+      peer->link.retransmits++;
+      transmitPending(peer);
+    }
+  }
+}
+
+// Function to start every connected lane
+// edgeTime is the pad release edge or the start cue, so the top units can
+// remove the send delay; verdict is the start sequence's, NULL without one
+void sendStartSignal(int64_t edgeTime, const StartVerdict *verdict) {
+  uint8_t lanes = signalLanes();
+  bool result = sendReliable(1, edgeTime, lanes, verdict); // Start signal
+  halProbe(PROBE_RADIO_SEND);
+
+  // New race, decided on our clock from the same edge
+  raceSequence = pendingMsg.sequence;
+  raceStartEdge = edgeTime;
+  raceLanes = lanes;
+  for (int i = 0; i < MAX_LANES; i++) {
+    peers.lanes[i].finished = false;
+  }
   
-  if (result == ESP_OK) {
-    Serial.println("Start signal sent successfully");
+  if (result) {
+    logEvent(eventLog, LOG_START_SENT);
   } else {
-    Serial.println("Error sending start signal");
+    logEvent(eventLog, LOG_START_SEND_FAILED);
   }
 }
 
-// Function to send reset signal to top device
+// Function to tell the lanes a climber is on the start pad, so they ping more
+// often until the run is over; a hint, sent once and not acknowledged
+void sendReadySignal() {
+  WireBatch batch;
+  wireBatchClear(batch);
+  wireBatchAdd(batch, 9, 0, 0, signalLanes());
+  sendFrame(NULL, batch);
+}
+
+// Function to send reset signal to the top units
 void sendResetSignal() {
-  Message msg;
-  msg.messageType = 2; // Reset signal
-  msg.timestamp = millis();
-  
-  esp_err_t result = esp_now_send(topDeviceMAC, (uint8_t *) &msg, sizeof(msg));
+  raceLanes = 0;
+  bool result = sendReliable(2, 0, signalLanes(), NULL); // Reset signal
   
-  if (result == ESP_OK) {
-    Serial.println("Reset signal sent successfully");
+  if (result) {
+    logEvent(eventLog, LOG_RESET_SENT);
   } else {
-    Serial.println("Error sending reset signal");
+    logEvent(eventLog, LOG_RESET_SEND_FAILED);
+  }
+}
+
+// Function to start the run when the climber leaves the pad, judged against
+// the cue when the start sequence is on
+void startRun(int64_t releaseEdge) {
+  if (!startSequence.enabled) {
+    setLEDOrange();
+    sendStartSignal(releaseEdge, NULL);
+    return;
+  }
+
+  StartVerdict verdict;
+  portENTER_CRITICAL(&cueMux);
+  bool judged = startSequenceJudge(startSequence, releaseEdge, verdict);
+  bool cancelled = !startSequence.armed;
+  if (cancelled) halDigitalWrite(CUE_PIN, LOW); // A cue still to come, not one already sounding
+  portEXIT_CRITICAL(&cueMux);
+  if (cancelled) halTimerStop(cueTimer);
+
+  if (!judged) {
+    logEvent(eventLog, LOG_START_ABORTED);
+    turnLEDOff();
+    return;
+  }
+  if (verdict.falseStart) {
+    logEvent(eventLog, LOG_FALSE_START, verdict.reactionUs / 1000000.0);
+    setLEDRed();
+  } else {
+    logEvent(eventLog, LOG_REACTION, verdict.reactionUs / 1000000.0);
+    setLEDOrange();
   }
+  sendStartSignal(verdict.startEdge, &verdict);
 }
 
 // Initialize ESP-NOW
 void initESPNow() {
   Serial.println("Initializing ESP-NOW...");
   
-  // Set device as a Wi-Fi Station
-  WiFi.mode(WIFI_STA);
-  Serial.print("WiFi MAC Address: ");
-  Serial.println(WiFi.macAddress());
-  
-  // Initialize ESP-NOW
-  if (esp_now_init() != ESP_OK) {
+  // Set device as a Wi-Fi Station and start ESP-NOW
+  if (!halRadioBegin(OnDataRecv, OnDataSent)) {
     Serial.println("ERROR: ESP-NOW initialization failed!");
     return;
   }
   Serial.println("ESP-NOW initialized successfully");
   
-  // Register send callback
-  esp_now_register_send_cb(OnDataSent);
-  Serial.println("Send callback registered");
-  
-  // Register receive callback
-  esp_now_register_recv_cb(OnDataRecv);
-  Serial.println("Receive callback registered");
+  uint8_t mac[6];
+  halRadioMacAddress(mac);
+  Serial.printf("WiFi MAC Address: %02X:%02X:%02X:%02X:%02X:%02X\n",
+                mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
   
-  // Add peer (top device)
-  esp_now_peer_info_t peerInfo = {};
-  memcpy(peerInfo.peer_addr, topDeviceMAC, 6);
-  peerInfo.channel = 0;
-  peerInfo.encrypt = false;
-  peerInfo.ifidx = WIFI_IF_STA;
-  
-  Serial.print("Adding peer with MAC: ");
-  for (int i = 0; i < 6; i++) {
-    Serial.printf("%02X", topDeviceMAC[i]);
-    if (i < 5) Serial.print(":");
+  // Add a peer for the top unit of each lane paired before
+  uint8_t topMACs[MAX_LANES][6];
+  if (!halConfigRead("lanes", topMACs, sizeof(topMACs))) {
+    memset(topMACs, 0, sizeof(topMACs));
   }
-  Serial.println();
-  
-  // Add peer
-  esp_err_t addStatus = esp_now_add_peer(&peerInfo);
-  if (addStatus != ESP_OK) {
-    Serial.print("Failed to add peer. Error: ");
-    Serial.println(addStatus);
+  static const uint8_t noMAC[6] = {0, 0, 0, 0, 0, 0};
+  for (uint8_t lane = 1; lane <= MAX_LANES; lane++) {
+    const uint8_t *topMAC = topMACs[lane - 1];
+    if (memcmp(topMAC, noMAC, 6) == 0) continue;
+
+    Serial.printf("Adding lane %d peer with MAC: ", lane);
+    for (int i = 0; i < 6; i++) {
+      Serial.printf("%02X", topMAC[i]);
+      if (i < 5) Serial.print(":");
+    }
+    Serial.println();
+
+    if (!halRadioAddPeer(topMAC)) {
+      Serial.println("Failed to add peer.");
+      return;
+    }
+    peerTableAdd(peers, topMAC, lane);
+  }
+
+  // Starts and resets for several lanes go out as one broadcast
+  if (!halRadioAddPeer(BROADCAST_MAC)) {
+    Serial.println("Failed to add broadcast peer.");
     return;
   }
   
-  Serial.println("SUCCESS: Peer added successfully!");
-  Serial.println("Bottom unit paired and ready!");
+  Serial.println("SUCCESS: Peers added successfully!");
+  Serial.println("New top units get the next free lane when they power up");
+
+  // Ping the paired top units, so one that came up first doesn't wait for its next ping
+  for (uint8_t lane = 1; lane <= MAX_LANES; lane++) {
+    LanePeer *peer = peerTableLane(peers, lane);
+    if (peer == NULL) continue;
+    WireBatch ping;
+    wireBatchClear(ping);
+    wireBatchAdd(ping, 3, 0, 0, 0);
+    sendFrame(peer, ping);
+  }
 }
 
-void setup() {
-  Serial.begin(115200);
-  delay(2000);
-  
+// Function to print what the unit does, once it is ready
+void printBanner() {
   Serial.println("Speed Climbing Stopwatch - Start Timer (Bottom Unit)");
   Serial.println("====================================================");
-  Serial.print("Device MAC: ");
-  for (int i = 0; i < 6; i++) {
-    Serial.printf("%02X", bottomDeviceMAC[i]);
-    if (i < 5) Serial.print(":");
+  Serial.println("Bottom unit ready!");
+  Serial.println("- Step on button pad to turn LED white");
+  Serial.println("- Release button pad to start timer (LED turns orange)");
+  Serial.println("- Press reset button to clear top display");
+  if (startSequence.enabled) {
+    Serial.println("- Start sequence on: leave the pad on the cue after two beeps");
+  }
+  if (lowPower.enabled) {
+    Serial.println("- Low power mode on: sleeps between runs, step on the pad to wake it");
   }
-  Serial.println();
+}
+
+// No fixed delays: the pad interrupt is armed first, and the unit is ready to
+// start a run as soon as the radio is up
+void setup() {
+  Serial.setTxBufferSize(SERIAL_TX_BUFFER);
+  Serial.begin(115200);
   
   // Initialize pins
-  pinMode(BUTTON_PAD_PIN, INPUT_PULLUP);
-  pinMode(RESET_BUTTON_PIN, INPUT_PULLUP);
-  pinMode(LED_RED_PIN, OUTPUT);
-  pinMode(LED_GREEN_PIN, OUTPUT);
-  pinMode(LED_BLUE_PIN, OUTPUT);
+  halPinMode(BUTTON_PAD_PIN, INPUT_PULLUP);
+  padFilterReset(startPad, halDigitalRead(BUTTON_PAD_PIN));
+  halConfigRead("settle", (void *)&startPad.settleUs, sizeof(startPad.settleUs));
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  if (!halAttachFilteredInterrupt(BUTTON_PAD_PIN, onPadEdge, PAD_GLITCH_NS)) {
+    Serial.println("ERROR: No pulse counter for the button pad");
+  }
+  halPinMode(RESET_BUTTON_PIN, INPUT_PULLUP);
+  halPinMode(LED_RED_PIN, OUTPUT);
+  halPinMode(LED_GREEN_PIN, OUTPUT);
+  halPinMode(LED_BLUE_PIN, OUTPUT);
+  halPinMode(CUE_PIN, OUTPUT);
+  halDigitalWrite(CUE_PIN, LOW);
+  cueTimer = halTimerCreate(onCueTimer, NULL, "cue");
+  uint8_t sequenceEnabled = 0;
+  if (halConfigRead("sequence", &sequenceEnabled, sizeof(sequenceEnabled))) {
+    startSequence.enabled = sequenceEnabled;
+  }
+  halConfigRead("falsestart", (void *)&startSequence.falseStartUs, sizeof(startSequence.falseStartUs));
+  uint8_t lowPowerEnabled = 0;
+  if (halConfigRead("lowpower", &lowPowerEnabled, sizeof(lowPowerEnabled))) {
+    lowPower.enabled = lowPowerEnabled;
+  }
+  lowPowerReset(lowPower, halMicros());
+  halSleepWakeOnPin(BUTTON_PAD_PIN, LOW);
+  halSleepWakeOnPin(RESET_BUTTON_PIN, LOW);
+  halSleepWakeOnSerial();
   
   // Turn off LED initially
   turnLEDOff();
+  peerTableReset(peers);
+  if (halDigitalRead(RESET_BUTTON_PIN) == LOW) {
+    Serial.println("Reset button held - forgetting the paired top units");
+    saveLanes();
+  }
+  // Random first sequence so the top unit doesn't mistake signals after a reboot for duplicates
+  nextSequence = esp_random();
   
   // Initialize ESP-NOW
   initESPNow();
-  
-  Serial.println("Bottom unit ready!");
-  Serial.println("- Step on button pad to turn LED white");
-  Serial.println("- Release button pad to start timer (LED turns orange)");
-  Serial.println("- Press reset button to clear top display");
+  bootReadyUs = halMicrosSinceBoot();
+
+  // Messages from here on go through the log drain task
+  xTaskCreatePinnedToCore(logDrainTask, "log", LOG_STACK_SIZE, &eventLog, LOG_PRIORITY, NULL, LOG_CORE);
+  logEvent(eventLog, LOG_BOOT_READY, bootReadyUs / 1000.0);
+  printBanner();
 }
 
 void loop() {
   // Check button pad events
+  TRACE_BEGIN(TRACE_CHECK_BUTTON, 0);
   byte padEvent = checkButtonPad();
+  TRACE_END(TRACE_CHECK_BUTTON);
   
+  if (padEvent != 0) lastActivityTime = halMicros();
   if (padEvent == 1) { // Climber stepped on pad
-    Serial.println("Climber stepped on pad - LED WHITE");
+    logEvent(eventLog, LOG_PAD_PRESSED);
     setLEDWhite();
+    if (startSequence.enabled) armStartSequence(startPad.eventTime);
+    sendReadySignal();
   } else if (padEvent == 2) { // Climber released pad to start climbing
-    Serial.println("Climber released pad - Starting timer, LED ORANGE");
-    setLEDOrange();
-    sendStartSignal();
+    logEvent(eventLog, LOG_PAD_RELEASED);
+    startRun(releaseEdgeTime);
   }
   
   // Check reset button
   byte resetEvent = checkResetButton();
   
   if (resetEvent == 1) { // Reset button pressed
-    Serial.println("Reset button pressed - Clearing display and turning off LED");
+    logEvent(eventLog, LOG_RESET_PRESSED);
+    lastActivityTime = halMicros();
+    cancelStartSequence();
     turnLEDOff();
     sendResetSignal();
   }
+
+  // Pings, acks and lane results queued by the receive callback
+  drainRadioEvents();
+
+  // Retransmit an unacknowledged start/reset signal
+  serviceRetransmit();
+
+  // Remember newly paired top units
+  if (lanesChanged) {
+    lanesChanged = false;
+    saveLanes();
+  }
+
+  // Trace dump, start sequence and pad tuning requests
+  serviceSerialCommands();
   
-  delay(10); // Small delay for stability
+  // Sleep until the next pad edge, the pad can be decided, or LOOP_INTERVAL;
+  // in low power mode, light sleep until the next ping while idle
+  if (!sleepIfIdle()) ulTaskNotifyTake(pdTRUE, loopSleepTicks());
 }
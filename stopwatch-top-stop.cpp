@@ -1,12 +1,20 @@
-#include <esp_now.h>
-#include <WiFi.h>
-#include <esp_wifi.h>
 #include <MD_MAX72xx.h>
 #include <SPI.h>
-
-// Device MAC addresses
-uint8_t topDeviceMAC[] = {0xFC, 0xB4, 0x67, 0x4E, 0x7E, 0x38}; // This device MAC
-uint8_t bottomDeviceMAC[] = {0xFC, 0xB4, 0x67, 0x4E, 0x7D, 0x58}; // Bottom device MAC
+#include "hal.h"
+#include "matrix-transport.h"
+#include "matrix-frame.h"
+#include "digit-glyphs.h"
+#include "bcd-counter.h"
+#include "clock-sync.h"
+#include "link-stats.h"
+#include "peer-table.h"
+#include "wire-protocol.h"
+#include "event-queue.h"
+#include "task-stats.h"
+#include "trace-buffer.h"
+#include "deferred-log.h"
+#include "pad-filter.h"
+#include "run-history.h"
 
 // Hardware configuration - using ICSTATION_HW for 10888AS modules
 #define HARDWARE_TYPE MD_MAX72XX::ICSTATION_HW
@@ -19,179 +27,205 @@ uint8_t bottomDeviceMAC[] = {0xFC, 0xB4, 0x67, 0x4E, 0x7D, 0x58}; // Bottom devi
 #define LED_GREEN_PIN 23     // RGB LED Green  
 #define LED_BLUE_PIN 18      // RGB LED Blue
 
-MD_MAX72XX mx = MD_MAX72XX(HARDWARE_TYPE, DATA_PIN, CLK_PIN, CS_PIN, MAX_DEVICES);
+// Hardware SPI with DMA on the same pins (matrix-transport.h)
+MatrixDisplay mx = MatrixDisplay(HARDWARE_TYPE, DATA_PIN, CLK_PIN, CS_PIN, MAX_DEVICES);
+FrameBuffer frame; // Shadow of the display, only changed rows are sent
+
+// Tasks - the timing task owns the stopwatch state and has its core to itself
+// apart from the lower priority display task, so neither a display push nor
+// Serial output (log task, other core) can delay stop edge processing
+#define TIMING_CORE 1
+#define DISPLAY_CORE 1
+#define RADIO_CORE 0
+#define LOG_CORE 0
+#define HISTORY_CORE 0
+#define TIMING_PRIORITY 20
+#define DISPLAY_PRIORITY 10
+#define RADIO_PRIORITY 5
+#define LOG_PRIORITY 1
+#define HISTORY_PRIORITY 1
+#define TASK_STACK_SIZE 4096
+#define SERIAL_TX_BUFFER 1024  // Serial output is queued for the UART driver, so startup text doesn't hold up the boot
+TaskHandle_t timingTaskHandle = NULL;
+TaskHandle_t displayTaskHandle = NULL;
+TaskHandle_t radioTaskHandle = NULL;
+TaskHandle_t historyTaskHandle = NULL;
+DeferredLog eventLog;    // Messages waiting for the log task
+TaskStats timingStats;   // Latency: button edge or start/reset message to processing
+TaskStats displayStats;  // Latency: digit boundary to frame pushed
+TaskStats radioStats;    // Latency: message received to processing
 
-// Stopwatch variables
-unsigned long startTime = 0;
-unsigned long finalTime = 0;
+// Stopwatch variables - written only by the timing task
 enum StopwatchState { WAITING, RUNNING, STOPPED, DISPLAYING };
 StopwatchState stopwatchState = WAITING;
+int64_t startTime = 0;        // esp_timer time the run started (microseconds)
+int64_t finalTimeUs = 0;      // Final time in microseconds
+
+// Banner shown while waiting for a run - chosen by the radio task
+enum Banner { BANNER_NONE, BANNER_PAIR, BANNER_OK };
+
+// What the display task draws, copied out under snapshotMux
+typedef struct {
+  StopwatchState state;
+  int64_t startTime;
+  int64_t finalTimeUs;
+  Banner banner;
+  uint32_t version;   // Bumped on every change
+} DisplaySnapshot;
 
-// Button variables
-unsigned long lastDebounceTime = 0;
-unsigned long debounceDelay = 5; // 5ms debounce delay for better responsiveness
-byte buttonState = HIGH;
-byte lastButtonState = HIGH;
+portMUX_TYPE snapshotMux = portMUX_INITIALIZER_UNLOCKED;
+DisplaySnapshot snapshot = { WAITING, 0, 0, BANNER_PAIR, 0 };
+
+// Start/reset commands from the radio task to the timing task
+typedef struct {
+  int messageType;    // 1 = start, 2 = reset
+  int64_t startTime;  // Start: pad release edge on our clock (microseconds)
+  int64_t rxTime;     // When the message was received (microseconds)
+} TimingCommand;
+
+EventQueue<TimingCommand, 8> timingCommands;
+
+// Finished runs from the timing task to the radio task, which prints them
+typedef struct {
+  int64_t finalTimeUs;
+  int64_t startTime;      // Start edge on our clock (microseconds)
+  int64_t stopEdgeTime;   // Stop edge (microseconds)
+} RunResult;
+
+EventQueue<RunResult, 4> runResults;
+
+// Run history in flash (run-history.h) - runs are queued by the radio task and
+// written by the history task once nothing is being timed, since flash writes
+// stall both cores
+RunHistory history;
+EventQueue<RunRecord, 4> historyRecords;
+const unsigned long HISTORY_RETRY_INTERVAL = 500; // Recheck for a finished run while one is being timed (ms)
+const int HISTORY_SHOW_AT_BOOT = 5;               // Runs printed at startup
+
+// Display variables - used only by the display task
+BcdCounter timeCounter;       // Displayed SS.DD, limited to 99.99
+const uint32_t CENTISECOND_US = 10000;
+HalTimer frameTimer;
+volatile bool frameDue = false;
+int64_t frameDueTime = 0;     // Digit boundary the frame timer is armed for
+
+// Tick-to-photon latency: digit boundary to frame pushed to the display
+typedef struct {
+  uint32_t frames;
+  int64_t totalUs;
+  int64_t minUs;
+  int64_t maxUs;
+} FrameLatencyStats;
+FrameLatencyStats frameLatency;
+
+// Stop pad, conditioned by pad-filter.h - decided in the timing task
+PadFilter stopPad;
+PadCommand padCommand;                 // Tuning commands, radio task only
+portMUX_TYPE buttonMux = portMUX_INITIALIZER_UNLOCKED;
+int64_t buttonEdgeTime = 0;            // esp_timer time of the last edge, for the interrupt latency (microseconds)
+int64_t stopEdgeTime = 0;              // Validated stop edge (microseconds)
 
 // LED states
 enum LEDState { LED_OFF, LED_GREEN };
 LEDState currentLEDState = LED_OFF;
 
-// Communication message types
-typedef struct {
-  int messageType; // 1 = start signal, 2 = reset signal, 3 = ping, 4 = pong
-  unsigned long timestamp;
-} Message;
+// Boot - the radio task brings up the radio while setup() brings up the display
+#define BOOT_RADIO 0x01
+#define BOOT_DISPLAY 0x02
+portMUX_TYPE bootMux = portMUX_INITIALIZER_UNLOCKED;
+uint8_t bootPending = BOOT_RADIO | BOOT_DISPLAY;
+int64_t bootReadyUs = 0;  // Boot-to-ready time, from power-up until a start can be received and shown (microseconds)
 
 // Connection status variables
 bool isConnectedToBottom = false;
-unsigned long lastPingTime = 0;
-unsigned long lastPongTime = 0;
-const unsigned long PING_INTERVAL = 1000; // Send ping every 1 second
-const unsigned long CONNECTION_TIMEOUT = 3000; // Consider disconnected after 3 seconds
-
-// Define 8x8 patterns for digits 0-9
-uint8_t digitPatterns[10][8] = {
-  // Digit 0
-  {
-    0b00111100,  // Row 0: __XXXX__
-    0b01100110,  // Row 1: _XX__XX_
-    0b01100110,  // Row 2: _XX__XX_
-    0b01100110,  // Row 3: _XX__XX_
-    0b01100110,  // Row 4: _XX__XX_
-    0b01100110,  // Row 5: _XX__XX_
-    0b00111100,  // Row 6: __XXXX__
-    0b00000000   // Row 7: ________
-  },
-  // Digit 1
-  {
-    0b00011000,  // Row 0: ___XX___
-    0b00111000,  // Row 1: __XXX___
-    0b00011000,  // Row 2: ___XX___
-    0b00011000,  // Row 3: ___XX___
-    0b00011000,  // Row 4: ___XX___
-    0b00011000,  // Row 5: ___XX___
-    0b01111100,  // Row 6: _XXXXX__
-    0b00000000   // Row 7: ________
-  },
-  // Digit 2
-  {
-    0b00111100,  // Row 0: __XXXX__
-    0b01100110,  // Row 1: _XX__XX_
-    0b00000110,  // Row 2: _____XX_
-    0b00001100,  // Row 3: ____XX__
-    0b00110000,  // Row 4: __XX____
-    0b01100000,  // Row 5: _XX_____
-    0b01111100,  // Row 6: _XXXXX__
-    0b00000000   // Row 7: ________
-  },
-  // Digit 3
-  {
-    0b00111100,  // Row 0: __XXXX__
-    0b01100110,  // Row 1: _XX__XX_
-    0b00000110,  // Row 2: _____XX_
-    0b00011100,  // Row 3: ___XXX__
-    0b00000110,  // Row 4: _____XX_
-    0b01100110,  // Row 5: _XX__XX_
-    0b00111100,  // Row 6: __XXXX__
-    0b00000000   // Row 7: ________
-  },
-  // Digit 4
-  {
-    0b00001100,  // Row 0: ____XX__
-    0b00011100,  // Row 1: ___XXX__
-    0b00111100,  // Row 2: __XXXX__
-    0b01101100,  // Row 3: _XX_XX__
-    0b01111110,  // Row 4: _XXXXXX_
-    0b00001100,  // Row 5: ____XX__
-    0b00001100,  // Row 6: ____XX__
-    0b00000000   // Row 7: ________
-  },
-  // Digit 5
-  {
-    0b01111110,  // Row 0: _XXXXXX_
-    0b01100000,  // Row 1: _XX_____
-    0b01100000,  // Row 2: _XX_____
-    0b01111100,  // Row 3: _XXXXX__
-    0b00000110,  // Row 4: _____XX_
-    0b01100110,  // Row 5: _XX__XX_
-    0b00111100,  // Row 6: __XXXX__
-    0b00000000   // Row 7: ________
-  },
-  // Digit 6
-  {
-    0b00111100,  // Row 0: __XXXX__
-    0b01100110,  // Row 1: _XX__XX_
-    0b01100000,  // Row 2: _XX_____
-    0b01111100,  // Row 3: _XXXXX__
-    0b01100110,  // Row 4: _XX__XX_
-    0b01100110,  // Row 5: _XX__XX_
-    0b00111100,  // Row 6: __XXXX__
-    0b00000000   // Row 7: ________
-  },
-  // Digit 7
-  {
-    0b01111110,  // Row 0: _XXXXXX_
-    0b00000110,  // Row 1: _____XX_
-    0b00001100,  // Row 2: ____XX__
-    0b00011000,  // Row 3: ___XX___
-    0b00110000,  // Row 4: __XX____
-    0b00110000,  // Row 5: __XX____
-    0b00110000,  // Row 6: __XX____
-    0b00000000   // Row 7: ________
-  },
-  // Digit 8
-  {
-    0b00111100,  // Row 0: __XXXX__
-    0b01100110,  // Row 1: _XX__XX_
-    0b01100110,  // Row 2: _XX__XX_
-    0b00111100,  // Row 3: __XXXX__
-    0b01100110,  // Row 4: _XX__XX_
-    0b01100110,  // Row 5: _XX__XX_
-    0b00111100,  // Row 6: __XXXX__
-    0b00000000   // Row 7: ________
-  },
-  // Digit 9
-  {
-    0b00111100,  // Row 0: __XXXX__
-    0b01100110,  // Row 1: _XX__XX_
-    0b01100110,  // Row 2: _XX__XX_
-    0b00111110,  // Row 3: __XXXXX_
-    0b00000110,  // Row 4: _____XX_
-    0b01100110,  // Row 5: _XX__XX_
-    0b00111100,  // Row 6: __XXXX__
-    0b00000000   // Row 7: ________
-  }
-};
-
-// Decimal point patterns - split between panels 2 and 1
-uint8_t decimalPatternLeft[8] = {  // For panel 2 (right side)
-  0b00000000,  // Row 0: ________
-  0b00000000,  // Row 1: ________
-  0b00000000,  // Row 2: ________
-  0b00000000,  // Row 3: ________
-  0b00000000,  // Row 4: ________
-  0b00000000,  // Row 5: ________
-  0b00000001,  // Row 6: _______X
-  0b00000000   // Row 7: ________
-};
-
-uint8_t decimalPatternRight[8] = {  // For panel 1 (left side)
-  0b00000000,  // Row 0: ________
-  0b00000000,  // Row 1: ________
-  0b00000000,  // Row 2: ________
-  0b00000000,  // Row 3: ________
-  0b00000000,  // Row 4: ________
-  0b00000000,  // Row 5: ________
-  0b00000000,  // Row 6: ________
-  0b00000000   // Row 7: ________
-};
+int64_t lastPingTime = 0;  // halMicros() of the last ping or discovery
+int64_t pingWait = 0;      // Longest wait until the next ping, as the last one told the bottom unit
+int64_t lastPongTime = 0;  // halMicros() of the last message from the bottom unit
+const int64_t PING_INTERVAL_US = 1000000; // Send ping every 1 second
+const int64_t RECONNECT_INTERVAL_US = 100000; // Ping (or broadcast discovery) every 100ms while not connected
+const int64_t CONNECTION_TIMEOUT_US = 3000000; // Consider disconnected after 3 seconds
+const int MISSED_PINGS_LOST = 3;               // and at least this many unanswered pings
+
+// Adaptive pings: quick from a climber stepping on the start pad until the
+// run is over, backing off once nothing has happened for a while - radio task only
+const int64_t PING_ACTIVE_INTERVAL_US = 250000;   // Before and during a run
+const int64_t PING_BACKOFF_INTERVAL_US = 4000000; // Idle
+const int64_t READY_HOLD_US = 15000000;           // A climber on the start pad keeps the pings quick this long
+const int64_t IDLE_BACKOFF_US = 60000000;         // Back off after a minute without a run
+int64_t readyTime = -READY_HOLD_US;  // When the bottom unit last said a climber is on the start pad
+int64_t lastActivityTime = 0;        // Last climber ready, start, stop or reset
+bool runActive = false;              // Started and not yet stopped or reset
+int unansweredPings = 0;             // Pings sent since the bottom unit was last heard
+
+// Link statistics (link-stats.h) - radio task only, failed deliveries are
+// counted by the send callback
+LinkStats link;
+uint32_t pingSequence = 0;           // Number of the last ping or discovery sent
+volatile uint32_t deliveryFailures = 0;
+int64_t lastSyncSampleTime = 0;      // Clock sync samples are kept at least PING_INTERVAL_US / 2 apart
+
+// Bottom unit, found by discovery and kept in the settings - radio task only
+uint8_t bottomDeviceMAC[6];
+bool haveBottomUnit = false;          // bottomDeviceMAC is set
+bool discovering = false;             // Pings are broadcast as discovery, the first bottom unit to answer is adopted
+volatile bool bottomChanged = false;  // Newly adopted, for the history task to save
+
+// Clock synchronisation with the bottom unit
+ClockSync clockSync;
+int64_t lastPeerTxTime = 0; // Transmit time of the last message from the bottom unit (its clock)
+int64_t lastPeerRxTime = 0; // When we received it (our clock)
+
+// Received messages, handed from the Wi-Fi task to the radio task
+typedef struct {
+  Message msg;
+  int64_t rxTime;   // esp_timer time the callback ran (microseconds)
+  uint8_t mac[6];
+  int rssi;         // Of the frame (dBm)
+  bool firstInFrame;
+} RadioEvent;
+
+EventQueue<RadioEvent, 16> radioEvents;
+
+// Events for the bottom unit, sent together as one frame (wire-protocol.h) - radio task only
+WireBatch outbox;
+const unsigned long RADIO_IDLE_TIMEOUT = 100; // Longest radio task sleep, for pings and timeouts (ms)
+Banner currentBanner = BANNER_PAIR;
+bool okMessageShown = false;   // "OK" is up, taken down OK_MESSAGE_DURATION_US after okMessageTime
+int64_t okMessageTime = 0;
+const int64_t OK_MESSAGE_DURATION_US = 2000000;
+
+// Duplicate suppression for retransmitted start/reset signals
+uint32_t lastSignalSequence = 0;
+bool haveSignalSequence = false;
+
+// Lane, told by the bottom unit in its replies (peer-table.h) - radio task only
+uint8_t laneId = LANE_NONE;
+
+// Current race and the stop reported back to the bottom unit, which decides
+// the race on its clock
+uint32_t raceSequence = 0;       // Sequence number of the start signal
+int64_t raceStartEdge = 0;       // Pad release or start cue on the bottom unit's clock (microseconds)
+const int64_t RESULT_RETRY_INTERVAL_US = 100000; // Resend an unacknowledged result every 100ms
+const int MAX_RESULT_RETRIES = 8;
+Message pendingResult;      // Only type, sequence and edge time are used
+bool resultPending = false;
+int resultRetries = 0;
+int64_t lastResultSendTime = 0;
+
+// Start sequence verdict for the current race, sent with its start signal
+bool raceHasVerdict = false;
+bool raceFalseStart = false;
+int64_t raceReactionUs = 0;
+
+// Link statistics for the run history, counted from the start signal on
+uint32_t runMessages = 0;     // Messages received from the bottom unit
+uint16_t runDuplicates = 0;   // Duplicate start/reset signals among them
 
 // Function to set RGB LED color
 void setLEDColor(int red, int green, int blue) {
-  analogWrite(LED_RED_PIN, red);
-  analogWrite(LED_GREEN_PIN, green);
-  analogWrite(LED_BLUE_PIN, blue);
+  halLedWrite(LED_RED_PIN, red);
+  halLedWrite(LED_GREEN_PIN, green);
+  halLedWrite(LED_BLUE_PIN, blue);
 }
 
 // Function to turn LED off
@@ -208,131 +242,136 @@ void setLEDGreen() {
 
 // Function to display a digit on a specific panel
 void displayDigit(int panel, int digit) {
-  for (int row = 0; row < 8; row++) {
-    mx.setRow(panel, row, digitPatterns[digit][row]);
-  }
+  frameSetPanel(frame, panel, glyphTable[GLYPH_PLAIN][digit]);
 }
 
 // Function to blank a specific panel
 void blankPanel(int panel) {
-  for (int row = 0; row < 8; row++) {
-    mx.setRow(panel, row, 0b00000000);
-  }
+  frameBlankPanel(frame, panel);
 }
 
-// Function to display digit with left decimal point on panel 2
+// Function to display digit with left decimal point (panel 1)
 void displayDigitWithLeftDecimal(int panel, int digit) {
-  for (int row = 0; row < 8; row++) {
-    uint8_t pattern = digitPatterns[digit][row] | decimalPatternLeft[row];
-    mx.setRow(panel, row, pattern);
-  }
+  frameSetPanel(frame, panel, glyphTable[GLYPH_LEFT_DECIMAL][digit]);
 }
 
-// Function to display digit with right decimal point on panel 1
+// Function to display digit with right decimal point (panel 2)
 void displayDigitWithRightDecimal(int panel, int digit) {
-  for (int row = 0; row < 8; row++) {
-    uint8_t pattern = digitPatterns[digit][row] | decimalPatternRight[row];
-    mx.setRow(panel, row, pattern);
-  }
+  frameSetPanel(frame, panel, glyphTable[GLYPH_RIGHT_DECIMAL][digit]);
 }
 
 // Function to clear all displays
 void clearDisplay() {
-  mx.clear();
+  frameClear(frame);
+  frameRender(frame, mx);
 }
 
-// Function to update the stopwatch display
-void updateStopwatchDisplay() {
-  if (stopwatchState != RUNNING) return;
-  
-  // Calculate elapsed time in centiseconds (hundredths of a second)
-  unsigned long currentTime = millis();
-  unsigned long elapsed = (currentTime - startTime);
-  unsigned long centiseconds = elapsed / 10; // Convert to centiseconds
-  
-  // Extract seconds and centiseconds
-  unsigned long totalSeconds = centiseconds / 100;
-  unsigned long remainingCentiseconds = centiseconds % 100;
-  
-  // Limit display to 99.99 seconds
-  if (totalSeconds >= 100) {
-    totalSeconds = 99;
-    remainingCentiseconds = 99;
+// Function to draw the panels the time counter reports as changed
+// Display format: SS.DD (seconds.centiseconds)
+void drawTimeCounter(uint8_t changed) {
+  if (changed & 0x01) {
+    if (timeCounter.digits[0] == 0) {
+      blankPanel(0);
+    } else {
+      displayDigit(0, timeCounter.digits[0]);                  // Tens of seconds
+    }
   }
-  
-  // Extract individual digits
-  int secondsTens = (totalSeconds / 10) % 10;
-  int secondsOnes = totalSeconds % 10;
-  int centisecondsTens = (remainingCentiseconds / 10) % 10;
-  int centisecondsOnes = remainingCentiseconds % 10;
-  
-  // Display format: SS.DD (seconds.centiseconds)
-  if (secondsTens == 0) {
-    blankPanel(0);
-   } else {
-    displayDigit(0, secondsTens);                    // Tens of seconds
-   }
-  displayDigitWithLeftDecimal(1, secondsOnes);     // Ones of seconds with left decimal point
-  displayDigitWithRightDecimal(2, centisecondsTens); // Tenths of seconds with right decimal point
-  displayDigit(3, centisecondsOnes);               // Hundredths of seconds
+  if (changed & 0x02) displayDigitWithLeftDecimal(1, timeCounter.digits[1]);  // Ones of seconds with left decimal point
+  if (changed & 0x04) displayDigitWithRightDecimal(2, timeCounter.digits[2]); // Tenths of seconds with right decimal point
+  if (changed & 0x08) displayDigit(3, timeCounter.digits[3]);                 // Hundredths of seconds
+  if (changed != 0) frameRender(frame, mx);
+}
+
+// Function to update the stopwatch display
+void updateStopwatchDisplay(int64_t runStartTime) {
+  TRACE_BEGIN(TRACE_DISPLAY_UPDATE, 0);
+  // Advance the displayed time by the centiseconds elapsed since the last frame
+  drawTimeCounter(bcdAdvance(timeCounter, halMicros() - runStartTime));
+  TRACE_END(TRACE_DISPLAY_UPDATE);
+}
+
+// Display timer callback - wakes the display task at the digit boundary
+void onFrameTimer(void *) {
+  frameDue = true;
+  xTaskNotifyGive(displayTaskHandle);
+}
+
+// Function to arm the display timer for the next time the shown digits change
+void scheduleNextFrame(int64_t runStartTime) {
+  if (timeCounter.overflowed) return;
+  frameDueTime = runStartTime + (int64_t)(timeCounter.ticks + 1) * CENTISECOND_US;
+  int64_t wait = frameDueTime - halMicros();
+  halTimerStartOnce(frameTimer, wait);
+}
+
+// Function to stop the display timer
+void cancelFrameTimer() {
+  halTimerStop(frameTimer);
+  frameDue = false;
+}
+
+// Function to record how late a frame reached the display
+void recordFrameLatency(int64_t latencyUs) {
+  if (frameLatency.frames == 0 || latencyUs < frameLatency.minUs) frameLatency.minUs = latencyUs;
+  if (frameLatency.frames == 0 || latencyUs > frameLatency.maxUs) frameLatency.maxUs = latencyUs;
+  frameLatency.totalUs += latencyUs;
+  frameLatency.frames++;
+}
+
+// Function to print tick-to-photon latency and jitter
+void printFrameLatency() {
+  if (frameLatency.frames == 0) return;
+  Serial.printf("Tick-to-photon: %u frames, avg %lld us, min %lld us, max %lld us, jitter %lld us\n",
+                frameLatency.frames, (long long)(frameLatency.totalUs / frameLatency.frames),
+                (long long)frameLatency.minUs, (long long)frameLatency.maxUs,
+                (long long)(frameLatency.maxUs - frameLatency.minUs));
 }
 
 // Function to display final time (when stopped)
-void displayFinalTime() {
-  unsigned long centiseconds = finalTime / 10; // Convert to centiseconds
-  
-  // Extract seconds and centiseconds
-  unsigned long totalSeconds = centiseconds / 100;
-  unsigned long remainingCentiseconds = centiseconds % 100;
-  
-  // Limit display to 99.99 seconds
-  if (totalSeconds >= 100) {
-    totalSeconds = 99;
-    remainingCentiseconds = 99;
-  }
-  
-  // Extract individual digits
-  int secondsTens = (totalSeconds / 10) % 10;
-  int secondsOnes = totalSeconds % 10;
-  int centisecondsTens = (remainingCentiseconds / 10) % 10;
-  int centisecondsOnes = remainingCentiseconds % 10;
-  
-  // Display format: SS.DD (seconds.centiseconds)
-  if (secondsTens == 0) {
-    blankPanel(0);
-   } else {
-    displayDigit(0, secondsTens);                    // Tens of seconds
-   }
-  displayDigitWithLeftDecimal(1, secondsOnes);     // Ones of seconds with left decimal point
-  displayDigitWithRightDecimal(2, centisecondsTens); // Tenths of seconds with right decimal point
-  displayDigit(3, centisecondsOnes);               // Hundredths of seconds
+void displayFinalTime(int64_t timeUs) {
+  bcdReset(timeCounter, CENTISECOND_US, true);
+  drawTimeCounter(bcdAdvance(timeCounter, timeUs));
+}
+
+// Interrupt handler for the stop pad - stamps every edge through the glitch
+// filter, checkButton() decides once the pad has settled
+void IRAM_ATTR onButtonEdge() {
+  int64_t now = halMicros();
+  padFilterEdge(stopPad, now, halDigitalRead(BUTTON_PIN));
+  portENTER_CRITICAL_ISR(&buttonMux);
+  buttonEdgeTime = now;
+  portEXIT_CRITICAL_ISR(&buttonMux);
+
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(timingTaskHandle, &woken);
+  if (woken) portYIELD_FROM_ISR();
 }
 
 // Function to handle button events
+// Returns 1 once a press has settled; the time of its first edge is then
+// available in stopEdgeTime. Releases and glitches are only logged
 byte checkButton() {
-  byte reading = digitalRead(BUTTON_PIN);
-
-  if (reading != lastButtonState) {
-    lastDebounceTime = millis();
+  PadEvent event = padFilterUpdate(stopPad, halMicros(), halDigitalRead(BUTTON_PIN));
+  if (event == PAD_NONE) {
+    return 0; // No event
   }
-
-  if ((millis() - lastDebounceTime) > debounceDelay) {
-    if (reading != buttonState) {
-      buttonState = reading;
-      if (buttonState == LOW) {
-        return 1; // Pressed
-      }
-    }
+  if (event == PAD_GLITCH) {
+    logEvent(eventLog, LOG_PAD_GLITCH, stopPad.lastEdges, stopPad.lastSettleUs);
+    return 0;
   }
 
-  lastButtonState = reading;
-  return 0; // No event
+  logEvent(eventLog, LOG_PAD_SETTLED, stopPad.level, stopPad.lastEdges, stopPad.lastSettleUs);
+  if (event != PAD_PRESSED) {
+    return 0;
+  }
+  stopEdgeTime = stopPad.eventTime;
+  return 1; // Pressed
 }
 
 // Function to display "PAIR" on the matrix
 void displayPairMessage() {
   // Clear display first
-  clearDisplay();
+  frameClear(frame);
   
   // Simple pattern for "PAIR" - using basic shapes
   // P on panel 0
@@ -384,18 +423,17 @@ void displayPairMessage() {
   };
   
   // Display each letter
-  for (int row = 0; row < 8; row++) {
-    mx.setRow(0, row, pPattern[row]);
-    mx.setRow(1, row, aPattern[row]);
-    mx.setRow(2, row, iPattern[row]);
-    mx.setRow(3, row, rPattern[row]);
-  }
+  frameSetPanel(frame, 0, pPattern);
+  frameSetPanel(frame, 1, aPattern);
+  frameSetPanel(frame, 2, iPattern);
+  frameSetPanel(frame, 3, rPattern);
+  frameRender(frame, mx);
 }
 
 // Function to display "OK" on the matrix
 void displayOKMessage() {
   // Clear display first
-  clearDisplay();
+  frameClear(frame);
   
   // O on panel 1
   uint8_t oPattern[8] = {
@@ -422,144 +460,746 @@ void displayOKMessage() {
   };
   
   // Display each letter (centered)
-  for (int row = 0; row < 8; row++) {
-    mx.setRow(1, row, oPattern[row]);
-    mx.setRow(2, row, kPattern[row]);
-  }
+  frameSetPanel(frame, 1, oPattern);
+  frameSetPanel(frame, 2, kPattern);
+  frameRender(frame, mx);
 }
 
 // Callback function for receiving ESP-NOW data
-void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
-  Message msg;
-  memcpy(&msg, incomingData, sizeof(msg));
+// Runs in the Wi-Fi task: only timestamp and queue the message, the radio task does the rest
+void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len, int rssi) {
+  int64_t rxTime = halMicros();
+  WireBatch batch;
+  WireStatus status = wireDecode(incomingData, len, batch);
+  TRACE_BEGIN(TRACE_RADIO_RECEIVE, batch.count > 0 ? batch.events[0].messageType : 0);
+  if (status != WIRE_OK) {
+    logEvent(eventLog, LOG_BAD_FRAME, status, len);
+    TRACE_END(TRACE_RADIO_RECEIVE);
+    return;
+  }
+
+  // One radio event per event in the frame
+  RadioEvent ev;
+  ev.rxTime = rxTime;
+  memcpy(ev.mac, mac, 6);
+  ev.rssi = rssi;
+  for (int i = 0; i < batch.count; i++) {
+    ev.msg = batch.events[i];
+    ev.firstInFrame = i == 0;
+    if (ev.msg.messageType == 1) halProbe(PROBE_RADIO_RECEIVE);
+    queuePush(radioEvents, ev);
+  }
+  if (radioTaskHandle != NULL) xTaskNotifyGive(radioTaskHandle);
+  TRACE_END(TRACE_RADIO_RECEIVE);
+}
+
+// Callback function for ESP-NOW send status (Wi-Fi task)
+void OnDataSent(const uint8_t *, bool delivered) {
+  if (!delivered) deliveryFailures++;
+}
+
+// Function to choose how often to ping: quickly while not connected and from
+// a climber stepping on the start pad until the run is over, every
+// PING_INTERVAL_US otherwise, backing off once idle for IDLE_BACKOFF_US
+int64_t pingInterval() {
+  if (!isConnectedToBottom) return RECONNECT_INTERVAL_US;
+  int64_t now = halMicros();
+  if (runActive || now - readyTime < READY_HOLD_US) return PING_ACTIVE_INTERVAL_US;
+  if (now - lastActivityTime >= IDLE_BACKOFF_US) return PING_BACKOFF_INTERVAL_US;
+  return PING_INTERVAL_US;
+}
+
+// Function to add a numbered ping, or a discovery, to the outbox
+// It tells the bottom unit how long until the next one, for its connection timeout
+bool addPing() {
+  int64_t interval = pingInterval();
+  if (!wireBatchAdd(outbox, discovering ? 7 : 3, pingSequence + 1, interval, 0)) return false;
+  pingWait = interval;
+  pingSequence++;
+  lastPingTime = halMicros();
+  if (!discovering) {
+    linkStatsPingSent(link, pingSequence);
+    unansweredPings++;
+  }
+  return true;
+}
+
+// Function to get when the next ping is due (halMicros() time): after the
+// current interval, but no later than the last ping said, so a backoff starts
+// with the ping after it rather than leaving the bottom unit waiting too long
+int64_t nextPingTime() {
+  int64_t interval = pingInterval();
+  return lastPingTime + (pingWait < interval ? pingWait : interval);
+}
+
+// Function to send the queued events to the bottom unit as one frame
+// A ping that is at least half due rides along, saving a frame of its own
+void flushOutbox() {
+  if (outbox.count == 0) return;
+  if (halMicros() - lastPingTime >= pingInterval() / 2) addPing();
+  outbox.lane = laneId;
+  outbox.timestamp = halMicros();
+  outbox.echoTime = lastPeerTxTime;
+  outbox.recvTime = lastPeerRxTime;
+  uint8_t buf[WIRE_MAX_FRAME];
+  size_t len = wireEncode(outbox, buf);
+  halRadioSend(discovering ? BROADCAST_MAC : bottomDeviceMAC, buf, len);
+  wireBatchClear(outbox);
+}
+
+// Function to queue an event for the bottom unit, sending the frame first if it is full
+void queueOutgoing(int type, uint32_t sequence, int64_t edgeTime) {
+  if (!wireBatchAdd(outbox, type, sequence, edgeTime, 0)) {
+    flushOutbox();
+    wireBatchAdd(outbox, type, sequence, edgeTime, 0);
+  }
+}
+
+// Function to publish the timer state to the display task (timing task only)
+void publishTimerState() {
+  portENTER_CRITICAL(&snapshotMux);
+  snapshot.state = stopwatchState;
+  snapshot.startTime = startTime;
+  snapshot.finalTimeUs = finalTimeUs;
+  snapshot.version++;
+  portEXIT_CRITICAL(&snapshotMux);
+  xTaskNotifyGive(displayTaskHandle);
+}
+
+// Function to choose the banner shown while waiting (radio task only)
+void showBanner(Banner banner) {
+  if (banner == currentBanner) return;
+  currentBanner = banner;
+  portENTER_CRITICAL(&snapshotMux);
+  snapshot.banner = banner;
+  snapshot.version++;
+  portEXIT_CRITICAL(&snapshotMux);
+  if (displayTaskHandle != NULL) xTaskNotifyGive(displayTaskHandle); // Otherwise drawn when it starts
+}
+
+// Function to take a consistent copy of what should be displayed
+DisplaySnapshot readSnapshot() {
+  portENTER_CRITICAL(&snapshotMux);
+  DisplaySnapshot copy = snapshot;
+  portEXIT_CRITICAL(&snapshotMux);
+  return copy;
+}
+
+// Function to hand a start/reset to the timing task
+void sendTimingCommand(int messageType, int64_t commandStartTime, int64_t rxTime) {
+  TimingCommand cmd;
+  cmd.messageType = messageType;
+  cmd.startTime = commandStartTime;
+  cmd.rxTime = rxTime;
+  if (!queuePush(timingCommands, cmd)) {
+    logEvent(eventLog, LOG_TIMING_QUEUE_FULL);
+    return;
+  }
+  if (timingTaskHandle != NULL) xTaskNotifyGive(timingTaskHandle); // Otherwise taken when it starts
+}
+
+// Function to pair with a bottom unit that answered our discovery
+void adoptBottomUnit(const uint8_t *mac) {
+  if (haveBottomUnit) halRadioRemovePeer(bottomDeviceMAC); // The one before gives up its ESP-NOW peer
+  memcpy(bottomDeviceMAC, mac, 6);
+  haveBottomUnit = true;
+  discovering = false;
+  halRadioAddPeer(mac);
+  logEvent(eventLog, LOG_BOTTOM_PAIRED, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+  // Its clock and sequence numbers start from scratch
+  clockSyncReset(clockSync);
+  lastPeerTxTime = 0;
+  lastPeerRxTime = 0;
+  linkStatsReset(link);
+  haveSignalSequence = false;
+  bottomChanged = true;
+  if (historyTaskHandle != NULL) xTaskNotifyGive(historyTaskHandle);
+}
+
+// Function to handle a received message from the bottom unit
+void processRadioEvent(const RadioEvent &ev) {
+  const Message &msg = ev.msg;
+  int64_t rxTime = ev.rxTime;
+  taskStatsLatency(radioStats, halMicros() - rxTime);
+
+  logEvent(eventLog, LOG_MESSAGE_FROM, ev.mac[0], ev.mac[1], ev.mac[2], ev.mac[3], ev.mac[4], ev.mac[5]);
+
+  // Only our bottom unit is listened to; while discovering, the first one
+  // to answer us (its frame carries our lane) becomes ours
+  if (!haveBottomUnit || memcmp(ev.mac, bottomDeviceMAC, 6) != 0) {
+    if (!discovering || msg.lane == LANE_NONE) {
+      logEvent(eventLog, LOG_OTHER_BOTTOM);
+      return;
+    }
+    adoptBottomUnit(ev.mac);
+  }
+  runMessages++;
+  if (ev.firstInFrame) linkStatsFrame(link, ev.rssi, msg.echoTime, msg.recvTime, msg.timestamp, rxTime);
+
+  // Messages addressed to us carry our lane
+  if (msg.lane != LANE_NONE && msg.lane != laneId) {
+    laneId = msg.lane;
+    logEvent(eventLog, LOG_LANE_ASSIGNED, laneId);
+  }
   
-  Serial.print("Message received from: ");
-  for (int i = 0; i < 6; i++) {
-    Serial.printf("%02X", mac[i]);
-    if (i < 5) Serial.print(":");
+  // Acknowledge every start/reset, including duplicates whose first ack was lost
+  if (msg.messageType == 1 || msg.messageType == 2) {
+    // Starts and resets are broadcast to all lanes, skip those for other lanes
+    if (laneId != LANE_NONE && !(msg.laneMask & LANE_BIT(laneId))) return;
+
+    queueOutgoing(5, msg.sequence, 0);
+
+    if (haveSignalSequence && msg.sequence == lastSignalSequence) {
+      logEvent(eventLog, LOG_DUPLICATE_SIGNAL, msg.sequence);
+      runDuplicates++;
+      lastPeerTxTime = msg.timestamp;
+      lastPeerRxTime = rxTime;
+      return;
+    }
+    lastSignalSequence = msg.sequence;
+    haveSignalSequence = true;
   }
-  Serial.println();
   
   // Update connection status when we receive any message from bottom device
-  lastPongTime = millis();
+  lastPongTime = rxTime;
+  unansweredPings = 0;
+  discovering = false;
   if (!isConnectedToBottom) {
     isConnectedToBottom = true;
-    Serial.println("Bottom unit connected!");
-    displayOKMessage();
-    delay(2000);
-    clearDisplay();
+    logEvent(eventLog, LOG_BOTTOM_CONNECTED);
+    showBanner(BANNER_OK); // Only drawn while waiting for a run
+    okMessageShown = true;
+    okMessageTime = rxTime;
+    lastActivityTime = rxTime; // Regular pings for a while before backing off
   }
-  
+
   if (msg.messageType == 1) { // Start signal
-    Serial.println("Start signal received - Beginning stopwatch");
-    startTime = millis();
-    stopwatchState = RUNNING;
+    logEvent(eventLog, LOG_START_RECEIVED);
+    runMessages = 1;
+    runDuplicates = 0;
+    okMessageShown = false;
+    showBanner(BANNER_NONE);
+    // Run starts at the pad release (or the start cue), mapped onto our clock
+    int64_t runStartTime;
+    if (clockSync.valid) {
+      runStartTime = clockSyncToLocal(clockSync, msg.edgeTime);
+    } else {
+      // Not synchronised yet - remove the edge age and half the round trip
+      int64_t edgeAge = msg.timestamp - msg.edgeTime;
+      runStartTime = rxTime - edgeAge - clockSync.rtt / 2;
+    }
+    raceSequence = msg.sequence;
+    raceStartEdge = msg.edgeTime;
+    raceHasVerdict = false;
+    resultPending = false;
+    runActive = true;
+    readyTime = rxTime - READY_HOLD_US; // The run keeps the pings quick from here
+    lastActivityTime = rxTime;
+    sendTimingCommand(1, runStartTime, rxTime);
   } else if (msg.messageType == 2) { // Reset signal
-    Serial.println("Reset signal received - Clearing display and turning off LED");
-    clearDisplay();
-    turnLEDOff();
-    stopwatchState = WAITING;
+    logEvent(eventLog, LOG_RESET_RECEIVED);
+    resultPending = false;
+    runActive = false;
+    readyTime = rxTime - READY_HOLD_US;
+    lastActivityTime = rxTime;
+    okMessageShown = false;
+    showBanner(BANNER_NONE);
+    sendTimingCommand(2, 0, rxTime);
   } else if (msg.messageType == 3) { // Ping received
-    Serial.println("Ping received - Sending pong");
+    logEvent(eventLog, LOG_PING_RECEIVED);
     // Send pong response
-    Message pongMsg;
-    pongMsg.messageType = 4;
-    pongMsg.timestamp = millis();
-    esp_now_send(bottomDeviceMAC, (uint8_t *) &pongMsg, sizeof(pongMsg));
+    queueOutgoing(4, 0, 0);
   } else if (msg.messageType == 4) { // Pong received
-    Serial.println("Pong received - Connection confirmed");
-    // Connection already handled above
+    logEvent(eventLog, LOG_PONG_RECEIVED);
+    linkStatsPong(link, msg.sequence);
+    // Connection already handled above, feed the clock synchronisation; quick
+    // pings would narrow its window too much for the drift fit
+    if (rxTime - lastSyncSampleTime >= PING_INTERVAL_US / 2) {
+      lastSyncSampleTime = rxTime;
+      if (clockSyncAddSample(clockSync, msg.echoTime, msg.recvTime, msg.timestamp, rxTime)) {
+        logEvent(eventLog, LOG_CLOCK_SYNC, clockSyncOffsetAt(clockSync, rxTime), clockSync.drift * 1e6, clockSync.rtt);
+      }
+    }
+  } else if (msg.messageType == 5) { // Ack of our result
+    if (resultPending && msg.sequence == pendingResult.sequence) {
+      resultPending = false;
+      logEvent(eventLog, LOG_RESULT_ACKED, msg.sequence);
+    }
+  } else if (msg.messageType == 9) { // Climber on the start pad, a run is coming
+    if (laneId == LANE_NONE || (msg.laneMask & LANE_BIT(laneId))) {
+      logEvent(eventLog, LOG_CLIMBER_READY);
+      readyTime = rxTime;
+      lastActivityTime = rxTime;
+    }
+  } else if (msg.messageType == 8) { // Start verdict, in the frame of its start signal
+    if (msg.sequence == raceSequence && !raceHasVerdict) {
+      raceHasVerdict = true;
+      raceFalseStart = msg.laneMask & 1;
+      raceReactionUs = msg.edgeTime;
+      logEvent(eventLog, raceFalseStart ? LOG_FALSE_START : LOG_REACTION, raceReactionUs / 1000000.0);
+    }
+  }
+
+  lastPeerTxTime = msg.timestamp;
+  lastPeerRxTime = rxTime;
+}
+
+// Function to process everything the receive callback has queued
+void drainRadioEvents() {
+  RadioEvent ev;
+  while (queuePop(radioEvents, ev)) {
+    processRadioEvent(ev);
+  }
+}
+
+// Function to print receive queue statistics
+void printRadioQueueStats() {
+  Serial.printf("Radio queue: depth %u, max depth %u, overflows %u\n",
+                queueDepth(radioEvents), radioEvents.maxDepth.load(), radioEvents.overflows.load());
+}
+
+// Function to print the link statistics (radio task)
+void printLinkStats() {
+  link.sendFailures = deliveryFailures;
+  linkStatsPrint(link, "Bottom unit");
+  Serial.printf("  pinging every %lld ms\n", (long long)(pingInterval() / 1000));
+}
+
+// Function to print CPU share and worst-case latency of each task
+void printTaskStats() {
+  taskStatsPrint(timingStats);
+  taskStatsPrint(displayStats);
+  taskStatsPrint(radioStats);
+}
+
+// Function to print a finished run (radio task, keeps Serial off the timing core)
+void printRunResult(const RunResult &run) {
+  logEvent(eventLog, LOG_STOP_PRESSED);
+  logEvent(eventLog, LOG_FINAL_TIME, run.finalTimeUs / 1000000.0);
+  printRadioQueueStats();
+  printLinkStats();
+  // Display statistics belong to the display task, read unlocked for printing only
+  framePrintStats(frame);
+  printFrameLatency();
+  printTaskStats();
+}
+
+// Function to queue a finished run for the history task, with the link statistics
+void saveRunRecord(const RunResult &run) {
+  RunRecord record;
+  memset(&record, 0, sizeof(record));
+  record.finalTimeUs = run.finalTimeUs;
+  record.startEdgeUs = run.startTime;
+  record.stopEdgeUs = run.stopEdgeTime;
+  record.rttUs = (int32_t)clockSync.rtt;
+  record.driftPpb = (int32_t)(clockSync.drift * 1e9);
+  record.messages = runMessages;
+  record.duplicates = runDuplicates;
+  record.clockSynced = clockSync.valid;
+  record.lane = laneId;
+  record.reactionUs = raceHasVerdict ? (int32_t)raceReactionUs : 0;
+  record.startVerdict = !raceHasVerdict ? RUN_NO_VERDICT : raceFalseStart ? RUN_FALSE_START : RUN_CLEAN_START;
+  if (!queuePush(historyRecords, record)) {
+    logEvent(eventLog, LOG_HISTORY_QUEUE_FULL);
+    return;
+  }
+  xTaskNotifyGive(historyTaskHandle);
+}
+
+// Function to print the most recent runs stored in flash (setup only)
+void printRunHistory() {
+  RunRecord records[HISTORY_SHOW_AT_BOOT];
+  int count = historyReadRecent(history, records, HISTORY_SHOW_AT_BOOT);
+  Serial.printf("Run history: %d recent runs in flash\n", count);
+  for (int i = 0; i < count; i++) {
+    Serial.printf("  Run %u: %.3f s (rtt %d us, %u messages, %u duplicates)",
+                  records[i].sequence, records[i].finalTimeUs / 1000000.0, records[i].rttUs,
+                  records[i].messages, records[i].duplicates);
+    if (records[i].startVerdict == RUN_NO_VERDICT) {
+      Serial.println();
+    } else {
+      Serial.printf(", %sreaction %.3f s\n", records[i].startVerdict == RUN_FALSE_START ? "FALSE START, " : "",
+                    records[i].reactionUs / 1000000.0);
+    }
+  }
+}
+
+// Function to (re)transmit the pending lane result
+void transmitResult() {
+  lastResultSendTime = halMicros();
+  queueOutgoing(6, pendingResult.sequence, pendingResult.edgeTime);
+}
+
+// Function to report a finished run to the bottom unit, with the stop edge on
+// its clock: the start edge it sent plus our final time
+void sendRunResult(const RunResult &run) {
+  pendingResult.messageType = 6;
+  pendingResult.sequence = raceSequence;
+  pendingResult.edgeTime = raceStartEdge + run.finalTimeUs;
+  resultPending = true;
+  resultRetries = 0;
+  transmitResult();
+}
+
+// Function to resend the lane result until the bottom unit acknowledges it
+void serviceResultRetransmit() {
+  if (!resultPending || halMicros() - lastResultSendTime < RESULT_RETRY_INTERVAL_US) return;
+  if (resultRetries >= MAX_RESULT_RETRIES) {
+    resultPending = false;
+    logEvent(eventLog, LOG_RESULT_GAVE_UP, pendingResult.sequence);
+    return;
   }
+  resultRetries++;
+  link.retransmits++;
+  transmitResult();
 }
 
-// Function to send ping to bottom unit
+// Function to send ping to bottom unit, or a discovery to any bottom unit
 void sendPing() {
-  Message pingMsg;
-  pingMsg.messageType = 3;
-  pingMsg.timestamp = millis();
-  esp_now_send(bottomDeviceMAC, (uint8_t *) &pingMsg, sizeof(pingMsg));
-  lastPingTime = millis();
+  if (!addPing()) {
+    flushOutbox();
+    addPing();
+  }
 }
 
 // Initialize ESP-NOW
 void initESPNow() {
-  // Show pairing message
-  displayPairMessage();
   Serial.println("Initializing ESP-NOW...");
   Serial.println("Waiting for bottom unit to connect...");
   
-  // Set device as a Wi-Fi Station
-  WiFi.mode(WIFI_STA);
-  Serial.print("WiFi MAC Address: ");
-  Serial.println(WiFi.macAddress());
-  
-  // Initialize ESP-NOW
-  if (esp_now_init() != ESP_OK) {
+  // Set device as a Wi-Fi Station and start ESP-NOW
+  if (!halRadioBegin(OnDataRecv, OnDataSent)) {
     Serial.println("ERROR: ESP-NOW initialization failed!");
     return;
   }
   Serial.println("ESP-NOW initialized successfully");
   
-  // Register receive callback
-  esp_now_register_recv_cb(OnDataRecv);
-  Serial.println("Receive callback registered");
+  uint8_t mac[6];
+  halRadioMacAddress(mac);
+  Serial.printf("WiFi MAC Address: %02X:%02X:%02X:%02X:%02X:%02X\n",
+                mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
   
-  // Add peer (bottom device)
-  esp_now_peer_info_t peerInfo = {};
-  memcpy(peerInfo.peer_addr, bottomDeviceMAC, 6);
-  peerInfo.channel = 0;
-  peerInfo.encrypt = false;
-  peerInfo.ifidx = WIFI_IF_STA;
-  
-  Serial.print("Adding peer with MAC: ");
-  for (int i = 0; i < 6; i++) {
-    Serial.printf("%02X", bottomDeviceMAC[i]);
-    if (i < 5) Serial.print(":");
-  }
-  Serial.println();
-  
-  // Add peer
-  esp_err_t addStatus = esp_now_add_peer(&peerInfo);
-  if (addStatus != ESP_OK) {
-    Serial.print("Failed to add peer. Error: ");
-    Serial.println(addStatus);
+  // Discovery goes out as a broadcast
+  if (!halRadioAddPeer(BROADCAST_MAC)) {
+    Serial.println("Failed to add broadcast peer.");
     return;
   }
+
+  // Add peer (bottom unit paired before), or look for one
+  haveBottomUnit = halConfigRead("bottom", bottomDeviceMAC, sizeof(bottomDeviceMAC));
+  if (haveBottomUnit) {
+    Serial.print("Adding peer with MAC: ");
+    for (int i = 0; i < 6; i++) {
+      Serial.printf("%02X", bottomDeviceMAC[i]);
+      if (i < 5) Serial.print(":");
+    }
+    Serial.println();
+
+    if (!halRadioAddPeer(bottomDeviceMAC)) {
+      Serial.println("Failed to add peer.");
+      return;
+    }
+    Serial.println("SUCCESS: Peer added successfully!");
+    Serial.println("Sending ping to establish connection...");
+  } else {
+    Serial.println("No bottom unit paired yet - sending discovery...");
+    discovering = true;
+  }
   
-  Serial.println("SUCCESS: Peer added successfully!");
-  Serial.println("Sending ping to establish connection...");
-  
-  // Start connection process by sending initial ping
+  // Start connection process by sending initial ping; a paired bottom unit
+  // has CONNECTION_TIMEOUT_US to answer before we look for another
+  lastPongTime = halMicros();
   sendPing();
 }
 
-void setup() {
-  Serial.begin(115200);
-  delay(2000);
-  
+// Function to mark part of the boot done; the last part records the boot-to-ready time
+void bootStepDone(uint8_t step) {
+  portENTER_CRITICAL(&bootMux);
+  bootPending &= ~step;
+  bool ready = bootPending == 0;
+  if (ready) bootReadyUs = halMicrosSinceBoot();
+  portEXIT_CRITICAL(&bootMux);
+  if (ready) logEvent(eventLog, LOG_BOOT_READY, bootReadyUs / 1000.0);
+}
+
+// Function to apply a new timer state or banner to the display (display task)
+void showSnapshot(const DisplaySnapshot &prev, const DisplaySnapshot &next) {
+  if (next.state == RUNNING) {
+    if (prev.state != RUNNING || prev.startTime != next.startTime) {
+      bcdReset(timeCounter, CENTISECOND_US, true);
+      updateStopwatchDisplay(next.startTime);
+      halProbe(PROBE_DISPLAY_PUSH);
+      scheduleNextFrame(next.startTime);
+    }
+    return;
+  }
+
+  cancelFrameTimer();
+  if (next.state == DISPLAYING) {
+    displayFinalTime(next.finalTimeUs);
+  } else if (next.banner == BANNER_PAIR) {
+    displayPairMessage();
+  } else if (next.banner == BANNER_OK) {
+    displayOKMessage();
+  } else {
+    clearDisplay();
+  }
+}
+
+// Timing task - owns the stopwatch state; handles stop edges and start/reset
+// commands, never touches the display SPI or Serial
+void timingTask(void *) {
+  int64_t lastEdgeSeen = 0;
+  for (;;) {
+    // Sleep until an edge or command, or until the stop pad can be decided
+    TickType_t timeout = portMAX_DELAY;
+    int64_t dueUs = padFilterDueIn(stopPad, halMicros());
+    if (dueUs >= 0) {
+      timeout = pdMS_TO_TICKS(max((int64_t)1, (dueUs + 999) / 1000));
+    }
+    ulTaskNotifyTake(pdTRUE, timeout);
+    taskStatsWake(timingStats);
+
+    TimingCommand cmd;
+    while (queuePop(timingCommands, cmd)) {
+      taskStatsLatency(timingStats, halMicros() - cmd.rxTime);
+      if (cmd.messageType == 1) {
+        startTime = cmd.startTime;
+        stopwatchState = RUNNING;
+        halProbe(PROBE_STATE_UPDATE);
+      } else {
+        turnLEDOff();
+        stopwatchState = WAITING;
+      }
+      publishTimerState();
+    }
+
+    // Interrupt-to-task latency, once per captured edge
+    portENTER_CRITICAL(&buttonMux);
+    int64_t edgeTime = buttonEdgeTime;
+    portEXIT_CRITICAL(&buttonMux);
+    if (edgeTime != lastEdgeSeen) {
+      lastEdgeSeen = edgeTime;
+      taskStatsLatency(timingStats, halMicros() - edgeTime);
+    }
+
+    // Check button events (stop button)
+    TRACE_BEGIN(TRACE_CHECK_BUTTON, 0);
+    byte buttonEvent = checkButton();
+    TRACE_END(TRACE_CHECK_BUTTON);
+
+    if (buttonEvent == 1 && stopwatchState == RUNNING && stopEdgeTime > startTime) { // Stop button pressed while running
+      // Final time comes from the interrupt timestamp, not from when the task noticed the press
+      finalTimeUs = stopEdgeTime - startTime;
+      stopwatchState = DISPLAYING;
+      setLEDGreen();
+      publishTimerState();
+
+      RunResult run;
+      run.finalTimeUs = finalTimeUs;
+      run.startTime = startTime;
+      run.stopEdgeTime = stopEdgeTime;
+      queuePush(runResults, run);
+      xTaskNotifyGive(radioTaskHandle);
+    }
+
+    taskStatsSleep(timingStats);
+  }
+}
+
+// Display task - draws snapshots of the timer state and pushes a frame at
+// each digit boundary while running
+void displayTask(void *) {
+  DisplaySnapshot shown = readSnapshot();
+  showSnapshot(shown, shown);
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    taskStatsWake(displayStats);
+
+    DisplaySnapshot next = readSnapshot();
+    if (next.version != shown.version) {
+      showSnapshot(shown, next);
+      shown = next;
+    }
+
+    // Push the frame the display timer woke us for
+    if (frameDue) {
+      frameDue = false;
+      if (shown.state == RUNNING) {
+        updateStopwatchDisplay(shown.startTime);
+        int64_t latency = halMicros() - frameDueTime;
+        recordFrameLatency(latency);
+        taskStatsLatency(displayStats, latency);
+        scheduleNextFrame(shown.startTime);
+      }
+    }
+
+    taskStatsSleep(displayStats);
+  }
+}
+
+// Function to work out how long the radio task may sleep: until the next ping
+// is due, but no longer than RADIO_IDLE_TIMEOUT
+TickType_t radioSleepTicks() {
+  int64_t pingDue = nextPingTime();
+  int64_t sleepMs = (pingDue - halMicros() + 999) / 1000;
+  return pdMS_TO_TICKS(max((int64_t)1, min(sleepMs, (int64_t)RADIO_IDLE_TIMEOUT)));
+}
+
+// Function to act on commands from Serial: t dumps the trace buffer, l
+// prints the link statistics, the others tune the stop pad (pad-filter.h)
+// and a new settle time is saved
+void serviceSerialCommands() {
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if (c == 't') {
+      TRACE_DUMP();
+    } else if (c == 'l') {
+      printLinkStats();
+    } else if (padFilterCommand(stopPad, padCommand, c, "Stop pad")) {
+      uint32_t settleUs = stopPad.settleUs;
+      halConfigWrite("settle", &settleUs, sizeof(settleUs));
+    }
+  }
+}
+
+// Radio task - received messages, pings, connection status and Serial output
+// Brings the radio up first, while setup() carries on with the display
+void radioTask(void *) {
+  initESPNow();
+  flushOutbox(); // First ping or discovery
+  bootStepDone(BOOT_RADIO);
+
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, radioSleepTicks());
+    taskStatsWake(radioStats);
+
+    // Handle messages queued by the receive callback
+    drainRadioEvents();
+
+    // Check connection status
+    int64_t currentTime = halMicros();
+
+    // Take down the "OK" banner once it has been shown long enough
+    if (okMessageShown && currentTime - okMessageTime >= OK_MESSAGE_DURATION_US) {
+      okMessageShown = false;
+      showBanner(BANNER_NONE);
+    }
+
+    // Send periodic pings if not connected or to maintain connection
+    if (currentTime >= nextPingTime()) {
+      sendPing();
+    }
+
+    // Acks, pongs and the ping go out together
+    flushOutbox();
+
+    // Check if connection timed out: pings unanswered, however far apart they
+    // are, the last given a round trip to be answered
+    if (isConnectedToBottom && unansweredPings >= MISSED_PINGS_LOST && currentTime - lastPingTime >= LINK_MAX_RTT_US &&
+        currentTime - lastPongTime > CONNECTION_TIMEOUT_US) {
+      isConnectedToBottom = false;
+      logEvent(eventLog, LOG_BOTTOM_LOST);
+      printRadioQueueStats();
+      printLinkStats();
+      printTaskStats();
+      okMessageShown = false;
+      showBanner(BANNER_PAIR); // Only drawn while waiting for a run
+    }
+
+    // Look for another bottom unit if ours stays silent
+    if (!discovering && !isConnectedToBottom && currentTime - lastPongTime > CONNECTION_TIMEOUT_US) {
+      discovering = true;
+      logEvent(eventLog, LOG_DISCOVERING);
+    }
+
+    // Print runs finished by the timing task
+    RunResult run;
+    while (queuePop(runResults, run)) {
+      runActive = false;
+      lastActivityTime = halMicros();
+      sendRunResult(run);
+      flushOutbox(); // Report the stop before the slow statistics output
+      printRunResult(run);
+      saveRunRecord(run);
+    }
+    serviceResultRetransmit();
+    flushOutbox();
+
+    // Trace dump, link statistics and pad tuning requests
+    serviceSerialCommands();
+
+    taskStatsSleep(radioStats);
+  }
+}
+
+// History task - commits queued runs and a newly paired bottom unit to flash,
+// waiting while a run is being timed; afterwards erases the next sector if the
+// current one is full, so the next commit only has to program one record
+void historyTask(void *) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(HISTORY_RETRY_INTERVAL));
+    if (readSnapshot().state == RUNNING) continue;
+
+    if (bottomChanged) {
+      bottomChanged = false;
+      halConfigWrite("bottom", bottomDeviceMAC, sizeof(bottomDeviceMAC));
+    }
+    if (queueDepth(historyRecords) == 0) continue;
+
+    RunRecord record;
+    while (queuePop(historyRecords, record)) {
+      if (historyAppend(history, record)) {
+        logEvent(eventLog, LOG_RUN_SAVED, record.sequence);
+      } else {
+        logEvent(eventLog, LOG_RUN_SAVE_FAILED);
+      }
+    }
+    historyPrepare(history);
+  }
+}
+
+// Function to print what the unit does, once it is ready
+void printBanner() {
   Serial.println("Speed Climbing Stopwatch - Stop Timer (Top Unit)");
   Serial.println("=================================================");
-  Serial.print("Device MAC: ");
-  for (int i = 0; i < 6; i++) {
-    Serial.printf("%02X", topDeviceMAC[i]);
-    if (i < 5) Serial.print(":");
-  }
-  Serial.println();
+  Serial.println("Top unit initialized!");
+  Serial.println("- Waiting for connection to bottom unit");
+  Serial.println("- Will show 'PAIR' until connected, then 'OK'");
+  Serial.println("- Press button to stop timer when running (LED turns green)");
+}
+
+// No fixed delays: the radio comes up on core 0 while the display comes up
+// here, and the run history and startup text follow once both are going
+void setup() {
+  Serial.setTxBufferSize(SERIAL_TX_BUFFER);
+  Serial.begin(115200);
   
   // Initialize pins
-  pinMode(BUTTON_PIN, INPUT_PULLUP);
-  pinMode(LED_RED_PIN, OUTPUT);
-  pinMode(LED_GREEN_PIN, OUTPUT);
-  pinMode(LED_BLUE_PIN, OUTPUT);
+  halPinMode(BUTTON_PIN, INPUT_PULLUP);
+  halPinMode(LED_RED_PIN, OUTPUT);
+  halPinMode(LED_GREEN_PIN, OUTPUT);
+  halPinMode(LED_BLUE_PIN, OUTPUT);
   
   // Turn off LED initially
   turnLEDOff();
+  clockSyncReset(clockSync);
+  taskStatsReset(timingStats, "timing");
+  taskStatsReset(displayStats, "display");
+  taskStatsReset(radioStats, "radio");
+  
+  // Display timer
+  frameTimer = halTimerCreate(onFrameTimer, NULL, "frame");
+
+  // Initialize ESP-NOW in the radio task
+  xTaskCreatePinnedToCore(radioTask, "radio", TASK_STACK_SIZE, NULL, RADIO_PRIORITY, &radioTaskHandle, RADIO_CORE);
   
   // Initialize the display
   if (!mx.begin()) {
     Serial.println("ERROR: MAX7219 initialization failed!");
     while(1) {
-      delay(500);
+      halDelay(500);
     }
   }
   
@@ -568,60 +1208,34 @@ void setup() {
   // Configure display settings
   mx.control(MD_MAX72XX::INTENSITY, 15);   // Maximum brightness
   mx.control(MD_MAX72XX::SHUTDOWN, false); // Turn on display
-  clearDisplay();                          // Clear all panels
-  
-  // Initialize ESP-NOW
-  initESPNow();
+  frameBegin(frame, mx);                   // Clear all panels
   
-  Serial.println("Top unit initialized!");
-  Serial.println("- Waiting for connection to bottom unit");
-  Serial.println("- Will show 'PAIR' until connected, then 'OK'");
-  Serial.println("- Press button to stop timer when running (LED turns green)");
-}
+  padFilterReset(stopPad, halDigitalRead(BUTTON_PIN));
+  halConfigRead("settle", (void *)&stopPad.settleUs, sizeof(stopPad.settleUs));
 
-void loop() {
-  // Check connection status
-  unsigned long currentTime = millis();
-  
-  // Send periodic pings if not connected or to maintain connection
-  if (currentTime - lastPingTime >= PING_INTERVAL) {
-    sendPing();
-  }
-  
-  // Check if connection timed out
-  if (isConnectedToBottom && (currentTime - lastPongTime > CONNECTION_TIMEOUT)) {
-    isConnectedToBottom = false;
-    Serial.println("Connection to bottom unit lost!");
-    if (stopwatchState == WAITING) {
-      displayPairMessage();
-    }
-  }
-  
-  // Check button events (stop button)
-  byte buttonEvent = checkButton();
-  
-  if (buttonEvent == 1 && stopwatchState == RUNNING) { // Stop button pressed while running
-    Serial.println("Stop button pressed - Timer stopped, LED GREEN");
-    finalTime = millis() - startTime;
-    stopwatchState = DISPLAYING;
-    setLEDGreen();
-    displayFinalTime();
-    
-    // Print final time to serial
-    float finalTimeSeconds = finalTime / 1000.0;
-    Serial.print("Final time: ");
-    Serial.print(finalTimeSeconds, 2);
-    Serial.println(" seconds");
+  // Display and timing tasks - they pick up any banner or start the radio task has already queued
+  xTaskCreatePinnedToCore(displayTask, "display", TASK_STACK_SIZE, NULL, DISPLAY_PRIORITY, &displayTaskHandle, DISPLAY_CORE);
+  xTaskCreatePinnedToCore(timingTask, "timing", TASK_STACK_SIZE, NULL, TIMING_PRIORITY, &timingTaskHandle, TIMING_CORE);
+  xTaskNotifyGive(timingTaskHandle);
+  if (!halAttachFilteredInterrupt(BUTTON_PIN, onButtonEdge, PAD_GLITCH_NS)) {
+    Serial.println("ERROR: No pulse counter for the stop pad");
   }
-  
-  // Update display if running
-  if (stopwatchState == RUNNING) {
-    static unsigned long lastUpdate = 0;
-    if (millis() - lastUpdate >= 10) {  // Update every 10ms
-      lastUpdate = millis();
-      updateStopwatchDisplay();
-    }
+  bootStepDone(BOOT_DISPLAY);
+
+  // Find the end of the run history and show the last runs
+  if (historyBegin(history)) {
+    printRunHistory();
+  } else {
+    Serial.println("WARNING: No storage partition, runs will not be saved");
   }
-  
-  delay(10); // Small delay for stability
+  xTaskCreatePinnedToCore(historyTask, "history", TASK_STACK_SIZE, NULL, HISTORY_PRIORITY, &historyTaskHandle, HISTORY_CORE);
+  printBanner();
+
+  // Messages from here on go through the log task
+  xTaskCreatePinnedToCore(logDrainTask, "log", TASK_STACK_SIZE, &eventLog, LOG_PRIORITY, NULL, LOG_CORE);
+}
+
+void loop() {
+  // Everything runs in the tasks started by setup()
+  vTaskDelete(NULL);
 }
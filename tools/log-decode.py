@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""Decode deferred log records (include/deferred-log.h) in a Serial stream.
+
+Ordinary text is passed through; binary log frames are turned back into text,
+prefixed with the unit's clock in seconds. Reads a capture file, or stdin to
+follow a live port:
+
+    stty -F /dev/ttyUSB0 115200 raw && cat /dev/ttyUSB0 | log-decode.py
+    log-decode.py capture.bin
+
+Format strings are read from include/log-formats.h next to this script, or
+the file given with --formats; it must match the firmware that sent the log.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+FRAME_START = 0x1E
+DEFAULT_FORMATS = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "include", "log-formats.h")
+SPEC = re.compile(r"%(?:%|[-+ #0]*\d*(?:\.\d+)?([hlLqjzt]*)([diouxXcfeEgG]))")
+
+
+def load_formats(path):
+    """Return the format strings of LOG_FORMATS in ID order."""
+    with open(path) as f:
+        source = f.read()
+    return [bytes(s, "utf-8").decode("unicode_escape")
+            for s in re.findall(r'X\(\s*\w+\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)', source)]
+
+
+def format_message(fmt, args):
+    """Apply C printf conventions the Python % operator lacks (length modifiers, unsigned)."""
+    out = []
+    pos = 0
+    index = 0
+    for m in SPEC.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        if m.group(0) == "%%":
+            out.append("%")
+            continue
+        value = args[index] if index < len(args) else 0
+        index += 1
+        length, conversion = m.group(1), m.group(2)
+        spec = m.group(0).replace(length, "", 1) if length else m.group(0)
+        if conversion in "uoxX" and isinstance(value, int) and value < 0:
+            value &= (1 << 64) - 1 if length.count("l") >= 2 else 0xFFFFFFFF
+        if conversion == "u":
+            spec = spec[:-1] + "d"
+        out.append(spec % value)
+    out.append(fmt[pos:])
+    return "".join(out)
+
+
+class Stream:
+    def __init__(self, f):
+        self.f = f
+
+    def byte(self):
+        b = self.f.read(1)
+        if not b:
+            raise EOFError
+        return b[0]
+
+    def exact(self, n):
+        data = self.f.read(n)
+        if len(data) < n:
+            raise EOFError
+        return data
+
+    def varint(self):
+        shift = 0
+        value = 0
+        while True:
+            b = self.byte()
+            value |= (b & 0x7F) << shift
+            shift += 7
+            if b < 0x80:
+                break
+        return (value >> 1) ^ -(value & 1)
+
+
+def decode(f, formats, out):
+    stream = Stream(f)
+    text = bytearray()
+    base = 0
+    last = None
+    try:
+        while True:
+            b = stream.byte()
+            if b != FRAME_START:
+                text.append(b)
+                if b == ord("\n"):
+                    out.write(text.decode("utf-8", "replace").rstrip("\r\n") + "\n")
+                    out.flush()
+                    text.clear()
+                continue
+
+            fmt_id, argc, double_mask, time_us = struct.unpack("<HBBI", stream.exact(8))
+            args = []
+            for i in range(argc):
+                if double_mask & (1 << i):
+                    args.append(struct.unpack("<d", stream.exact(8))[0])
+                else:
+                    args.append(stream.varint())
+
+            # 32-bit microsecond clock, wraps every 71 minutes
+            if last is not None and time_us < last:
+                base += 1 << 32
+            last = time_us
+            seconds = (base + time_us) / 1e6
+
+            if fmt_id < len(formats):
+                message = format_message(formats[fmt_id], args)
+            else:
+                message = "unknown log format %d %s" % (fmt_id, args)
+            out.write("[%12.6f] %s\n" % (seconds, message))
+            out.flush()
+    except EOFError:
+        if text:
+            out.write(text.decode("utf-8", "replace") + "\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", help="raw serial capture (default: stdin)")
+    parser.add_argument("--formats", default=DEFAULT_FORMATS, help="log-formats.h to read format strings from")
+    args = parser.parse_args()
+
+    formats = load_formats(args.formats)
+    if args.capture is None:
+        decode(sys.stdin.buffer, formats, sys.stdout)
+    else:
+        with open(args.capture, "rb") as f:
+            decode(f, formats, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Decode trace buffer dumps (include/trace-buffer.h) captured from Serial.
+
+Capture the raw serial stream to a file, send 't' to the unit, then:
+
+    trace-decode.py capture.bin                  # text timeline
+    trace-decode.py capture.bin --chrome out.json  # chrome://tracing / Perfetto
+
+Text and log lines around the dumps are skipped. Every dump in the capture is
+decoded; with --dump N only the Nth (from 0).
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b"STRC"
+HEADER = struct.Struct("<4sBBHII")
+RECORD = struct.Struct("<IBBH")
+FLAG_END = 0x01
+FLAG_CORE1 = 0x02
+
+# Must match enum TraceEvent
+EVENT_NAMES = ["checkButton", "OnDataRecv", "updateStopwatchDisplay", "setRow"]
+
+
+def event_name(event):
+    return EVENT_NAMES[event] if event < len(EVENT_NAMES) else "event%d" % event
+
+
+def find_dumps(data):
+    """Yield (cpu_mhz, overwritten, records) for each dump in the capture."""
+    pos = data.find(MAGIC)
+    while pos >= 0:
+        if pos + HEADER.size > len(data):
+            break
+        _, version, record_size, cpu_mhz, count, overwritten = HEADER.unpack_from(data, pos)
+        start = pos + HEADER.size
+        end = start + count * record_size
+        if version != 1 or record_size != RECORD.size or end > len(data):
+            print("skipping damaged dump at offset %d" % pos, file=sys.stderr)
+            pos = data.find(MAGIC, pos + 1)
+            continue
+        records = [RECORD.unpack_from(data, start + i * record_size) for i in range(count)]
+        yield cpu_mhz, overwritten, records
+        pos = data.find(MAGIC, end)
+
+
+def to_events(cpu_mhz, records):
+    """Unwrap each core's cycle counter and convert to microseconds from the first record."""
+    last = {}
+    total = {}
+    events = []
+    for cycles, event, flags, arg in records:
+        core = 1 if flags & FLAG_CORE1 else 0
+        if core in last:
+            total[core] += (cycles - last[core]) & 0xFFFFFFFF
+        else:
+            total[core] = cycles
+        last[core] = cycles
+        events.append((total[core], core, event, bool(flags & FLAG_END), arg))
+    if not events:
+        return []
+    origin = min(e[0] for e in events)
+    return sorted(((c - origin) / cpu_mhz, core, event, end, arg)
+                  for c, core, event, end, arg in events)
+
+
+def print_timeline(events):
+    open_at = {}
+    for ts, core, event, end, arg in events:
+        key = (core, event)
+        if end:
+            begin = open_at.pop(key, None)
+            took = "  %9.3f us" % (ts - begin) if begin is not None else ""
+            print("%12.3f  core%d  end    %-24s%s" % (ts, core, event_name(event), took))
+        else:
+            open_at[key] = ts
+            print("%12.3f  core%d  begin  %-24s arg=%d" % (ts, core, event_name(event), arg))
+
+
+def chrome_trace(events):
+    trace = []
+    for ts, core, event, end, arg in events:
+        entry = {"name": event_name(event), "ph": "E" if end else "B",
+                 "ts": ts, "pid": 0, "tid": core}
+        if not end:
+            entry["args"] = {"arg": arg}
+        trace.append(entry)
+    for core in sorted(set(e[1] for e in events)):
+        trace.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": core,
+                      "args": {"name": "core %d" % core}})
+    return {"traceEvents": trace}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", help="raw serial capture containing one or more dumps")
+    parser.add_argument("--chrome", metavar="FILE", help="write Chrome trace JSON instead of a timeline")
+    parser.add_argument("--dump", type=int, help="only decode this dump (0 = first)")
+    args = parser.parse_args()
+
+    with open(args.capture, "rb") as f:
+        data = f.read()
+
+    dumps = list(find_dumps(data))
+    if not dumps:
+        sys.exit("no trace dumps found in %s" % args.capture)
+    if args.dump is not None:
+        dumps = dumps[args.dump:args.dump + 1]
+
+    # Dumps are laid end to end on the Chrome timeline
+    all_events = []
+    offset = 0.0
+    for index, (cpu_mhz, overwritten, records) in enumerate(dumps):
+        events = to_events(cpu_mhz, records)
+        if args.chrome is None:
+            print("dump %d: %d records at %d MHz, %d older records overwritten"
+                  % (index, len(records), cpu_mhz, overwritten))
+            print_timeline(events)
+        else:
+            all_events += [(ts + offset, core, event, end, arg) for ts, core, event, end, arg in events]
+            if events:
+                offset += events[-1][0] + 1000.0
+
+    if args.chrome is not None:
+        with open(args.chrome, "w") as f:
+            json.dump(chrome_trace(all_events), f)
+        print("wrote %d events to %s" % (len(all_events), args.chrome))
+
+
+if __name__ == "__main__":
+    main()